@@ -34,6 +34,12 @@ public:
     {
         _mm_free(ptr);
     }
+
+    // Без состояния: память любого экземпляра освобождает любой (нужно для swap и присваивания векторов)
+    template <typename T2>
+    bool operator==(const AlignmentAllocator<T2, align>&) const { return true; }
+    template <typename T2>
+    bool operator!=(const AlignmentAllocator<T2, align>&) const { return false; }
 };
 
 template<typename T>
@@ -112,7 +112,7 @@ public:
         DCHECK_ALIGNMENT_16;
 
         __m128 norm_bc = _mm_sqrt_ss(_mm_dp_ps(v4, v4, 0x71)); // Корень из нормы (не берем fourth)
-        return _mm_div_ps(v4, _mm_broadcastss_ps(norm_bc));
+        return _mm_div_ps(v4, _mm_shuffle_ps(norm_bc, norm_bc, 0));
     }
 
     inline float NormSq() const
@@ -151,11 +151,14 @@ public:
     {
         DCHECK_ALIGNMENT_16;
         Matrix4 result = {};
+        // Строка результата - комбинация строк m с коэффициентами строки this: без сборки столбцов m и _mm_dp_ps
         for (size_t i = 0; i < 4; i++)
-         for (size_t j = 0; j < 4; j++)
-             result.rows[i].vals[j] = _mm_cvtss_f32(_mm_dp_ps(rows[i],
-                                                              _mm_set_ps(m.coeffitients[3][j], m.coeffitients[2][j],
-                                                                         m.coeffitients[1][j], m.coeffitients[0][j]), 0xF1));
+        {
+            __m128 row = _mm_mul_ps(_mm_set1_ps(coeffitients[i][0]), m.rows[0]);
+            for (size_t k = 1; k < 4; k++)
+                row = _mm_add_ps(row, _mm_mul_ps(_mm_set1_ps(coeffitients[i][k]), m.rows[k]));
+            result.rows[i] = row;
+        }
         return result;
     }
 
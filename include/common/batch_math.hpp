@@ -0,0 +1,230 @@
+#pragma once
+
+#include "basic_math.hpp"
+#include "cpu_dispatch.hpp"
+
+// Пакеты по 8 векторов в SoA-раскладке: одна компонента всех 8 векторов - в одном регистре,
+// поэтому Dot, Cross и умножение на матрицу - вертикальные операции без перестановок и _mm_dp_ps.
+// Два варианта - параметр шаблона: Isa::Sse41 (по два __m128 на компоненту, базовый) и Isa::Avx2
+// (по __m256, методы с PLANE_RENDER_TARGET_AVX2). Код на пакетах пишется шаблоном от Isa, вариант
+// выбирается во время работы по BatchIsa(ActiveIsa()). Точка входа AVX2-варианта помечается
+// PLANE_RENDER_BATCH_KERNEL_AVX2: иначе методы пакетов не встраиваются в шаблон без target.
+// Умножение и сложение раздельно (без FMA), как и в остальных ядрах: результаты вариантов совпадают бит в бит
+#define PLANE_RENDER_BATCH_KERNEL_AVX2 PLANE_RENDER_TARGET_AVX2 __attribute__((flatten))
+
+namespace plane_render {
+
+constexpr size_t BatchSize = 8;
+
+// Вариант пакетов для уровня isa: AVX-512 пакетам по 8 ничего не добавляет, а ниже AVX2 (и для scalar) -
+// SSE4.1, без которого не собирается basic_math.hpp
+inline Isa BatchIsa(Isa isa)
+{
+    return isa >= Isa::Avx2 ? Isa::Avx2 : Isa::Sse41;
+}
+
+template<Isa I>
+struct Float8;
+
+template<>
+struct Float8<Isa::Sse41>
+{
+public:
+    __m128 lo; // Векторы 0-3
+    __m128 hi; // 4-7
+
+    Float8() = default;
+    Float8(__m128 l, __m128 h) : lo(l), hi(h) {}
+    explicit Float8(float val) : lo(_mm_set1_ps(val)), hi(_mm_set1_ps(val)) {}
+
+    static Float8 Load(const float* src) { return { _mm_loadu_ps(src), _mm_loadu_ps(src + 4) }; }
+    void Store(float* dst) const { _mm_storeu_ps(dst, lo); _mm_storeu_ps(dst + 4, hi); }
+
+    inline Float8 operator+(const Float8& a) const { return { _mm_add_ps(lo, a.lo), _mm_add_ps(hi, a.hi) }; }
+    inline Float8 operator-(const Float8& a) const { return { _mm_sub_ps(lo, a.lo), _mm_sub_ps(hi, a.hi) }; }
+    inline Float8 operator*(const Float8& a) const { return { _mm_mul_ps(lo, a.lo), _mm_mul_ps(hi, a.hi) }; }
+    inline Float8 operator/(const Float8& a) const { return { _mm_div_ps(lo, a.lo), _mm_div_ps(hi, a.hi) }; }
+    inline Float8 Sqrt() const { return { _mm_sqrt_ps(lo), _mm_sqrt_ps(hi) }; }
+
+    // a*b + c
+    static inline Float8 MulAdd(const Float8& a, const Float8& b, const Float8& c) { return a*b + c; }
+};
+
+template<>
+struct Float8<Isa::Avx2>
+{
+public:
+    __m256 v;
+
+    Float8() = default;
+    PLANE_RENDER_TARGET_AVX2 Float8(__m256 val) : v(val) {}
+    PLANE_RENDER_TARGET_AVX2 explicit Float8(float val) : v(_mm256_set1_ps(val)) {}
+
+    PLANE_RENDER_TARGET_AVX2 static Float8 Load(const float* src) { return _mm256_loadu_ps(src); }
+    PLANE_RENDER_TARGET_AVX2 void Store(float* dst) const { _mm256_storeu_ps(dst, v); }
+
+    PLANE_RENDER_TARGET_AVX2 inline Float8 operator+(const Float8& a) const { return _mm256_add_ps(v, a.v); }
+    PLANE_RENDER_TARGET_AVX2 inline Float8 operator-(const Float8& a) const { return _mm256_sub_ps(v, a.v); }
+    PLANE_RENDER_TARGET_AVX2 inline Float8 operator*(const Float8& a) const { return _mm256_mul_ps(v, a.v); }
+    PLANE_RENDER_TARGET_AVX2 inline Float8 operator/(const Float8& a) const { return _mm256_div_ps(v, a.v); }
+    PLANE_RENDER_TARGET_AVX2 inline Float8 Sqrt() const { return _mm256_sqrt_ps(v); }
+
+    PLANE_RENDER_TARGET_AVX2 static inline Float8 MulAdd(const Float8& a, const Float8& b, const Float8& c)
+    {
+        return _mm256_add_ps(_mm256_mul_ps(a.v, b.v), c.v);
+    }
+};
+
+namespace batch_detail {
+
+// Транспонирование 4 x 4 в каждой 128-битной половине: строки (векторы AoS) <-> столбцы (компоненты SoA).
+// Обратно к самому себе
+PLANE_RENDER_TARGET_AVX2 inline void Transpose4(__m256& r0, __m256& r1, __m256& r2, __m256& r3)
+{
+    __m256 const t0 = _mm256_unpacklo_ps(r0, r1); // x0 x1 y0 y1
+    __m256 const t1 = _mm256_unpacklo_ps(r2, r3); // x2 x3 y2 y3
+    __m256 const t2 = _mm256_unpackhi_ps(r0, r1); // z0 z1 w0 w1
+    __m256 const t3 = _mm256_unpackhi_ps(r2, r3); // z2 z3 w2 w3
+    r0 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(1, 0, 1, 0));
+    r1 = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 2, 3, 2));
+    r2 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(1, 0, 1, 0));
+    r3 = _mm256_shuffle_ps(t2, t3, _MM_SHUFFLE(3, 2, 3, 2));
+}
+
+// 8 векторов по 4 float -> 4 компоненты
+PLANE_RENDER_TARGET_AVX2 inline void LoadAoS(const Vector4D* src, Float8<Isa::Avx2> (&out)[4])
+{
+    __m256 r[4];
+    for (size_t i = 0; i < 4; i++)
+        r[i] = _mm256_insertf128_ps(_mm256_castps128_ps256(src[i].v4), src[i + 4].v4, 1); // Векторы i и i+4
+    Transpose4(r[0], r[1], r[2], r[3]);
+    for (size_t i = 0; i < 4; i++)
+        out[i] = r[i];
+}
+
+PLANE_RENDER_TARGET_AVX2 inline void StoreAoS(const Float8<Isa::Avx2> (&in)[4], Vector4D* dst)
+{
+    __m256 r[4] = { in[0].v, in[1].v, in[2].v, in[3].v };
+    Transpose4(r[0], r[1], r[2], r[3]);
+    for (size_t i = 0; i < 4; i++)
+    {
+        dst[i].v4 = _mm256_castps256_ps128(r[i]);
+        dst[i + 4].v4 = _mm256_extractf128_ps(r[i], 1);
+    }
+}
+
+inline void LoadAoS(const Vector4D* src, Float8<Isa::Sse41> (&out)[4])
+{
+    __m128 lo[4] = { src[0], src[1], src[2], src[3] };
+    __m128 hi[4] = { src[4], src[5], src[6], src[7] };
+    _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+    _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+    for (size_t i = 0; i < 4; i++)
+        out[i] = { lo[i], hi[i] };
+}
+
+inline void StoreAoS(const Float8<Isa::Sse41> (&in)[4], Vector4D* dst)
+{
+    __m128 lo[4] = { in[0].lo, in[1].lo, in[2].lo, in[3].lo };
+    __m128 hi[4] = { in[0].hi, in[1].hi, in[2].hi, in[3].hi };
+    _MM_TRANSPOSE4_PS(lo[0], lo[1], lo[2], lo[3]);
+    _MM_TRANSPOSE4_PS(hi[0], hi[1], hi[2], hi[3]);
+    for (size_t i = 0; i < 4; i++)
+    {
+        dst[i].v4 = lo[i];
+        dst[i + 4].v4 = hi[i];
+    }
+}
+
+} // namespace batch_detail
+
+template<Isa I>
+struct Vec3x8
+{
+public:
+    Float8<I> x;
+    Float8<I> y;
+    Float8<I> z;
+
+public:
+    // 8 векторов подряд (fourth не используется)
+    static Vec3x8 Load(const FastVector3D* src)
+    {
+        Float8<I> c[4];
+        batch_detail::LoadAoS(src, c);
+        return { c[0], c[1], c[2] };
+    }
+    // fourth записывается нулем
+    void Store(FastVector3D* dst) const
+    {
+        Float8<I> const c[4] = { x, y, z, Float8<I>(0.f) };
+        batch_detail::StoreAoS(c, dst);
+    }
+
+    inline Vec3x8 operator+(const Vec3x8& a) const { return { x + a.x, y + a.y, z + a.z }; }
+    inline Vec3x8 operator-(const Vec3x8& a) const { return { x - a.x, y - a.y, z - a.z }; }
+    inline Vec3x8 operator*(const Float8<I>& k) const { return { x*k, y*k, z*k }; }
+
+    inline Float8<I> Dot(const Vec3x8& a) const { return Float8<I>::MulAdd(x, a.x, Float8<I>::MulAdd(y, a.y, z*a.z)); }
+    inline Float8<I> NormSq() const { return Dot(*this); }
+    inline Vec3x8 Normalized() const { return *this * (Float8<I>(1.f) / NormSq().Sqrt()); }
+
+    inline Vec3x8 Cross(const Vec3x8& a) const
+    {
+        return { y*a.z - z*a.y, z*a.x - x*a.z, x*a.y - y*a.x };
+    }
+};
+
+template<Isa I>
+struct Vec4x8
+{
+public:
+    Float8<I> x;
+    Float8<I> y;
+    Float8<I> z;
+    Float8<I> fourth;
+
+public:
+    static Vec4x8 Load(const Vector4D* src) // 8 векторов подряд
+    {
+        Float8<I> c[4];
+        batch_detail::LoadAoS(src, c);
+        return { c[0], c[1], c[2], c[3] };
+    }
+    void Store(Vector4D* dst) const
+    {
+        Float8<I> const c[4] = { x, y, z, fourth };
+        batch_detail::StoreAoS(c, dst);
+    }
+
+    inline Vec4x8 operator+(const Vec4x8& a) const { return { x + a.x, y + a.y, z + a.z, fourth + a.fourth }; }
+    inline Vec4x8 operator-(const Vec4x8& a) const { return { x - a.x, y - a.y, z - a.z, fourth - a.fourth }; }
+    inline Vec4x8 operator*(const Float8<I>& k) const { return { x*k, y*k, z*k, fourth*k }; }
+};
+
+// Matrix4 с коэффициентами, размноженными на 8 дорожек: строится один раз на пакеты с одной матрицей
+template<Isa I>
+struct Mat4x8
+{
+public:
+    Float8<I> c[4][4];
+
+public:
+    explicit Mat4x8(const Matrix4& m)
+    {
+        for (size_t i = 0; i < 4; i++)
+         for (size_t j = 0; j < 4; j++)
+             c[i][j] = Float8<I>(m.coeffitients[i][j]);
+    }
+
+    // Умножение на 8 векторов-столбцов
+    inline Vec4x8<I> operator*(const Vec4x8<I>& v) const
+    {
+        Float8<I> r[4];
+        for (size_t i = 0; i < 4; i++)
+            r[i] = Float8<I>::MulAdd(c[i][0], v.x, Float8<I>::MulAdd(c[i][1], v.y, Float8<I>::MulAdd(c[i][2], v.z, c[i][3]*v.fourth)));
+        return { r[0], r[1], r[2], r[3] };
+    }
+};
+
+} // namespace plane_render
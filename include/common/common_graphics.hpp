@@ -13,7 +13,7 @@ struct Point2D
 // Screen coordinates (in pixels)
 typedef int ScreenDimension;
 using PixelPoint = Point2D<ScreenDimension>;
-using PixelPointF = Point2D<float>; // Для ускорения некоторых расчетов, храним все равно целые
+using PixelPointF = Point2D<float>; // Для ускорения некоторых расчетов, храним с точностью до долей пикселя
 
 // Colors
 struct Color // Order for SDL
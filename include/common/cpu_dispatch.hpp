@@ -0,0 +1,32 @@
+#pragma once
+
+// Выбор вариантов горячих ядер во время работы. Библиотеки собираются под SSE4.1 (без него не обходится
+// basic_math.hpp), а варианты ядер на широких векторах - отдельные функции с атрибутом target:
+// вызываются, только если их поддерживает процессор (cpuid). Так одна сборка работает на любой машине
+// с SSE4.1 и на каждой использует лучшее, что та умеет.
+// Результаты вариантов совпадают бит в бит: FMA в target AVX2 не включается, а для AVX-512 (он FMA подразумевает)
+// слияние умножений со сложениями выключено при сборке (-ffp-contract=off в CMakeLists.txt)
+#define PLANE_RENDER_TARGET_AVX2   __attribute__((target("avx2")))
+#define PLANE_RENDER_TARGET_AVX512 __attribute__((target("avx2,avx512f,avx512bw,avx512vl")))
+
+namespace plane_render {
+
+// По возрастанию: каждый уровень включает предыдущие
+enum class Isa
+{
+    Scalar, // Ядра без векторов - запасной вариант и эталон для сравнения
+    Sse41,
+    Avx2,
+    Avx512  // F + BW + VL
+};
+
+// Что поддерживают процессор и ОС
+Isa DetectIsa();
+
+// Уровень, под который выбираются ядра: DetectIsa(), ограниченный сверху переменной окружения
+// PLANE_RENDER_ISA (scalar, sse4.1, avx2, avx512). Определяется при первом вызове и пишется в лог
+Isa ActiveIsa();
+
+const char* IsaName(Isa isa);
+
+} // namespace plane_render
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+// Статистика ожидания на спинлоках (ScreenBuffer, ListMT). Собирается только при LOCK_STATS_ENABLED:
+// в debug всегда, в release - с -DPLANE_RENDER_LOCK_STATS (cmake -DLOCK_STATS=ON). Иначе код вырезается целиком
+#if defined(PLANE_RENDER_LOCK_STATS) || defined(_DEBUG)
+    #define LOCK_STATS_ENABLED
+#endif
+
+namespace plane_render {
+
+struct LockStats
+{
+    uint64_t acquires = 0;   // Успешные захваты
+    uint64_t failed_cas = 0; // Неудачные попытки захвата
+    uint64_t yields = 0;
+    uint64_t wait_ns = 0;    // От первой неудачной попытки до захвата
+
+    LockStats& operator+=(const LockStats& other)
+    {
+        acquires += other.acquires;
+        failed_cas += other.failed_cas;
+        yields += other.yields;
+        wait_ns += other.wait_ns;
+        return *this;
+    }
+};
+
+// Ожидание одного захвата. Копится в потоке до успеха, а в общий LockStats добавляется
+// уже под захваченным спинлоком - поэтому сама статистика обходится без атомиков
+class LockWaitCounter
+{
+public:
+    void Failed()
+    {
+        if (failed_cas_++ == 0)
+            start_ = std::chrono::steady_clock::now();
+    }
+    void Yield() { yields_++; }
+
+    void AddTo(LockStats& stats) const
+    {
+        stats.acquires++;
+        if (failed_cas_ == 0)
+            return;
+        stats.failed_cas += failed_cas_;
+        stats.yields += yields_;
+        stats.wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                             std::chrono::steady_clock::now() - start_).count();
+    }
+
+private:
+    uint64_t failed_cas_ = 0;
+    uint64_t yields_ = 0;
+    std::chrono::steady_clock::time_point start_;
+};
+
+} // namespace plane_render
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace plane_render {
+
+// Аппаратные счетчики (perf_event_open, только Linux) вокруг стадий конвейера.
+// Каждый поток открывает свои счетчики при первом замере: две группы (аппаратная и программная),
+// поэтому замер - это два read. Счетчики, которые ядро не дало открыть (виртуалка, perf_event_paranoid),
+// помечаются недоступными, остальные работают.
+// Суммы копятся по потокам и стадиям, Totals() складывает их по именам стадий
+class PerfCounters
+{
+public:
+    enum Event
+    {
+        Cycles,
+        Instructions,
+        L1DMisses,      // Промахи L1 данных на чтение
+        LLCMisses,      // Промахи последнего уровня кэша
+        BranchMisses,
+        ContextSwitches, // Программный счетчик: видно ожидание в LockRow (там yield)
+        EventsCount
+    };
+
+    struct Values
+    {
+        double values[EventsCount] = {}; // С поправкой на мультиплексирование, поэтому не целые
+    };
+
+    struct StageTotals
+    {
+        std::string name;
+        uint64_t samples = 0; // Сколько раз стадия измерялась
+        Values totals;
+    };
+
+    static constexpr size_t GroupsCount = 2; // Аппаратная и программная группы
+
+    // Сырые показания групп на момент замера
+    struct Sample
+    {
+        uint64_t values[EventsCount] = {};
+        uint64_t enabled[GroupsCount] = {};
+        uint64_t running[GroupsCount] = {};
+    };
+
+public:
+    static PerfCounters& Instance();
+    static const char* EventName(Event event);
+
+    // Включает замеры PerfCountersScope. Выключенные стоят одну relaxed-загрузку
+    void SetEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    bool IsEnabled() const        { return enabled_.load(std::memory_order_relaxed); }
+
+    // Открылся ли счетчик хотя бы в одном потоке
+    bool IsAvailable(Event event) const { return (available_mask_.load(std::memory_order_relaxed) >> event) & 1; }
+
+    // Показания счетчиков текущего потока (при первом вызове в потоке - открывает их)
+    void Read(Sample& sample);
+    // Добавляет разницу двух показаний к стадии stage текущего потока. stage - строковый литерал
+    void Add(const char* stage, const Sample& begin, const Sample& end);
+
+    // Оба метода - только когда никто не измеряет (например, между кадрами)
+    std::vector<StageTotals> Totals() const;
+    void Reset();
+
+private:
+    struct ThreadTotals
+    {
+        struct Stage
+        {
+            const char* name;
+            uint64_t samples;
+            Values totals;
+        };
+        std::vector<Stage> stages; // Стадий немного, ищем линейно по указателю
+    };
+    struct ThreadCounters;
+
+private:
+    PerfCounters() = default;
+    ThreadCounters& Local();
+
+private:
+    static thread_local std::unique_ptr<ThreadCounters> local_;
+
+    std::atomic<bool> enabled_{false};
+    std::atomic<uint32_t> available_mask_{0};
+
+    mutable std::mutex totals_mutex_; // Только регистрация потоков, Totals и Reset
+    std::vector<std::unique_ptr<ThreadTotals>> totals_;
+};
+
+// Замер счетчиков от создания до разрушения объекта
+class PerfCountersScope
+{
+public:
+    explicit PerfCountersScope(const char* stage) :
+        stage_(stage), active_(PerfCounters::Instance().IsEnabled())
+    {
+        if (active_)
+            PerfCounters::Instance().Read(begin_);
+    }
+    PerfCountersScope(const PerfCountersScope&) = delete;
+    PerfCountersScope& operator=(const PerfCountersScope&) = delete;
+
+    ~PerfCountersScope()
+    {
+        if (!active_)
+            return;
+        PerfCounters::Sample end;
+        PerfCounters::Instance().Read(end);
+        PerfCounters::Instance().Add(stage_, begin_, end);
+    }
+
+private:
+    const char* stage_;
+    bool active_;
+    PerfCounters::Sample begin_;
+};
+
+#define PERF_COUNTERS_SCOPE_CONCAT_IMPL(a, b) a##b
+#define PERF_COUNTERS_SCOPE_CONCAT(a, b) PERF_COUNTERS_SCOPE_CONCAT_IMPL(a, b)
+#define PERF_COUNTERS_SCOPE(stage) ::plane_render::PerfCountersScope PERF_COUNTERS_SCOPE_CONCAT(perf_scope_, __LINE__)(stage)
+
+} // namespace plane_render
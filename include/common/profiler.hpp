@@ -0,0 +1,113 @@
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace plane_render {
+
+// Профилировщик стадий кадра. Каждый поток пишет события в свой кольцевой буфер без блокировок
+// (мьютекс берется только один раз - при регистрации потока), старые события затираются новыми.
+// Выключенный профилировщик стоит одну relaxed-загрузку на замер.
+// Результат - JSON в формате Chrome trace events (открывается в Perfetto / chrome://tracing)
+class Profiler
+{
+public:
+    static constexpr size_t RingCapacity = 1 << 15; // Событий на поток, степень двойки
+    static constexpr int64_t NoValue = -1;
+
+    using Clock = std::chrono::steady_clock;
+
+    struct Event
+    {
+        const char* name; // Только строковые литералы: указатель хранится до экспорта
+        uint64_t start_ns;
+        uint64_t duration_ns;
+        int64_t value; // Попадает в args, если != NoValue (например, число треугольников в задании)
+    };
+
+public:
+    static Profiler& Instance();
+
+    void SetEnabled(bool enabled) { enabled_.store(enabled, std::memory_order_relaxed); }
+    bool IsEnabled() const        { return enabled_.load(std::memory_order_relaxed); }
+
+    // Наносекунды от создания профилировщика
+    uint64_t NowNs() const
+    {
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(Clock::now() - start_).count();
+    }
+
+    // Вызывается из потока, к которому относится событие
+    void Record(const char* name, uint64_t start_ns, uint64_t end_ns, int64_t value = NoValue);
+
+    // Имя текущего потока в трассе. Буфер при этом не создается - только при первом событии
+    static void SetThreadName(const std::string& name);
+
+    // Оба метода - только когда никто не пишет события (например, между кадрами)
+    bool WriteChromeTrace(const std::string& filename) const;
+    void Reset();
+
+private:
+    // Один писатель - свой поток
+    struct ThreadBuffer
+    {
+        size_t id;
+        std::string name;
+        std::atomic<uint64_t> written{0}; // Всего записано событий (индекс в кольце - по модулю)
+        std::vector<Event> events;
+    };
+
+private:
+    Profiler();
+    ThreadBuffer& LocalBuffer();
+
+private:
+    static thread_local ThreadBuffer* local_buffer_;
+    static thread_local std::string local_thread_name_; // До создания буфера потока
+
+    Clock::time_point const start_;
+    std::atomic<bool> enabled_{false};
+
+    mutable std::mutex buffers_mutex_; // Только регистрация потоков и экспорт
+    std::vector<std::unique_ptr<ThreadBuffer>> buffers_;
+};
+
+// Замер от создания до разрушения объекта
+class ProfileScope
+{
+public:
+    explicit ProfileScope(const char* name, int64_t value = Profiler::NoValue) :
+        name_(name), value_(value)
+    {
+        if (Profiler::Instance().IsEnabled())
+            start_ns_ = Profiler::Instance().NowNs();
+    }
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+    ~ProfileScope()
+    {
+        if (start_ns_ != NotStarted)
+            Profiler::Instance().Record(name_, start_ns_, Profiler::Instance().NowNs(), value_);
+    }
+
+    void SetValue(int64_t value) { value_ = value; }
+
+private:
+    static constexpr uint64_t NotStarted = ~uint64_t(0);
+
+    const char* name_;
+    int64_t value_;
+    uint64_t start_ns_ = NotStarted;
+};
+
+#define PROFILE_SCOPE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_SCOPE_CONCAT(a, b) PROFILE_SCOPE_CONCAT_IMPL(a, b)
+#define PROFILE_SCOPE(...) ::plane_render::ProfileScope PROFILE_SCOPE_CONCAT(profile_scope_, __LINE__)(__VA_ARGS__)
+
+} // namespace plane_render
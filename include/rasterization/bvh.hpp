@@ -0,0 +1,109 @@
+#pragma once
+
+#include "rasterization/scene_object.hpp"
+#include "threadpool/threadpool.hpp"
+
+#include "common/cpu_dispatch.hpp"
+
+#include <functional>
+#include <vector>
+
+namespace plane_render {
+
+// Результат трассировки луча origin + t*dir
+struct RayHit
+{
+    static constexpr uint32_t None = ~0u;
+
+    float t = 0.f;
+    float u = 0.f; // Барицентрические координаты точки: P = (1 - u - v)*A + u*B + v*C
+    float v = 0.f;
+    uint32_t triangle = None; // Номер в Bvh (см. Bvh::TriangleSource)
+};
+
+// Иерархия описывающих параллелепипедов над треугольниками мешей (полная детализация, с учетом Position)
+// в исходных координатах. Строится сверху вниз с поверхностной эвристикой (SAH) по корзинам: верхние уровни -
+// в вызывающем потоке, поддеревья - параллельно на пуле. Узлы по 32 байта (два в кэш-линии) в порядке обхода
+// в глубину: левый потомок - следующий узел. Глубина - не больше MaxDepth (стек обхода): ближе к нему узлы
+// делятся по медиане, а не по SAH. Лист - до LeafSize треугольников в одном блоке SoA, тест
+// Мёллера-Трумбора на блоке - за один проход AVX2 (по ActiveIsa(), иначе по одному треугольнику)
+class Bvh
+{
+public:
+    static constexpr size_t LeafSize = 8;
+    static constexpr size_t Bins = 16;
+    static constexpr size_t MaxDepth = 64;
+
+    // Откуда треугольник: объект и номер первой вершины в его LodIndices(0)
+    struct Source
+    {
+        uint32_t object;
+        uint32_t first_index;
+    };
+
+public:
+    // По объектам objects[i] с use(i) (пустой use - по всем); номера в Source - в objects
+    Bvh(const std::vector<SceneObject>& objects, ThreadPool& pool, const std::function<bool(size_t)>& use = nullptr);
+    Bvh(const Bvh&) = delete;
+    Bvh& operator=(const Bvh&) = delete;
+
+    // Ближайшее пересечение с t в (t_min, t_max). false - если его нет (hit не меняется)
+    bool Intersect(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max, RayHit& hit) const;
+    // Есть ли любое пересечение с t в (t_min, t_max) - для теней
+    bool Occluded(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max) const;
+
+    const Source& TriangleSource(uint32_t triangle) const { return sources_[triangle]; }
+    // Нормаль плоскости треугольника (не нормированная, направление - по обходу A, B, C)
+    FastVector3D GeometricNormal(uint32_t triangle) const;
+
+    size_t TrianglesCount() const { return sources_.size(); }
+    size_t NodesCount()     const { return nodes_.size(); }
+
+private:
+    struct alignas(32) Node
+    {
+        float mins[3];
+        uint32_t offset; // Лист - номер блока треугольников, внутренний узел - правый потомок
+        float maxs[3];
+        uint16_t count;  // Треугольников в листе, 0 - внутренний узел
+        uint16_t axis;   // Ось разбиения: ближний по направлению луча потомок обходится первым
+    };
+    static_assert(sizeof(Node) == 32, "Two nodes per cache line");
+
+    // Треугольники листа: A, ребра AB и AC по компонентам. Пустые дорожки - вырожденные (ребра нулевые)
+    struct alignas(32) TriangleBlock
+    {
+        float a[3][LeafSize];
+        float e1[3][LeafSize];
+        float e2[3][LeafSize];
+        uint32_t id[LeafSize];
+    };
+
+    struct BuildNode;
+    struct BuildContext; // Границы и центры треугольников, их порядок по листьям
+
+    // Строит поддерево узла над треугольниками ctx.order[node.begin, node.end). Узлы меньше defer_below
+    // треугольников не строит, а складывает в deferred - их достраивают задания на пуле
+    void BuildNodeSubtree(BuildContext& ctx, BuildNode& node, size_t defer_below, std::vector<BuildNode*>* deferred);
+    // Перекладывает дерево сборки в nodes_ и blocks_ в порядке обхода в глубину
+    void Flatten(const BuildNode& node, const BuildContext& ctx, size_t depth);
+
+    template<bool AnyHit>
+    bool Traverse(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max, RayHit* hit) const;
+    // Ближайшее попадание в блок с t в (t_min, t_max): t_max и hit обновляются. Варианты - по isa_
+    bool IntersectBlock(const TriangleBlock& block, const FastVector3D& origin, const FastVector3D& dir,
+                        float t_min, float& t_max, RayHit* hit) const;
+    bool IntersectBlockScalar(const TriangleBlock& block, const FastVector3D& origin, const FastVector3D& dir,
+                              float t_min, float& t_max, RayHit* hit) const;
+    PLANE_RENDER_TARGET_AVX2 bool IntersectBlockAvx2(const TriangleBlock& block, const FastVector3D& origin,
+                                                     const FastVector3D& dir, float t_min, float& t_max, RayHit* hit) const;
+
+private:
+    std::vector<Node, AlignmentAllocator<Node, 64>> nodes_;
+    std::vector<TriangleBlock, AlignmentAllocator<TriangleBlock, 64>> blocks_;
+    std::vector<Source> sources_;
+    Vec4DynamicArray corners_; // По 3 вершины на треугольник (A, B, C) - для сборки и GeometricNormal
+    Isa isa_;
+};
+
+} // namespace plane_render
@@ -3,6 +3,7 @@
 #include "rasterization/rasterizer.hpp"
 #include "rasterization/texture.hpp"
 #include "rasterization/graphics_types.hpp"
+#include "rasterization/shadow_map.hpp"
 
 namespace plane_render {
 
@@ -17,6 +18,9 @@ public:
     void LoadTexture(const std::string& texture_name);
     const Texture* GetTexture() const { return &texture_; }
 
+    // Карта теней (nullptr - без теней): рассеянная и зеркальная части PhongLight умножаются на ее Visibility
+    void SetShadowMap(const ShadowMap* shadow_map) { shadow_map_ = shadow_map; }
+
     inline float PhongLight(const Vertex& avg_vertex) const
     {
         FastVector3D light = (geom_->LightPos() - avg_vertex.vertex_coords);
@@ -30,7 +34,11 @@ public:
         // std::pow убивает производительность!
         //float spec = std::pow(prod, lightN_);
         float spec = Pow(prod, lightN_);
-        return 0.2f + 0.4f*diff + 0.4f*spec;
+        if (!shadow_map_)
+            return 0.2f + 0.4f*diff + 0.4f*spec;
+        if (diff == 0.f && spec == 0.f)
+            return 0.2f; // Выборка из карты не нужна
+        return 0.2f + (0.4f*diff + 0.4f*spec) * shadow_map_->Visibility(avg_vertex.vertex_coords);
     }
 
     virtual Color ProcessFragment(const Vertex& vertex_avg) const;
@@ -38,6 +46,7 @@ public:
 protected:
     RenderingGeometryConstPtr geom_;
     Texture texture_;
+    const ShadowMap* shadow_map_ = nullptr;
 
 private:
     static constexpr size_t lightN_ = 3;
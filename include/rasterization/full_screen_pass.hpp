@@ -0,0 +1,33 @@
+#pragma once
+
+#include "rasterization/screen_buffer.hpp"
+
+namespace plane_render {
+
+// Полноэкранный (вычислительный) проход по кадру вместо растеризации прямоугольника во весь экран: без
+// барицентрических координат, спинлоков рядов, теста глубины и AverageVertices на каждом пикселе.
+// RasterizationPipeline после растеризации объектов вызывает BeginFrame, затем ProcessTile для каждой
+// плитки ScreenBuffer - параллельно на пуле. Плитка получает свои пиксели и глубину (см. ScreenBuffer::TileSpan),
+// пишет в них без блокировок; координаты пикселя в кадре - span.x0 + x, span.y0 + y.
+// На этом строятся трассировка лучей и постобработка
+class FullScreenPass
+{
+public:
+    FullScreenPass(const RenderingGeometryConstPtr& geom) : geom_(geom) {}
+    FullScreenPass(const FullScreenPass&) = delete;
+    FullScreenPass& operator=(const FullScreenPass&) = delete;
+    virtual ~FullScreenPass() {}
+
+    // Один раз на кадр, в вызывающем потоке, до плиток: общие для всех пикселей величины (камера, свет)
+    virtual void BeginFrame() {}
+    // Из потоков пула, для каждой плитки кадра ровно один раз
+    virtual void ProcessTile(const ScreenBuffer::TileSpan& span) = 0;
+
+protected:
+    const RenderingGeometry& GetGeom() const { return *geom_; }
+
+private:
+    RenderingGeometryConstPtr geom_;
+};
+
+} // namespace plane_render
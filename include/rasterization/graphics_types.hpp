@@ -10,6 +10,8 @@
 #include <vector>
 #include <memory>
 #include <cmath>
+#include <cstdint>
+#include <algorithm>
 
 namespace plane_render {
 
@@ -72,99 +74,166 @@ typedef VectorAlignment16<Vertex> VerticesVector;
 // Triangles
 typedef std::vector<size_t> IndicesList;
 
-// Барицентрические координаты
-// Приватно наследуемся, чтобы скрыть +, -, *
-struct alignas(16) BaricentricCoords : private Vector4D
+// Растеризация ведется в фиксированной точке 28.4: пиксельные координаты вершин привязаны к сетке 1/16 пикселя
+constexpr int SubpixelBits = 4;
+constexpr int SubpixelSteps = 1 << SubpixelBits;
+// Треугольники с вершинами дальше от экрана отбрасываются: иначе переполнятся реберные функции (int64)
+constexpr float GuardBandPx = static_cast<float>(1 << 22);
+
+// Прямоугольник пикселей, границы включительно. По умолчанию пустой
+struct ScreenRect
 {
-public:
-    // Информация для расчета БЦ-координат, которая зависит только от вершин треугольника
-    struct alignas(16) BCPrecalculated
+    PixelPoint mins = {0, 0};
+    PixelPoint maxs = {-1, -1};
+
+    static ScreenRect Screen(ScreenDimension w, ScreenDimension h) { return { {0, 0}, {w-1, h-1} }; }
+
+    inline bool IsEmpty() const { return mins.x > maxs.x || mins.y > maxs.y; }
+    inline size_t Area()  const { return IsEmpty() ? 0 : static_cast<size_t>(maxs.x - mins.x + 1) * (maxs.y - mins.y + 1); }
+
+    // Описывающий прямоугольник объединения
+    inline void Extend(const ScreenRect& r)
     {
-    private:
-        __m128 z_inv_; // 1/z1, 1/z2, 1/z3, 1.0 - для скалярного произведения с ним в пересчете в мировые
-        Point2D<float> BA_d_; // _d - уже с делением на знаменатель: 3й элемент векторного произведения
-        Point2D<float> CA_d_;
-        float denom_;
-
-    public:
-        // Вызывающий обязан: 1) проверить denom != 0.f: не является ли треугольник вырожденным - IsValid()
-        //                    2) обеспечить abs(z_coord) <= -GraphicsEps
-        inline BCPrecalculated(const Vertex& A, const Vertex& B, const Vertex& C) :
-            BA_d_{B.pixel_pos.x - A.pixel_pos.x,
-                  B.pixel_pos.y - A.pixel_pos.y},
-            CA_d_{C.pixel_pos.x - A.pixel_pos.x,
-                  C.pixel_pos.y - A.pixel_pos.y}
+        if (r.IsEmpty())
+            return;
+        if (IsEmpty())
         {
-            DCHECK_ALIGNMENT_16;
-            // Нельзя использовать точки с положительными и нулевыми z
-            DCHECK(A.vertex_coords.z <= -GraphicsEps && B.vertex_coords.z <= -GraphicsEps && C.vertex_coords.z <= -GraphicsEps);
-
-            denom_ = BA_d_.x*CA_d_.y - CA_d_.x*BA_d_.y;
-            // Замедляет, но не имеет эффекта
-            //if (std::abs(denom_) < GraphicsEps) // Вырожденный треугольник
-            //{
-            //    denom_ = 0.f;
-            //    return;
-            //}
-
-            BA_d_.x /= denom_; BA_d_.y /= denom_;
-            CA_d_.x /= denom_; CA_d_.y /= denom_;
-
-            z_inv_ = _mm_set_ps(0.f, 1/C.vertex_coords.z, 1/B.vertex_coords.z, 1/A.vertex_coords.z);
+            *this = r;
+            return;
         }
-        inline bool IsValid() const { return denom_ != 0.f; }
+        mins = { std::min(mins.x, r.mins.x), std::min(mins.y, r.mins.y) };
+        maxs = { std::max(maxs.x, r.maxs.x), std::max(maxs.y, r.maxs.y) };
+    }
+
+    inline bool Intersects(const ScreenRect& r) const
+    {
+        return !IsEmpty() && !r.IsEmpty() && mins.x <= r.maxs.x && r.mins.x <= maxs.x && mins.y <= r.maxs.y && r.mins.y <= maxs.y;
+    }
+};
+
+// Подготовка треугольника к растеризации: реберные функции в целых числах - точные
+// Правило заполнения top-left: пиксель на общем ребре двух треугольников достается ровно одному из них
+struct alignas(16) TriangleSetup
+{
+public:
+    // E(x, y) для центра пикселя (x, y). Внутри треугольника E + bias >= 0
+    struct Edge
+    {
+        int64_t origin = 0; // E(0, 0)
+        int64_t step_x = 0; // Приращение при x + 1
+        int64_t step_y = 0; // Приращение при y + 1
+        int64_t bias = 0;   // 0 для top-left ребер, -1 для остальных: точки на таких ребрах не покрываются
 
-        friend struct BaricentricCoords;
+        inline int64_t At(ScreenDimension x, ScreenDimension y) const { return origin + step_x*x + step_y*y; }
     };
 
+    __m128 z_inv; // 1/z0, 1/z1, 1/z2, 0 - для перехода к мировым БЦ-координатам
+    const Vertex* v[3] = {}; // Вершины в порядке положительной ориентации
+    Edge edges[3]; // edges[i] - ребро напротив v[i]: E_i(v[i]) = area, E_i пропорциональна i-й БЦ-координате
+    int64_t area = 0; // Удвоенная площадь в единицах (1/16 px)^2, > 0 у валидного треугольника
+
+    // Пиксели-кандидаты: центры внутри описывающего прямоугольника, без обрезки по экрану
+    PixelPoint mins = {0, 0};
+    PixelPoint maxs = {-1, -1};
+
 private:
-    bool is_valid_ = true;
+    Point2D<int64_t> span_ = {0, 0}; // Размер описывающего прямоугольника в 1/16 px
 
 public:
-    /*  Point2D<float> BA{(float) B.x - A.x, (float) B.y - A.y};
-        Point2D<float> CA{(float) C.x - A.x, (float) C.y - A.y};
-        Point2D<float> AP{(float) A.x - p.x, (float) A.y - p.y};
-        float denom = BA.x*CA.y - CA.x*BA.y;
-
-        float comp_b = (CA.x*AP.y - AP.x*CA.y) / denom;
-        float comp_c = (AP.x*BA.y - BA.x*AP.y) / denom;
-        BaricentricCoords res_new = { 1.f - comp_b - comp_c, comp_b, comp_c }; */
-
-    // Нельзя использовать с невалидным BCPrecalculated (где denom = 0 - вырожденный треугольник)
-    // Вершина A - чтобы посчитать AP
-    // После вызова проверять IsValid()!
-    inline BaricentricCoords(const BCPrecalculated& bcp, const Vertex& A, const PixelPoint& p)
+    // Вызывающий обязан обеспечить z <= -GraphicsEps у всех вершин
+    inline TriangleSetup(const Vertex& A, const Vertex& B, const Vertex& C)
     {
         DCHECK_ALIGNMENT_16;
-        DCHECK(std::abs(bcp.denom_) >= GraphicsEps);
+        // Нельзя использовать точки с положительными и нулевыми z
+        DCHECK(A.vertex_coords.z <= -GraphicsEps && B.vertex_coords.z <= -GraphicsEps && C.vertex_coords.z <= -GraphicsEps);
 
-        Point2D<float> AP{ A.pixel_pos.x - p.x, A.pixel_pos.y - p.y};
-        float comp_b = bcp.CA_d_.x*AP.y - AP.x*bcp.CA_d_.y;
-        float comp_c = AP.x*bcp.BA_d_.y - bcp.BA_d_.x*AP.y;
-        v4 = _mm_set_ps(0.f, comp_c, comp_b, 1.f - comp_b - comp_c);
-
-        // Проверяем, все ли значения >= 0
-        __m128 comp_raw = _mm_cmplt_ps(v4, _mm_set1_ps((float) -1e-4));
-        int comp = _mm_movemask_ps(comp_raw);
-        if (comp)
+        // Координаты уже на сетке 1/16 (см. RenderingGeometry::SetPixelPos) - перевод точный
+        Point2D<int64_t> p[3];
+        const Vertex* src[3] = { &A, &B, &C };
+        for (size_t i = 0; i < 3; i++)
         {
-            is_valid_ = false;
+            // Отрицание сравнения - чтобы NaN тоже отбрасывались
+            if (!(std::abs(src[i]->pixel_pos.x) < GuardBandPx && std::abs(src[i]->pixel_pos.y) < GuardBandPx))
+                return;
+            p[i] = { static_cast<int64_t>(src[i]->pixel_pos.x * SubpixelSteps),
+                     static_cast<int64_t>(src[i]->pixel_pos.y * SubpixelSteps) };
+        }
+
+        area = (p[1].x - p[0].x)*(p[2].y - p[0].y) - (p[1].y - p[0].y)*(p[2].x - p[0].x);
+        if (area == 0) // Вырожденный треугольник
             return;
+        if (area < 0) // Приводим к положительной ориентации
+        {
+            std::swap(p[1], p[2]);
+            std::swap(src[1], src[2]);
+            area = -area;
+        }
+
+        for (size_t i = 0; i < 3; i++)
+        {
+            v[i] = src[i];
+
+            const auto& p0 = p[(i + 1) % 3];
+            const auto& p1 = p[(i + 2) % 3];
+            int64_t dx = p1.x - p0.x;
+            int64_t dy = p1.y - p0.y;
+
+            // E(P) = dx*(P.y - p0.y) - dy*(P.x - p0.x), P = (16x, 16y)
+            edges[i].origin = dy*p0.x - dx*p0.y;
+            edges[i].step_x = -dy*SubpixelSteps;
+            edges[i].step_y = dx*SubpixelSteps;
+            edges[i].bias = (dy < 0 || (dy == 0 && dx > 0)) ? 0 : -1;
         }
 
-        __m128 summ = _mm_dp_ps(v4, bcp.z_inv_, 0x7F); // Перемножаем без fourth, кладем во все
-        v4 = _mm_mul_ps(v4, bcp.z_inv_); // Барицентрики до деления на суммы
-        v4 = _mm_div_ps(v4, summ); // Получаем мировые БЦ
+        Point2D<int64_t> min_fixed = { std::min({p[0].x, p[1].x, p[2].x}), std::min({p[0].y, p[1].y, p[2].y}) };
+        Point2D<int64_t> max_fixed = { std::max({p[0].x, p[1].x, p[2].x}), std::max({p[0].y, p[1].y, p[2].y}) };
+        span_ = { max_fixed.x - min_fixed.x, max_fixed.y - min_fixed.y };
+        mins = { static_cast<ScreenDimension>((min_fixed.x + SubpixelSteps - 1) >> SubpixelBits), // ceil
+                 static_cast<ScreenDimension>((min_fixed.y + SubpixelSteps - 1) >> SubpixelBits) };
+        maxs = { static_cast<ScreenDimension>(max_fixed.x >> SubpixelBits), // floor
+                 static_cast<ScreenDimension>(max_fixed.y >> SubpixelBits) };
+
+        z_inv = _mm_set_ps(0.f, 1/v[2]->vertex_coords.z, 1/v[1]->vertex_coords.z, 1/v[0]->vertex_coords.z);
     }
 
-    inline bool IsValid() const { return is_valid_; }
+    inline bool IsValid() const { return area > 0; }
+
+    // Описывающий прямоугольник меньше side x side пикселей: тогда значения реберных функций
+    // на его пикселях по модулю меньше 2*(side*16)^2 и помещаются в int32
+    inline bool IsSmall(ScreenDimension side) const
+    {
+        return span_.x < side*SubpixelSteps && span_.y < side*SubpixelSteps;
+    }
+};
+
+// Барицентрические координаты
+// Приватно наследуемся, чтобы скрыть +, -, *
+struct alignas(16) BaricentricCoords : private Vector4D
+{
+public:
+    // weights - (w0, w1, w2, 0): значения реберных функций (без bias), пропорциональные экранным БЦ-координатам
+    // z_inv - (1/z0, 1/z1, 1/z2, 0). Получаем мировые БЦ-координаты: нормировка на площадь не нужна
+    inline BaricentricCoords(__m128 weights, __m128 z_inv)
+    {
+        DCHECK_ALIGNMENT_16;
+
+        __m128 summ = _mm_dp_ps(weights, z_inv, 0x7F); // Перемножаем без fourth, кладем во все
+        v4 = _mm_div_ps(_mm_mul_ps(weights, z_inv), summ); // Получаем мировые БЦ
+    }
+
+    // Уже готовые мировые БЦ-координаты (например, посчитанные векторно сразу для нескольких пикселей)
+    inline BaricentricCoords(float a, float b, float c) : Vector4D(a, b, c, 0.f) {}
 
-    // Нельзя использовать если !IsValid
     inline Vertex AverageVertices(const Vertex& A, const Vertex& B, const Vertex& C) const
     {
-        DCHECK(IsValid());
         return A*x + B*y + C*z;
     }
+
+    // Только z от AverageVertices: те же операции в том же порядке - результат бит в бит тот же
+    inline float AverageZ(const Vertex& A, const Vertex& B, const Vertex& C) const
+    {
+        return A.vertex_coords.z*x + B.vertex_coords.z*y + C.vertex_coords.z*z;
+    }
 };
 
 } // namespace plane_render
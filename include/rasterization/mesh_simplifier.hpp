@@ -0,0 +1,16 @@
+#pragma once
+
+#include "rasterization/graphics_types.hpp"
+
+namespace plane_render {
+
+// Упрощение меша методом квадрик ошибок (Garland, Heckbert, 1997)
+// Используется стягивание ребра в одну из его вершин: новых вершин не появляется,
+// поэтому результат - просто другой список индексов на те же вершины (с теми же нормалями и текстурами)
+// Вершины с совпадающими координатами считаются одной (obj-загрузчик дублирует вершины на каждую грань)
+//
+// positions - исходные координаты (x, y, z, 1), indices - тройки индексов
+// Возвращает не больше target_triangles треугольников, если упростить сильнее не получилось - сколько осталось
+IndicesList SimplifyMesh(const Vec4DynamicArray& positions, const IndicesList& indices, size_t target_triangles);
+
+} // namespace plane_render
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "rasterization/scene_object.hpp"
+
+#include <vector>
+
+namespace plane_render {
+
+// Программное отсечение перекрытых объектов до вершинного шейдера. Несколько крупных объектов-заслонителей
+// растеризуются в буфер глубины низкого разрешения Width() x Height() (только глубина, по 4 пикселя ряда
+// за шаг SSE), затем описанная сфера каждого остального объекта проверяется по нему: если во всех пикселях
+// ее экранного прямоугольника заслонители ближе ее ближней точки - объект не виден.
+// Глубина треугольника заслонителя берется по самой дальней вершине - с запасом. Покрытие - по центрам
+// пикселей, это не строго консервативно: прямоугольник проверки расширяется на пиксель
+class OcclusionCuller
+{
+public:
+    static constexpr size_t DefaultWidth = 256;
+    static constexpr size_t DefaultHeight = 128;
+    static constexpr float MinOccluderShare = 1.f / 16; // Заслонитель - объект с радиусом на экране не меньше этой доли ширины
+
+    OcclusionCuller(const RenderingGeometryConstPtr& geom, size_t width, size_t height);
+    OcclusionCuller(const OcclusionCuller&) = delete;
+    OcclusionCuller& operator=(const OcclusionCuller&) = delete;
+
+    void Clear(); // Перед кадром
+    // Треугольники нулевого уровня детализации obj - после его вершинного шейдера (Vertices() - в пикселях кадра)
+    void AddOccluder(const SceneObject& obj);
+    // Сфера (center_src, radius) в исходных координатах целиком за заслонителями
+    bool IsOccluded(const FastVector3D& center_src, float radius) const;
+
+    size_t Width()  const { return width_;  }
+    size_t Height() const { return height_; }
+    const float* Depth() const { return depth_.data(); } // z камеры по рядам (шаг - Stride()), ScreenBuffer::ClearZ - пусто
+    size_t Stride() const { return stride_; }
+
+private:
+    void RasterizeTriangle(const Vertex& A, const Vertex& B, const Vertex& C, float scale_x, float scale_y);
+
+private:
+    RenderingGeometryConstPtr geom_;
+    size_t width_;
+    size_t height_;
+    size_t stride_; // Ряд дополнен до кратного 4 - блоки SSE не выходят за него
+    VectorAlignment16<float> depth_;
+};
+
+} // namespace plane_render
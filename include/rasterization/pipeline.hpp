@@ -2,39 +2,184 @@
 
 #include "rasterization/scene_object.hpp"
 #include "rasterization/rasterizer.hpp"
+#include "rasterization/reprojector.hpp"
+#include "rasterization/upscaler.hpp"
+#include "rasterization/full_screen_pass.hpp"
+#include "rasterization/shadow_pass.hpp"
+#include "rasterization/shadow_map.hpp"
+#include "rasterization/occlusion_culler.hpp"
 #include "threadpool/threadpool.hpp"
 
 #include "sdl_adapter/render_provider.hpp"
 
 #include <vector>
 #include <fstream>
+#include <functional>
+#include <memory>
 
 namespace plane_render {
 
-class RasterizationPipeline : public IRenderProvider
+struct PipelineOptions
 {
-private:
-    static constexpr size_t ThreadsCount = 8;
+    static constexpr size_t DefaultThreads = 8;
+    static constexpr float ResolutionScaleStep = 1.f / 16;
+
+    size_t threads = DefaultThreads;
+    bool pin_threads = false; // См. ThreadPool
+
+    // Настройки буфера кадра, см. ScreenBuffer
+    ScreenBuffer::Layout layout = ScreenBuffer::Layout::Linear;
+    ScreenBuffer::ClearMode clear_mode = ScreenBuffer::ClearMode::Eager;
+
+    // Если не пусто - включается Profiler, трасса стадий кадра (Chrome trace JSON) пишется сюда в деструкторе
+    std::string trace_filename;
+
+    // Update без изменений геометрии и объектов (по их версиям) не перерисовывает кадр, а оставляет прежний.
+    // Бенчмаркам, которые меряют перерисовку одного и того же вида, его надо выключать
+    bool frame_cache = true;
+
+    // Если камера и свет не менялись, а изменились отдельные объекты (например, SetPosition) - очищается
+    // и перерисовывается только описывающий прямоугольник их старых и новых положений на экране.
+    // Остальные объекты рисуются, только если задевают его. Если он больше dirty_rects_max_share экрана,
+    // кадр рисуется целиком
+    bool dirty_rects = false;
+    float dirty_rects_max_share = 0.5f;
+
+    // Репроекция при движении камеры (объекты и свет те же): прошлый кадр переносится в новый вид
+    // (см. Reprojector), растеризуются только плитки с дырами и каждая reprojection_refresh_period-я плитка
+    // по очереди - так ошибка репроекции живет не дольше этого числа кадров. Больше - быстрее и грубее.
+    // Если перерисовать надо больше reprojection_max_dirty_share плиток - кадр рисуется целиком, поэтому
+    // при 1 / reprojection_refresh_period >= reprojection_max_dirty_share (по умолчанию период 1 и 2)
+    // репроекция выключается. Без AVX2 (см. ActiveIsa) тоже выключается
+    bool reprojection = false;
+    size_t reprojection_refresh_period = 8;
+    float reprojection_max_dirty_share = 0.5f;
+
+    // Динамическое разрешение: кадр рисуется в уменьшенный ScreenBuffer (в той же памяти, см. ScreenBuffer::Resize)
+    // и билинейно растягивается до размера вывода. Масштаб по каждой стороне (шагами ResolutionScaleStep,
+    // от min_resolution_scale до 1) выбирается по временам стадий прошлого кадра так, чтобы кадр укладывался
+    // в target_frame_ms: очистка, растеризация, репроекция и полноэкранные проходы считаются пропорциональными
+    // числу пикселей
+    bool dynamic_resolution = false;
+    float target_frame_ms = 33.3f;
+    float min_resolution_scale = 0.5f;
+
+    // Гибридные тени (см. ShadowPass): первым полноэкранным проходом - теневой луч из каждого видимого пикселя
+    // объектов с SceneObject::ReceivesShadows через Bvh по объектам с SceneObject::CastsShadows (пересобирается,
+    // когда они меняются). Тень умножает цвет на shadow_factor.
+    // Как и любой проход (см. RasterizationPipeline::AddPass), выключает перерисовку части кадра и репроекцию
+    bool ray_traced_shadows = false;
+    float shadow_factor = 0.5f;
+
+    // Тени картой глубины из источника света (см. ShadowMap) shadow_map_size x shadow_map_size: фрагментные
+    // шейдеры объектов берут из нее видимость света. Карта перерисовывается, только когда меняются свет или
+    // объекты, - тогда и кадр рисуется целиком (тени могли сдвинуться вне перерисовываемой части)
+    bool shadow_map = false;
+    size_t shadow_map_size = 1024;
+
+    // Предварительный проход глубины: все объекты сначала растеризуются только в z-буфер (Rasterizer::Pass::DepthOnly),
+    // затем фрагментный шейдер вызывается только для фрагментов с глубиной, равной записанной. Окупается, когда
+    // перекрытий много и шейдер дорогой; сколько фрагментов обработал каждый проход - в FrameStats.
+    // С sort_last не действует
+    bool depth_prepass = false;
+
+    // Растеризация от ближних к дальним: каждый кадр объекты и мешлеты внутри объекта
+    // (см. SceneObject::Meshlets) сортируются по RenderingGeometry::SurfaceDistance, задания пулу выдаются
+    // в этом порядке. Дальние фрагменты тогда чаще отбрасываются тестом глубины до шейдера.
+    // Треугольники тогда берутся из SceneObject::MeshletIndices, без этой опции и meshlet_culling - в порядке файла
+    bool front_to_back = false;
+
+    // Программное отсечение перекрытых объектов (см. OcclusionCuller): до max_occluders самых крупных на экране
+    // объектов (кроме охватывающих камеру, вроде неба) проходят вершинный шейдер первыми и рисуются в буфер глубины
+    // occlusion_width x occlusion_height. Остальные проверяются по нему описанной сферой и, если целиком за
+    // заслонителями, пропускают вершинный шейдер и растеризацию. Время входит в FrameStats::vs
+    bool occlusion_culling = false;
+    size_t occlusion_width = OcclusionCuller::DefaultWidth;
+    size_t occlusion_height = OcclusionCuller::DefaultHeight;
+    size_t max_occluders = 4;
+
+    // Отсечение мешлетов (см. SceneObject::Meshlets): до вершинного шейдера отбрасываются мешлеты вне экрана
+    // и, у объектов с SceneObject::BackfaceCulling, повернутые к камере обратной стороной. Их треугольники
+    // не растеризуются, задания растеризации - по мешлетам (как при front_to_back)
+    bool meshlet_culling = false;
+
+    // Sort-last: вместо общего буфера со спинлоками рядов у каждого потока пула свой буфер цвета и глубины
+    // (плитками, с ленивой очисткой), и растеризация в него идет без всякой синхронизации. Треугольники кадра
+    // в порядке растеризации делятся на непрерывные части поровну по потокам, после растеризации буферы сводятся
+    // в кадр по глубине (SIMD, параллельно по рядам плиток) - только плитки, которых поток касался.
+    // Память - по полному буферу на поток. Время сведения входит в FrameStats::fs (отдельно - в composite).
+    // Выключает depth_prepass: проход глубины потока видел бы только его треугольники, и шейдер все равно шел бы
+    // для фрагментов, закрытых треугольниками других потоков
+    bool sort_last = false;
+};
+
+// Время стадий последнего кадра, мс
+struct FrameStats
+{
+    double total = 0;
+    double clear = 0;
+    double vs = 0;
+    double fs = 0; // Растеризация + фрагментный шейдер
+    double composite = 0; // Сведение буферов потоков при PipelineOptions::sort_last (входит в fs)
+    double reproject = 0; // Репроекция прошлого кадра (входит в total)
+    double upscale = 0;   // Растяжение до размера вывода при динамическом разрешении (входит в total)
+    double passes = 0;    // Полноэкранные проходы (входит в total)
+    size_t shadow_rays = 0; // Теневых лучей гибридных теней
+    double shadow_map = 0; // Обновление карты теней (входит в total, 0 - если не перерисовывалась)
+    size_t triangles = 0;
+    size_t depth_fragments = 0;  // Тестов глубины в проходе глубины (0 без PipelineOptions::depth_prepass)
+    size_t shaded_fragments = 0; // Вызовов фрагментного шейдера при растеризации
+    size_t occluded = 0; // Объектов, скрытых заслонителями (0 без PipelineOptions::occlusion_culling)
+    size_t culled_meshlets = 0; // Мешлетов, отсеченных до вершинного шейдера (0 без PipelineOptions::meshlet_culling)
+    bool cached = false; // Ничего не изменилось, кадр не перерисовывался (времена нулевые)
+    double reused = 0;   // Доля пикселей, оставшихся от прошлого кадра
+    float scale = 1.f;   // Размер кадра относительно вывода (по каждой стороне)
+
+    // Ожидание на спинлоках за кадр, заполняется только при LOCK_STATS_ENABLED (см. common/lock_stats.hpp)
+    LockStats row_locks;         // Все ряды ScreenBuffer
+    LockStats hottest_row_locks; // Ряд hottest_row, где ждали дольше всего
+    size_t hottest_row = 0;
+    LockStats task_locks;        // Список заданий ThreadPool
+};
 
+class RasterizationPipeline : public IRenderProvider
+{
 public:
-    // perf_filename - куда писать перформанс. Формат - <total>\t<vs>\t<fs+rast>
+    // perf_filename - куда писать перформанс (пусто - никуда).
+    // Формат - <total>\t<clear>\t<vs>\t<fs+rast>\t<треугольников в кадре>\t<доля пикселей из прошлого кадра>
+    //          \t<масштаб разрешения>\t<скрытых заслонителями объектов>\t<lod объекта 0>\t<lod объекта 1>...
+    // При LOCK_STATS_ENABLED в конце еще по 4 колонки <захватов>\t<неудачных CAS>\t<yield>\t<ожидание, мс>
+    // для рядов буфера, для самого "горячего" ряда (перед ними - его номер) и для списка заданий.
+    // Кадры, взятые из кэша (FrameStats::cached), не пишутся
     RasterizationPipeline(const RenderingGeometryPtr& geom, std::vector<SceneObject>&& objects,
-                          const std::string& perf_filename);
+                          const std::string& perf_filename, const PipelineOptions& options = PipelineOptions());
     RasterizationPipeline(const RasterizationPipeline&) = delete;
     RasterizationPipeline& operator=(const RasterizationPipeline&) = delete;
+    ~RasterizationPipeline(); // Пишет трассу, если она включена
 
     virtual void MoveCam(float dx, float dy, float dz) override;
     virtual void MoveAt (float dx, float dy, float dz) override;
 
-    // Перерисовывает экран
+    // Перерисовывает экран (или оставляет прежний кадр, см. PipelineOptions::frame_cache)
     virtual void Update() override;
+    void Invalidate() { frame_valid_ = false; } // Следующий Update перерисует кадр в любом случае
 
-    virtual const Color* GetPixels() const override { return rasterizer_.GetPixels(); }
-    virtual size_t GetBufferSize() const override   { return rasterizer_.GetBufferSize(); }
+    // Полноэкранные проходы (см. FullScreenPass) выполняются в каждом перерисованном кадре после растеризации
+    // объектов, в порядке добавления, до растяжения при динамическом разрешении. Кэш кадра про их входы
+    // ничего не знает: если проход зависит не только от геометрии и объектов, после изменений нужен Invalidate.
+    // Проходы меняют цвет кадра на месте, а перерисовка части кадра и репроекция берут цвет прошлого, уже
+    // обработанного: проход применился бы поверх себя. Поэтому они выключаются (с предупреждением в лог)
+    void AddPass(std::unique_ptr<FullScreenPass>&& pass);
+
+    // Всегда в размере вывода (при динамическом разрешении кадр может быть растянут)
+    virtual const Color* GetPixels() const override { return Upscaled() ? upscaler_->Pixels() : rasterizer_.GetPixels(); }
+    virtual size_t GetBufferSize() const override   { return static_cast<size_t>(output_width_)*output_height_*sizeof(Color); }
     const std::vector<SceneObject>& GetObjects() const { return objects_; }
+    const FrameStats& LastFrameStats() const { return last_stats_; }
+    ThreadPool& GetThreadPool() { return pool_; }
 
-    virtual ScreenDimension ScreenWidth() const override  { return geom_->Width();  }
-    virtual ScreenDimension ScreenHeight() const override { return geom_->Height(); }
+    virtual ScreenDimension ScreenWidth() const override  { return output_width_;  }
+    virtual ScreenDimension ScreenHeight() const override { return output_height_; }
 
 private:
     RenderingGeometryPtr geom_;
@@ -42,8 +187,79 @@ private:
     ThreadPool pool_;
 
     Rasterizer rasterizer_;
+    std::vector<std::unique_ptr<Rasterizer>> thread_rasterizers_; // Только при PipelineOptions::sort_last, по одному на поток
 
     std::ofstream perf_output_;
+    std::string trace_filename_;
+    FrameStats last_stats_;
+
+    // Версии, из которых нарисован текущий кадр
+    bool frame_cache_;
+    bool frame_valid_ = false;
+    uint64_t frame_geom_version_ = 0;
+    std::vector<uint64_t> frame_objects_versions_;
+    Matrix4 frame_view_;
+    FastVector3D frame_light_src_;
+
+    bool dirty_rects_;
+    float dirty_rects_max_share_;
+    bool depth_prepass_;
+    bool front_to_back_;
+    bool meshlet_culling_;
+    std::vector<ScreenRect> objects_rects_; // Где объекты на экране (только при dirty_rects_)
+
+    std::unique_ptr<Reprojector> reprojector_; // Только при PipelineOptions::reprojection
+    size_t refresh_period_;
+    float reprojection_max_dirty_share_;
+    size_t refresh_phase_ = 0;
+
+    // Динамическое разрешение (см. PipelineOptions::dynamic_resolution). Размер кадра - в geom_
+    ScreenDimension output_width_;
+    ScreenDimension output_height_;
+    bool dynamic_resolution_;
+    float target_frame_ms_;
+    float min_scale_;
+    float scale_ = 1.f; // Выбран по прошлому кадру, применяется при следующей перерисовке
+    std::unique_ptr<Upscaler> upscaler_; // Только при dynamic_resolution_
+
+    std::vector<std::unique_ptr<FullScreenPass>> passes_;
+    ShadowPass* shadow_pass_ = nullptr; // Только при PipelineOptions::ray_traced_shadows, лежит в passes_
+    std::unique_ptr<ShadowMap> shadow_map_; // Только при PipelineOptions::shadow_map
+
+    std::unique_ptr<OcclusionCuller> occlusion_culler_; // Только при PipelineOptions::occlusion_culling
+    size_t max_occluders_;
+    std::vector<uint8_t> culled_; // Объект скрыт в текущем кадре: его вершины не пересчитаны
+
+private:
+    bool ObjectsUpToDate() const;
+    bool FrameUpToDate() const;
+    void RememberFrameVersions();
+
+    void RenderFull();
+    // Перерисовка только изменившейся области (см. PipelineOptions::dirty_rects). false - если нельзя
+    bool RenderDirtyRegion();
+    // Кадр из репроекции прошлого (см. PipelineOptions::reprojection). false - если нельзя
+    bool RenderReprojected();
+
+    bool Upscaled() const { return geom_->Width() != output_width_ || geom_->Height() != output_height_; }
+    void ApplyResolutionScale();  // Перед перерисовкой: размер geom_ и буфера - под scale_
+    void ChooseResolutionScale(); // После: scale_ по временам стадий кадра
+
+    // f(part, parts) для всех частей на пуле, с ожиданием
+    void RunParts(const std::function<void(size_t, size_t)>& f);
+
+    // Выбор LOD, отсечение мешлетов (при PipelineOptions::meshlet_culling и cull_meshlets) и вершинный шейдер
+    void ShadeObject(size_t index, bool cull_meshlets = true);
+    void ShadeObjects(); // ShadeObject для всех, кроме скрытых заслонителями (отмечает их в culled_)
+    // Объекты с draw(i): по проходам (см. PipelineOptions::depth_prepass), каждый объект - через RasterizeObject
+    void RasterizeObjects(const std::function<bool(size_t)>& draw);
+    void RasterizeObject(const SceneObject& obj); // Раздает треугольники пулу и ждет их
+    // Все объекты order - в буферы потоков (см. PipelineOptions::sort_last), затем сведение в rasterizer_
+    void RasterizeSortLast(const std::vector<size_t>& order);
+    // Отрезки (первый треугольник, число) видимых мешлетов obj в порядке растеризации (при front_to_back_ -
+    // от ближних к дальним), идущие подряд в SceneObject::MeshletIndices - одним отрезком
+    std::vector<std::pair<size_t, size_t>> MeshletRanges(const SceneObject& obj) const;
+    void RunPass(FullScreenPass& pass); // Плитки - пулу по рядам, с ожиданием
 };
 
 } // namespace plane_render
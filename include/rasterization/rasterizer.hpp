@@ -3,6 +3,9 @@
 #include "rasterization/scene_object.hpp"
 #include "rasterization/screen_buffer.hpp"
 
+#include "common/cpu_dispatch.hpp"
+
+#include <atomic>
 #include <utility>
 #include <memory>
 
@@ -10,13 +13,35 @@ namespace plane_render {
 
 class Rasterizer
 {
+public:
+    // Треугольники, чей описывающий прямоугольник не больше SmallTriangleSide x SmallTriangleSide пикселей,
+    // растеризуются отдельным векторным путем (на плотных мешах таких большинство). Он есть для AVX2 и AVX-512
+    // и выбирается по ActiveIsa(), без них такие треугольники идут общим путем
+    static constexpr ScreenDimension SmallTriangleSide = 4;
+
+    // Что делается с фрагментом, прошедшим покрытие (см. PipelineOptions::depth_prepass)
+    enum class Pass
+    {
+        Shade,      // Тест глубины, запись глубины и цвета - фрагментный шейдер на каждый более близкий фрагмент
+        DepthOnly,  // Только тест и запись глубины: без фрагментного шейдера, цвета и интерполяции атрибутов
+        ShadeEqual, // После DepthOnly: шейдер только там, где глубина равна записанной, глубина не пишется
+    };
+
 // Ставим сюда, чтобы inline компилировался
 private:
     RenderingGeometryConstPtr geom_;
     ScreenBuffer screen_buffer_;
+    bool small_triangles_path_ = true;
+    Isa isa_;
+    ScreenRect scissor_; // Рисуются только пиксели внутри (по умолчанию - весь экран)
+    const uint8_t* tile_mask_ = nullptr; // Если задана - рисуются только плитки ScreenBuffer с mask[плитка] != 0
+    Pass pass_ = Pass::Shade;
+    std::atomic<size_t> fragments_; // Обработанных фрагментов с последнего TakeFragments
 
 public:
-    Rasterizer(const RenderingGeometryConstPtr& geom);
+    Rasterizer(const RenderingGeometryConstPtr& geom, ScreenBuffer::Layout layout = ScreenBuffer::Layout::Linear,
+               ScreenBuffer::ClearMode clear_mode = ScreenBuffer::ClearMode::Eager,
+               ScreenBuffer::Sharing sharing = ScreenBuffer::Sharing::Shared);
     Rasterizer(const Rasterizer&) = delete;
     Rasterizer& operator=(const Rasterizer&) = delete;
 
@@ -24,15 +49,79 @@ public:
     // Из obj берутся vertices и indices
     // Вершины имеют индексы for s in range(start, start+count): (indices[s]; indices[s+1]; indices[s+2])
     // Если start+count >= len(indices) => return
-    void Rasterize(const SceneObject& obj, size_t start, size_t count);
+    void Rasterize(const SceneObject& obj, size_t start, size_t count) { Rasterize(obj, obj.Indices(), start, count); }
+    // То же, но indices - другой порядок треугольников obj (SceneObject::MeshletIndices)
+    void Rasterize(const SceneObject& obj, const IndicesList& indices, size_t start, size_t count);
     void Clear() { screen_buffer_.Clear(); }
+    void ClearPart(size_t part, size_t parts) { screen_buffer_.ClearPart(part, parts); } // См. ScreenBuffer::ClearPart
+    void ClearRect(const ScreenRect& rect) { screen_buffer_.ClearRect(rect); } // См. ScreenBuffer::ClearRect
+    ScreenBuffer::ClearMode GetClearMode() const { return screen_buffer_.GetClearMode(); }
+    // После RenderingGeometry::SetRenderSize: буфер (в пределах начального размера) и scissor - под новый размер
+    void Resize()
+    {
+        screen_buffer_.Resize(geom_->Width(), geom_->Height());
+        ResetScissor();
+    }
+
+    // Ограничивает растеризацию прямоугольником (перерисовка части кадра). Менять - только между растеризациями
+    void SetScissor(const ScreenRect& rect) { scissor_ = rect; }
+    void ResetScissor() { scissor_ = ScreenRect::Screen(geom_->Width(), geom_->Height()); }
+    const ScreenRect& Scissor() const { return scissor_; }
+    // Маска плиток ScreenBuffer::TileSide x TileSide (по TilesCount() штук), nullptr - без маски. Тоже между растеризациями
+    void SetTileMask(const uint8_t* mask) { tile_mask_ = mask; }
+    const uint8_t* TileMask() const { return tile_mask_; }
+    size_t TilesX()     const { return screen_buffer_.TilesX(); }
+    size_t TilesCount() const { return screen_buffer_.TilesCount(); }
+    ScreenBuffer::TileSpan GetTile(size_t tile) { return screen_buffer_.GetTile(tile); } // См. ScreenBuffer::GetTile
+    void LoadPart(const Color* colors, const float* z, const std::vector<uint8_t>& clear_tiles, size_t part, size_t parts)
+    {
+        screen_buffer_.LoadPart(colors, z, clear_tiles, part, parts); // См. ScreenBuffer::LoadPart
+    }
+    // Сводит по глубине буферы растеризаторов sources (Lazy, того же размера) - см. ScreenBuffer::CompositePart
+    void CompositePart(const std::vector<const Rasterizer*>& sources, size_t part, size_t parts);
+
+    // Менять - только между растеризациями
+    void SetPass(Pass pass) { pass_ = pass; }
+    Pass GetPass() const { return pass_; }
+    // Сколько фрагментов обработано с прошлого вызова (и обнуляет): для Shade и ShadeEqual - вызовов
+    // фрагментного шейдера, для DepthOnly - тестов глубины
+    size_t TakeFragments() { return fragments_.exchange(0, std::memory_order_relaxed); }
+
+    // Для сравнения производительности: можно выключить отдельный путь для маленьких треугольников
+    void SetSmallTrianglesPath(bool enabled) { small_triangles_path_ = enabled; }
+
+#ifdef LOCK_STATS_ENABLED
+    LockStats TakeRowLockStats(size_t& hottest_row, LockStats& hottest) // См. ScreenBuffer::TakeRowLockStats
+    {
+        return screen_buffer_.TakeRowLockStats(hottest_row, hottest);
+    }
+#endif
 
     const Color* GetPixels() const { return screen_buffer_.GetPixels(); }
+    const float* GetDepth()  const { return screen_buffer_.GetDepth(); }
     size_t GetBufferSize()   const { return screen_buffer_.GetBufferSize(); }
 
 private:
-    // Вызывающий сам проверяет, что (A, B, C).z <= -GraphicsEps
-    void RasterizeTriangle(const SceneObject& obj, const Vertex& A, const Vertex& B, const Vertex& C);
+    // Есть ли в прямоугольнике пикселей плитки из tile_mask_ (без маски - всегда да)
+    bool AnyMaskedTile(const PixelPoint& mins, const PixelPoint& maxs) const;
+    inline bool PixelMasked(ScreenDimension x, ScreenDimension y) const
+    {
+        return !tile_mask_ || tile_mask_[(y / ScreenBuffer::TileSide) * screen_buffer_.TilesX() + x / ScreenBuffer::TileSide];
+    }
+
+    // Фрагмент x_dim в заблокированном ряду lines_acc с мировыми БЦ-координатами bc - по pass_.
+    // true - если он посчитан в fragments_
+    inline bool ProcessPixel(const FragmentShader& fs, const TriangleSetup& setup, const BaricentricCoords& bc,
+                             ScreenBuffer::Accessor& lines_acc, ScreenDimension x_dim) const;
+
+    // Вызывающий сам проверяет, что (A, B, C).z <= -GraphicsEps. Все возвращают число обработанных фрагментов
+    size_t RasterizeTriangle(const SceneObject& obj, const Vertex& A, const Vertex& B, const Vertex& C);
+
+    // Треугольник с setup.IsSmall(SmallTriangleSide): покрытие 8 пикселей (4x2) проверяется
+    // за один шаг AVX в int32, без построчного цикла
+    PLANE_RENDER_TARGET_AVX2 size_t RasterizeSmallTriangleAvx2(const FragmentShader& fs, const TriangleSetup& setup);
+    // То же, но весь прямоугольник 4x4 - за один шаг в 16 дорожках
+    PLANE_RENDER_TARGET_AVX512 size_t RasterizeSmallTriangleAvx512(const FragmentShader& fs, const TriangleSetup& setup);
 };
 
 } // namespace plane_render
\ No newline at end of file
@@ -2,6 +2,7 @@
 
 #include "graphics_types.hpp"
 #include "common/logger.hpp"
+#include "common/cpu_dispatch.hpp"
 
 #include <memory>
 
@@ -25,15 +26,16 @@ public:
 
     // Вспомогательная функция для преобразований геометрии
     // Переводит экранные координаты (ksi, eta, dzeta) в пиксели и устанавливает их в out_v
+    // Центр пикселя - целые координаты, сами координаты привязываются к сетке 1/SubpixelSteps пикселя
     inline void SetPixelPos(const FastVector3D& coords_screen, Vertex& out_v) const
     {
         /*   
-        return { Clump((ScreenDimension) std::round(-1.0/2 + screen_width_ / 2.0*(ksi + 1)), 0, screen_width_-1),
-                 Clump((ScreenDimension) std::round(-1.0/2 + screen_height_ / 2.0*(eta + 1)), 0, screen_height_-1) }; */
+        return { -1.0/2 + screen_width_ / 2.0*(ksi + 1),
+                 -1.0/2 + screen_height_ / 2.0*(eta + 1) }; */
 
         __m128 pixel_pos = _mm_add_ps(_mm_mul_ps(coords_screen, topixels_mul_), topixels_add_);
-        pixel_pos = _mm_round_ps(pixel_pos, _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
-        out_v.SetPixelPos(pixel_pos);
+        pixel_pos = _mm_round_ps(_mm_mul_ps(pixel_pos, _mm_set1_ps(SubpixelSteps)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        out_v.SetPixelPos(_mm_mul_ps(pixel_pos, _mm_set1_ps(1.f / SubpixelSteps)));
     }
 
     // Преобразование геометрии для вершинных шейдеров
@@ -41,10 +43,28 @@ public:
     // out_vp - Vertex, соответствующая вершине. В ней заполняются vertex_coords, pixel_pos
     // (!) При подаче в растеризатор нужно проверить, что z_вершины <= -GraphicsEps - нельзя рисовать точки с z >= 0
     void TransformGeometry(const Vector4D& src_vec4, Vertex& out_v) const;
+    // То же для count вершин подряд: out[i] - для src[i] + offset (offset.fourth = 0).
+    // Вариант выбирается по ActiveIsa(): на AVX2 и AVX-512 - по 2 и 4 вершины в регистре.
+    // Порядок операций как у поштучного (без FMA), результат совпадает бит в бит
+    void TransformGeometry(const Vector4D* src, const FastVector3D& offset, Vertex* out, size_t count) const;
+
+    // Радиус проекции сферы (center, radius) в исходных координатах на экран, в пикселях
+    // Если сфера пересекает ближнюю плоскость - возвращает +inf
+    float ProjectedRadius(const FastVector3D& center_src, float radius) const;
+    // Расстояние от камеры до поверхности сферы (center, radius) в исходных координатах - ключ порядка растеризации.
+    // Снаружи - до ближней точки, изнутри - до оболочки: небесная сфера вокруг камеры оказывается дальше всего
+    float SurfaceDistance(const FastVector3D& center_src, float radius) const
+    {
+        return std::abs(std::sqrt(FastVector3D(center_src - camera_pos_src_).NormSq()) - radius);
+    }
 
     ScreenDimension Width()  const { return screen_width_;  }
     ScreenDimension Height() const { return screen_height_; }
 
+    // Меняет размер в пикселях, в который рисуется кадр (динамическое разрешение). Соотношение сторон
+    // и перспектива остаются от размера при создании - картинка та же, только крупнее или мельче пиксели
+    void SetRenderSize(ScreenDimension w, ScreenDimension h);
+
     const FastVector3D& CameraPosSrc() const { return camera_pos_src_; } // После преобразования - в (0, 0, 0)
     const FastVector3D& LightPosSrc()  const { return light_pos_src_;  } // Свет до преобразования
     const FastVector3D& LightPos()     const { return light_pos_;      } // Свет после преобразования
@@ -52,15 +72,27 @@ public:
     // Для работы с raytracing
     float GetRatio() const { return ratio_; }
     float GetFov()   const { return fov_; }
+    float GetFar()   const { return f_; }
     Vector3D GetUp() const { return up_.ToVector3D(); }
     Vector3D GetAt() const { return at_.ToVector3D(); }
 
     void SetLightSrcPos(const Vector3D& pos);
 
+    // Исходные координаты -> координаты камеры (для репроекции прошлого кадра)
+    const Matrix4& ViewMatrix() const { return result_space_; }
+
+    // Меняется, только когда реально изменились вид, свет или размер кадра (повторный LookAt в ту же точку ее не трогает)
+    uint64_t Version() const { return version_; }
+
 private:
     void SetToPixelsCoeffitients();
     void UpdateTransform(); // Пересчитывает матрицы и свет
 
+    PLANE_RENDER_TARGET_AVX2 void TransformGeometryAvx2(const Vector4D* src, const FastVector3D& offset,
+                                                        Vertex* out, size_t count) const;
+    PLANE_RENDER_TARGET_AVX512 void TransformGeometryAvx512(const Vector4D* src, const FastVector3D& offset,
+                                                            Vertex* out, size_t count) const;
+
 private:
     // Положение камеры и вида
     FastVector3D up_ = {0, 1, 0};
@@ -85,9 +117,14 @@ private:
     float n_ = 0; // Ближний план
     float f_ = 0; // Дальный план
     float fov_ = 1.f;
+
+    uint64_t version_ = 0;
 };
 
 typedef std::shared_ptr<RenderingGeometry> RenderingGeometryPtr;
 typedef std::shared_ptr<const RenderingGeometry> RenderingGeometryConstPtr;
 
+// Обратная к матрице вида (RenderingGeometry::ViewMatrix): поворот транспонируется, сдвиг поворачивается обратно
+Matrix4 InverseRigid(const Matrix4& m);
+
 } // namespace plane_render
\ No newline at end of file
@@ -0,0 +1,60 @@
+#pragma once
+
+#include "rasterization/rendering_geometry.hpp"
+
+#include "common/cpu_dispatch.hpp"
+
+#include <atomic>
+#include <vector>
+
+namespace plane_render {
+
+// Перенос прошлого кадра в новый вид, когда двигалась только камера.
+// Пиксель прошлого кадра по своей глубине переводится обратно в координаты камеры и проецируется заново
+// (пустой - как точка на дальнем плане: в этом направлении по-прежнему пусто). Попадания в один пиксель
+// разрешает z-тест на атомиках (глубина и цвет упакованы в одно 64-битное слово), поэтому части параллельны.
+// Пиксели, куда ничего не попало, - дыры: открывшиеся из-за объектов области и новые края экрана.
+// Одиночные трещины от растяжения заделываются соседями, плитки с остальными дырами надо перерисовать.
+// Перенос написан на AVX2: создавать, только если ActiveIsa() >= Isa::Avx2
+class Reprojector
+{
+public:
+    Reprojector(const RenderingGeometryConstPtr& geom, size_t tile_side, size_t tiles_x, size_t tiles_count);
+    Reprojector(const Reprojector&) = delete;
+    Reprojector& operator=(const Reprojector&) = delete;
+
+    // Начало кадра: prev_view - матрица вида, с которой нарисован прошлый кадр (того же размера).
+    // Размер кадра берется из geom (не больше, чем при создании - под него выделена память), плитки - ScreenBuffer
+    void Begin(const Matrix4& prev_view, size_t tiles_x, size_t tiles_count);
+
+    // Шаги кадра - по очереди, части одного шага (part из parts) - параллельно
+    void ClearPart(size_t part, size_t parts);
+    PLANE_RENDER_TARGET_AVX2 void SplatPart(const Color* prev_colors, const float* prev_z, size_t part, size_t parts); // По рядам прошлого кадра
+    // По рядам плиток: кадр - в Colors()/Depth(), в DirtyTiles() - плитки с дырами и плитки очередного
+    // обновления (номер % refresh_period == refresh_phase). Возвращает число пикселей в остальных плитках
+    size_t ResolvePart(size_t refresh_phase, size_t refresh_period, size_t part, size_t parts);
+
+    const Color* Colors() const { return colors_.data(); }
+    const float* Depth()  const { return z_.data(); }
+    const std::vector<uint8_t>& DirtyTiles() const { return dirty_tiles_; }
+
+private:
+    // Трещина - дыра между двумя попаданиями по горизонтали или вертикали. 0 - не трещина
+    uint64_t FillCrack(size_t x, size_t y) const;
+
+private:
+    RenderingGeometryConstPtr geom_;
+    size_t width_;
+    size_t height_;
+    size_t tile_side_;
+    size_t tiles_x_;
+
+    Matrix4 delta_; // Координаты камеры прошлого кадра -> текущего
+
+    std::vector<std::atomic<uint64_t>> packed_; // (ключ глубины << 32) | цвет, 0 - дыра. Используется начало
+    std::vector<Color> colors_;
+    std::vector<float> z_;
+    std::vector<uint8_t> dirty_tiles_;
+};
+
+} // namespace plane_render
@@ -16,6 +16,31 @@ class FragmentShader;
 
 class SceneObject
 {
+public:
+    static constexpr size_t MaxLodLevels = 5;       // Включая исходный меш
+    static constexpr size_t MinLodTriangles = 64;   // Меньше - не упрощаем
+    static constexpr float LodPixelsPerTriangle = 4.f; // Сколько пикселей проекции должно приходиться на треугольник
+    static constexpr size_t MeshletMaxVertices = 64;   // Размер мешлета (см. Meshlets)
+    static constexpr size_t MeshletMaxTriangles = 124;
+    static constexpr size_t MeshletNormalCells = 6;    // Грани мешлета - из одной ячейки 6x6 развертки направлений нормали
+
+    // Мешлет - близкие в пространстве треугольники, идущие подряд в MeshletIndices() уровня детализации: не больше
+    // MeshletMaxTriangles треугольников на не больше MeshletMaxVertices разных вершин. Отсекается целиком
+    // (см. CullMeshlets) и растеризуется одним заданием
+    struct Meshlet
+    {
+        FastVector3D center;    // Описанная сфера в координатах меша (без Position)
+        FastVector3D cone_axis; // Ось конуса нормалей граней (лицевая сторона - обход против часовой)
+        float radius = 0.f;
+        float cone_cos = -1.f;  // Косинус и синус полуугла конуса. cone_cos <= 0 - граней со всех сторон, не отсекается
+        float cone_sin = 0.f;
+        size_t first = 0;        // Номер первого треугольника в MeshletIndices()
+        size_t count = 0;
+        size_t vertex_first = 0; // Разные вершины мешлета - MeshletVertices()[vertex_first, vertex_first + vertex_count)
+        size_t vertex_count = 0;
+    };
+    typedef VectorAlignment16<Meshlet> MeshletsList;
+
 public:
     class VertexShader
     {
@@ -40,13 +65,24 @@ public:
         const RenderingGeometry& GetGeom() const { return *associated_object_->geom_.get(); }
         VerticesVector& GetAssociatedVertices() { return associated_object_->vertices_; }
         const Vec4DynamicArray& GetAssociatedSrcCoords() const { return associated_object_->vert_src_coords_; }
+        const FastVector3D& GetAssociatedPosition() const { return associated_object_->position_; } // Сдвиг к исходным
+    };
+
+    // Масштаб, подбираемый при загрузке: радиус описанной сферы модели станет radius
+    struct FitRadius
+    {
+        float radius;
     };
 
 public:
     SceneObject(const RenderingGeometryConstPtr& geom, const std::string& obj_filename, float scale = 1.0,
                 size_t triangles_per_task = 1000);
+    // То же, но масштаб - по загруженным вершинам (вместо второй загрузки ради BoundingRadius)
+    SceneObject(const RenderingGeometryConstPtr& geom, const std::string& obj_filename, FitRadius fit,
+                size_t triangles_per_task = 1000);
     
     // Создание объекта без нормалей и текстурных координат. Это должен учитывать фрагментный шейдер!
+    // Порядок сохраняется: Vertices()[i] и SourceCoords()[i] - вершина vertices[i], Indices() уровня 0 - indices
     SceneObject(const RenderingGeometryConstPtr& geom, const std::vector<Vector3D>& vertices,
                 const std::vector<size_t>& indices, size_t triangles_per_task = 1000);
 
@@ -63,34 +99,111 @@ public:
     {
         vs_ = new VS(this);
         fs_ = new FS(geom_);
+        MarkChanged();
     }
 
     // Запускает вершинный шейдер для перерасчета (при обновлении позиции камеры)
     void Update();
 
-    const IndicesList&    Indices()  const { return indices_;  }
+    // Выбирает уровень детализации по размеру проекции объекта (радиус описанной сферы в пикселях)
+    // Выбирается самый детальный уровень, где на треугольник приходится не меньше LodPixelsPerTriangle пикселей.
+    // Все мешлеты уровня считаются видимыми
+    void SelectLod(float projected_radius_px);
+    size_t CurrentLod() const { return current_lod_; }
+    size_t LodCount()   const { return lod_indices_.size(); }
+
+    // Индексы текущего уровня детализации (треугольники в порядке файла)
+    const IndicesList&    Indices()  const { return lod_indices_[current_lod_]; }
+    const IndicesList&    LodIndices(size_t lod) const { return lod_indices_[lod]; }
+    // Мешлеты текущего уровня детализации, те же треугольники по мешлетам и списки вершин мешлетов
+    const MeshletsList&   Meshlets() const { return lod_meshlets_[current_lod_]; }
+    const IndicesList&    MeshletIndices() const { return lod_meshlet_indices_[current_lod_]; }
+    const IndicesList&    MeshletVertices() const { return lod_meshlet_vertices_[current_lod_]; }
+    const Vec4DynamicArray& SourceCoords() const { return vert_src_coords_; } // Координаты из меша (без Position)
     const VerticesVector& Vertices() const { return vertices_; }
+    size_t TrianglesCount() const { return Indices().size() / 3; }
+
+    // После SelectLod: отсекает мешлеты текущего уровня, целиком лежащие вне экрана или (при BackfaceCulling)
+    // повернутые к камере обратной стороной: нужны только сфера и конус, вершинный шейдер не требуется.
+    // Вершины шейдер по-прежнему считает все - они общие с соседними мешлетами. Возвращает число отсеченных
+    size_t CullMeshlets();
+    const IndicesList& VisibleMeshlets() const { return visible_meshlets_; } // Номера в Meshlets() по возрастанию
+    size_t VisibleTrianglesCount() const { return visible_triangles_; }
+
+    // Можно ли отсекать мешлеты, повернутые обратной стороной. Растеризатор рисует обе стороны граней,
+    // поэтому это верно только для замкнутых мешей, у которых лицевая сторона всех граней снаружи
+    void SetBackfaceCulling(bool enabled) { backface_culling_ = enabled; MarkChanged(); }
+    bool BackfaceCulling() const { return backface_culling_; }
+
+    // Описанная сфера в исходных координатах (с учетом Position)
+    FastVector3D BoundingCenter() const { return bounding_center_ + position_; }
+    float BoundingRadius() const { return bounding_radius_; }
+
+    // Сдвиг всего объекта относительно координат меша (объект двигается по сцене)
+    void SetPosition(const Vector3D& pos) { position_ = pos; MarkChanged(); }
+    const FastVector3D& Position() const { return position_; }
+
+    // Отбрасывает ли объект тени: рисуется ли в карту теней (см. ShadowMap) и попадает ли в Bvh теневых лучей
+    // (см. ShadowPass). Небо и подобное фоновое - не надо
+    void SetCastsShadows(bool casts) { casts_shadows_ = casts; MarkChanged(); }
+    bool CastsShadows() const { return casts_shadows_; }
+    // Затеняется ли объект гибридными тенями (см. ShadowPass): его пиксели проход не трогает. Небу - не надо
+    void SetReceivesShadows(bool receives) { receives_shadows_ = receives; MarkChanged(); }
+    bool ReceivesShadows() const { return receives_shadows_; }
+
+    // Описывающий прямоугольник на экране по вершинам видимых мешлетов после Update, обрезанный по экрану.
+    // Вершины за камерой не учитываются: треугольники с ними не рисуются. Пустой, если объект не виден
+    ScreenRect ScreenBounds() const;
 
     size_t TrianglesPerTask() const { return triangles_per_task_; } // Индивидуально для каждого объекта
     const VertexShader*   GetVS() const { return vs_; }
     const FragmentShader* GetFS() const { return fs_; }
-    FragmentShader* GetFS() { return fs_; } // Для работы с текстурами и т.п.
+    FragmentShader* GetFS() { MarkChanged(); return fs_; } // Для работы с текстурами и т.п. Считается изменением
+
+    // Версия объекта для кэша кадра (см. RasterizationPipeline): меняется при смене шейдеров,
+    // доступе к фрагментному шейдеру на запись и явном MarkChanged (если объект изменили в обход этих методов)
+    uint64_t Version() const { return version_; }
+    void MarkChanged() { version_++; }
 
 private:
     void LoadMeshFile(const std::string& obj_filename, float scale);
+    void ComputeBounds();
+    void BuildMesh(); // После загрузки файла и ComputeBounds: уровни детализации, склейка вершин, мешлеты
+    void BuildLods(); // Цепочка упрощенных мешей (lod_indices_[0] должен быть заполнен)
+    // Склеивает вершины с одинаковыми координатами, нормалью и текстурой (загрузчик дублирует их на каждую грань)
+    void WeldVertices();
+    // Раскладывает треугольники каждого уровня по направлению нормали и кривой Мортона центров в lod_meshlet_indices_
+    // (lod_indices_ не меняются) и режет на мешлеты. Вершины не переставляются: у мешлета - список их номеров
+    void BuildMeshlets();
+    void ResetVisibleMeshlets(); // Видимы все мешлеты текущего уровня
 
 private:
     RenderingGeometryConstPtr geom_;
 
     Vec4DynamicArray vert_src_coords_; // Координаты из меша
     VerticesVector vertices_; // Свойства вершин для растеризатора (меняются на каждой итерации)
-    IndicesList indices_;
+    std::vector<IndicesList> lod_indices_; // [0] - исходный меш, далее - упрощенные
+    std::vector<MeshletsList> lod_meshlets_; // По уровням, как lod_indices_
+    std::vector<IndicesList> lod_meshlet_indices_;
+    std::vector<IndicesList> lod_meshlet_vertices_;
+    size_t current_lod_ = 0;
+    IndicesList visible_meshlets_;
+    size_t visible_triangles_ = 0;
+
+    FastVector3D bounding_center_;
+    float bounding_radius_ = 0.f;
+    FastVector3D position_ = {0, 0, 0};
+    bool casts_shadows_ = true;
+    bool receives_shadows_ = true;
+    bool backface_culling_ = false;
 
     const size_t triangles_per_task_ = 0;
 
     VertexShader* vs_   = nullptr;
     FragmentShader* fs_ = nullptr;
 
+    uint64_t version_ = 0;
+
     // Вершинный шейдер может менять свойства вершин и иметь доступ к исходным координатам
     friend class VertexShader;
 };
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "rasterization/rendering_geometry.hpp"
+#include "common/lock_stats.hpp"
 #include <thread>
 #include <atomic>
 #include <limits>
@@ -13,6 +14,53 @@ class ScreenBuffer
 public:
     static constexpr size_t LockFragment = 5; // Сколько рядов блокируются одновременно
 
+    // Расположение цвета и глубины в памяти
+    enum class Layout
+    {
+        Linear, // Два отдельных массива по рядам
+        Tiled   // Плитки TileSide x TileSide: цвет и глубина плитки лежат рядом (512 байт, 8 кэш-линий)
+    };
+    static constexpr size_t TileSide = 8;
+    static constexpr size_t TilePixels = TileSide*TileSide;
+    static constexpr float ClearZ = -std::numeric_limits<float>::max(); // Глубина пустого пикселя
+
+    struct alignas(64) Tile
+    {
+        Color pixels[TilePixels];
+        float z[TilePixels];
+    };
+
+    // Плитка без блокировок - для полноэкранных проходов (см. FullScreenPass): пиксели [x0, x0 + width) x
+    // [y0, y0 + height) кадра, ряд y плитки начинается с pixels + y*stride (и z + y*stride). Разные плитки
+    // не пересекаются, поэтому их можно обрабатывать параллельно без спинлоков рядов
+    struct TileSpan
+    {
+        size_t x0;
+        size_t y0;
+        size_t width;  // У плиток на правом и нижнем краю кадра может быть меньше TileSide
+        size_t height;
+        size_t stride; // Linear - ширина кадра, Tiled - TileSide
+        Color* pixels;
+        float* z;
+
+        inline Color& Pixel(size_t x, size_t y) const { DCHECK(x < width && y < height); return pixels[y*stride + x]; }
+        inline float& Z(size_t x, size_t y) const     { DCHECK(x < width && y < height); return z[y*stride + x]; }
+    };
+
+    // Как очищается буфер перед кадром
+    enum class ClearMode
+    {
+        Eager, // Весь буфер сразу, non-temporal записями (можно по частям из разных потоков - ClearPart)
+        Lazy   // Clear только начинает новый кадр, плитка очищается при первом обращении к ней в кадре
+    };
+
+    // Кто пишет в буфер при растеризации
+    enum class Sharing
+    {
+        Shared, // Любой поток пула: ряды - под спинлоками
+        Private // Только один поток (буферы потоков при PipelineOptions::sort_last): ряды не блокируются
+    };
+
 public:
     // Обеспечивает спинлок линии
     class Accessor
@@ -22,6 +70,10 @@ public:
     private:
         size_t row_ = INVALID_ROW;
         ScreenBuffer* buffer_ = nullptr;
+        size_t row_offset_ = 0; // Linear: начало ряда
+        size_t tile_row_ = 0; // Первая плитка ряда
+        size_t row_in_tile_ = 0; // Tiled: начало ряда внутри плитки
+        size_t ready_tile_ = INVALID_ROW; // Lazy: последняя плитка, про которую известно, что она очищена
 
     public:
         Accessor(Accessor&& ac);
@@ -35,9 +87,14 @@ public:
             ReleaseRow(); // Защита на всякий случай: но лучше заранее самому вызывать
 
             bool expected = false;
-            if (buffer_->locks_[row].compare_exchange_weak(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
+            if (buffer_->sharing_ == Sharing::Private ||
+                buffer_->locks_[row].compare_exchange_weak(expected, true, std::memory_order_acquire, std::memory_order_relaxed))
             {
                 row_ = row;
+                row_offset_ = buffer_->width_*row;
+                tile_row_ = (row / TileSide) * buffer_->tiles_x_;
+                row_in_tile_ = (row % TileSide) * TileSide;
+                ready_tile_ = INVALID_ROW;
                 return true;
             }
             return false;
@@ -45,15 +102,27 @@ public:
 
         inline void LockRow(size_t row)
         {
+#ifdef LOCK_STATS_ENABLED
+            LockWaitCounter wait;
+            while (!TryLockRow(row))
+            {
+                wait.Failed();
+                wait.Yield();
+                std::this_thread::yield();
+            }
+            wait.AddTo(buffer_->row_lock_stats_[row]); // Ряд наш - можно писать без атомиков
+#else
             while (!TryLockRow(row))
                 std::this_thread::yield();
+#endif
         }
 
         inline void ReleaseRow()
         {
             if (row_ != INVALID_ROW)
             {
-                buffer_->locks_[row_].store(false, std::memory_order_release); // Мы владеем, поэтому просто store
+                if (buffer_->sharing_ == Sharing::Shared)
+                    buffer_->locks_[row_].store(false, std::memory_order_release); // Мы владеем, поэтому просто store
                 row_ = INVALID_ROW;
             }
         }
@@ -61,12 +130,33 @@ public:
         inline Color& Pixel(size_t x)
         {
             DCHECK(x < buffer_->width_ && row_ != INVALID_ROW);
-            return buffer_->pixels_[buffer_->width_*row_ + x];
+            PrepareTile(x);
+            if (buffer_->layout_ == Layout::Tiled)
+                return buffer_->tiles_[tile_row_ + x / TileSide].pixels[row_in_tile_ + x % TileSide];
+            return buffer_->pixels_[row_offset_ + x];
         }
         inline float& Z(size_t x)
         {
             DCHECK(x < buffer_->width_ && row_ != INVALID_ROW);
-            return buffer_->z_buffer_[buffer_->width_*row_ + x];
+            PrepareTile(x);
+            if (buffer_->layout_ == Layout::Tiled)
+                return buffer_->tiles_[tile_row_ + x / TileSide].z[row_in_tile_ + x % TileSide];
+            return buffer_->z_buffer_[row_offset_ + x];
+        }
+
+    private:
+        // Lazy: перед первым обращением к плитке в кадре ее нужно очистить
+        inline void PrepareTile(size_t x)
+        {
+            if (buffer_->clear_mode_ != ClearMode::Lazy)
+                return;
+
+            size_t const tile = tile_row_ + x / TileSide;
+            if (tile == ready_tile_)
+                return;
+            if (buffer_->tile_epochs_[tile].load(std::memory_order_acquire) < buffer_->frame_)
+                buffer_->LazyClearTile(tile);
+            ready_tile_ = tile;
         }
 
     private:
@@ -78,7 +168,8 @@ public:
     };
 
 public:
-    ScreenBuffer(size_t w, size_t h);
+    ScreenBuffer(size_t w, size_t h, Layout layout = Layout::Linear, ClearMode clear_mode = ClearMode::Eager,
+                 Sharing sharing = Sharing::Shared);
     ScreenBuffer(const ScreenBuffer&) = delete;
     ScreenBuffer& operator=(const ScreenBuffer&) = delete;
 
@@ -91,19 +182,100 @@ public:
     // В debug проверяет, что все спинлоки отпущены
     void Clear();
 
-    const Color* GetPixels() const { return pixels_; }
+    // Eager: очищает часть part из parts (0 <= part < parts), части можно очищать параллельно
+    // Вместе вызовы для всех part равносильны Clear. Для Lazy не используется
+    void ClearPart(size_t part, size_t parts);
+
+    // Очищает только пиксели rect (он уже обрезан по экрану), не начиная новый кадр - для перерисовки части кадра.
+    // Lazy: еще не очищенные в этом кадре плитки и так считаются пустыми, поэтому эпохи не трогаются
+    void ClearRect(const ScreenRect& rect);
+
+    // Меняет размер кадра в пределах размера при создании, без перевыделения памяти: кадр занимает
+    // прямоугольник w x h в начале буферов (ряды подряд по новой ширине, для Tiled - плиток по новой ширине).
+    // Содержимое после смены не определено, до растеризации нужен Clear. Только между кадрами
+    void Resize(size_t w, size_t h);
+
+    // Записывает готовый кадр (построчные colors и z) в плитки части part из parts (части - по рядам плиток).
+    // Плитки с clear_tiles[плитка] != 0 вместо этого очищаются. Lazy: перед частями нужен Clear (смена кадра)
+    void LoadPart(const Color* colors, const float* z, const std::vector<uint8_t>& clear_tiles, size_t part, size_t parts);
+
+    // Сводит в кадр буферы sources того же размера (sort-last): непустой пиксель источника заменяет пиксель кадра,
+    // если он не дальше, источники - по порядку (как растеризация их треугольников в общий буфер подряд).
+    // Только плитки части part из parts (части - по рядам плиток), которых источник касался в своем кадре -
+    // поэтому источники должны быть Lazy. Только между растеризациями
+    void CompositePart(const std::vector<const ScreenBuffer*>& sources, size_t part, size_t parts);
+
+    // Плитка tile (0 <= tile < TilesCount(), по рядам плиток). Без синхронизации - только между растеризациями.
+    // Lazy: еще не очищенная в этом кадре плитка сначала очищается
+    TileSpan GetTile(size_t tile);
+
+    // Всегда построчно: для Tiled сначала собирает плитки в pixels_ (тоже только ПОСЛЕ растеризации)
+    // Lazy: дочищает плитки, которых в этом кадре не касались. Уже чистые (не тронутые с прошлой очистки) не пишутся
+    const Color* GetPixels() const;
+    // Глубина, тоже построчно (для Tiled - собирается из плиток)
+    const float* GetDepth() const;
     size_t GetBufferSize()   const { return width_*height_*sizeof(Color); }
+    size_t TilesX()          const { return tiles_x_; }
+    size_t TilesCount()      const { return tiles_count_; }
+    Layout GetLayout()       const { return layout_; }
+    ClearMode GetClearMode() const { return clear_mode_; }
+
+#ifdef LOCK_STATS_ENABLED
+    // Ожидание в LockRow с прошлого вызова: сумма по рядам и ряд, где ждали дольше всего. Обнуляет статистику
+    // Тоже только ПОСЛЕ растеризации
+    LockStats TakeRowLockStats(size_t& hottest_row, LockStats& hottest);
+#endif
 
     ~ScreenBuffer();
 
+private:
+    void ResolveLazy() const; // Lazy: дочищает плитки, которых в этом кадре не касались
+    bool TileTouched(size_t tile) const; // Lazy: к плитке обращались в текущем кадре (Eager - всегда true)
+    TileSpan TileAt(size_t tile) const;  // Как GetTile, но без очистки
+    void Detile() const;
+
+    // Обычными записями (данные сразу понадобятся)
+    void ClearTile(size_t tile) const;
+    // Очищает плитку, если она еще не очищена в этом кадре. Если ее очищает другой поток - ждет его
+    void LazyClearTile(size_t tile);
+
 private:
     size_t width_;
     size_t height_;
+    size_t max_width_; // Размер при создании - под него выделена память
+    size_t max_height_;
+    Layout layout_;
+    ClearMode clear_mode_;
+    Sharing sharing_;
+
+    mutable Color* pixels_ = nullptr; // Для Tiled - только результат Detile
+    float* z_buffer_ = nullptr; // Только Linear
+    mutable float* z_detiled_ = nullptr; // Tiled: результат GetDepth, выделяется при первом вызове
+
+    size_t tiles_x_ = 0; // Плиток в ряду (с неполными на краю)
+    size_t tiles_count_ = 0;
+    Tile* tiles_ = nullptr; // Только Tiled
+
+    // Lazy: номер кадра, в котором плитка очищена (ClearingEpoch - очищается прямо сейчас)
+    // Плитка готова, если ее номер >= frame_
+    static constexpr uint64_t ClearingEpoch = 0;
+    static constexpr uint64_t NeverEpoch = 1;
+    uint64_t frame_ = NeverEpoch + 1;
+    mutable std::vector<std::atomic<uint64_t>> tile_epochs_;
+    // Lazy: плитка пуста и не тронута с тех пор - ее не нужно очищать снова. Пишет только очищающий плитку
+    // (под ClearingEpoch) или ResolveLazy/LoadPart между растеризациями
+    mutable std::vector<uint8_t> tile_clean_;
 
-    Color* pixels_ = nullptr;
-    float* z_buffer_ = nullptr;
+    std::vector<std::atomic_bool> locks_; // По 1 на ряд (Sharing::Private - не используются)
 
-    std::vector<std::atomic_bool> locks_; // По 1 на ряд
+    // Варианты ядер под ActiveIsa() (см. common/cpu_dispatch.hpp), выбираются в конструкторе
+    void (*fill_colors_)(Color* dst, size_t count, Color value) = nullptr;
+    void (*fill_z_)(float* dst, size_t count, float value) = nullptr;
+    void (*detile_row_)(Color* dst, const Tile* row_tiles, size_t row_in_tile, size_t width) = nullptr;
+    void (*composite_row_)(Color* dst, float* dst_z, const Color* src, const float* src_z, size_t count) = nullptr;
+#ifdef LOCK_STATS_ENABLED
+    std::vector<LockStats> row_lock_stats_; // Пишется под спинлоком своего ряда
+#endif
 };
 
 } // namespace plane_render
\ No newline at end of file
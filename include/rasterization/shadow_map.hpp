@@ -0,0 +1,58 @@
+#pragma once
+
+#include "rasterization/scene_object.hpp"
+#include "threadpool/threadpool.hpp"
+
+#include <vector>
+
+namespace plane_render {
+
+// Карта теней: сцена из точки LightPosSrc() (перспектива, направлена на описанную сферу объектов с
+// CastsShadows) в текстуру глубины Size() x Size(). Рисуется отдельным путем только глубины: без
+// фрагментного шейдера, цвета и интерполяции атрибутов - по пикселю хранится 1/z, линейная по экрану.
+// Полосы рядов карты - независимые задания пула, поэтому без спинлоков. Перерисовывается, только когда
+// меняются свет или объекты (по версиям). Выборка - Visibility с PCF 3x3 (см. FragmentShader::PhongLight)
+class ShadowMap
+{
+public:
+    static constexpr float DepthBias = 0.01f; // Затеняет только то, что дальше заслоняющего на 1% расстояния
+    static constexpr float MaxFov = 1.2f;     // Если свет внутри сферы объектов - видна только часть сцены
+    static constexpr size_t BandsPerThread = 4;
+    static constexpr size_t PcfRadius = 1;    // Окно (2*PcfRadius + 1)^2 пикселей карты
+
+    explicit ShadowMap(size_t size);
+    ShadowMap(const ShadowMap&) = delete;
+    ShadowMap& operator=(const ShadowMap&) = delete;
+
+    // Перед кадром: перерисовывает карту, если свет или объекты изменились. true - если перерисовала
+    bool Update(const std::vector<SceneObject>& objects, const FastVector3D& light_src, ThreadPool& pool);
+    // Перед кадром: матрица вида камеры - фрагментные шейдеры передают точки в ее координатах
+    void SetCameraView(const Matrix4& camera_view) { camera_to_src_ = InverseRigid(camera_view); }
+
+    // Освещенная доля окрестности точки (координаты камеры, как Vertex::vertex_coords) от 0 до 1.
+    // Вне карты и за светом - 1. Можно из разных потоков
+    float Visibility(const FastVector3D& camera_coords) const;
+
+    size_t Size() const { return size_; }
+    const float* InverseDepth() const { return inv_z_.data(); } // 1/z света по рядам, 0 - пусто
+
+private:
+    // Направляет свет на описанную сферу объектов с CastsShadows. false - если таких нет
+    bool SetupLight(const std::vector<SceneObject>& objects, const FastVector3D& light_src);
+    // Полоса рядов [y0, y1): очистка и все треугольники, задевающие ее
+    void RenderBand(const std::vector<SceneObject>& objects, size_t y0, size_t y1);
+    void RasterizeDepth(const TriangleSetup& setup, size_t y0, size_t y1);
+
+private:
+    size_t size_;
+    std::vector<float> inv_z_;
+    RenderingGeometryPtr light_geom_; // Вид из источника, пересоздается при перерисовке
+    std::vector<VerticesVector> light_vertices_; // Вершины объектов в координатах света (только vertex_coords и pixel_pos)
+    Matrix4 camera_to_src_;
+
+    bool valid_ = false;
+    FastVector3D light_src_;
+    std::vector<uint64_t> objects_versions_; // С которыми нарисована карта
+};
+
+} // namespace plane_render
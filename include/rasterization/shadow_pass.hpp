@@ -0,0 +1,59 @@
+#pragma once
+
+#include "rasterization/full_screen_pass.hpp"
+#include "rasterization/bvh.hpp"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+namespace plane_render {
+
+// Гибридные тени: видимость - растеризацией, тени - трассировкой лучей от видимых пикселей. По глубине пикселя
+// (z_buffer_ / z плитки) восстанавливается точка в координатах камеры, нормаль - по разностям глубины
+// с соседями внутри плитки (из двух соседей по оси берется более близкий по глубине - не через край объекта).
+// Из каждой точки, повернутой к свету, - один теневой луч к LightPos() через Bvh по объектам сцены
+// с SceneObject::CastsShadows (любое попадание); затененные пиксели и отвернутые от света умножаются на shadow_factor.
+// Пиксели объектов без SceneObject::ReceivesShadows (неба) не трогаются: они узнаются лучом из камеры к точке
+// пикселя по отдельному Bvh над такими объектами - попадание не дальше точки (с допуском OffsetPixels пикселей).
+// Стоимость - по видимым пикселям, а не по треугольникам с перерисовкой
+class ShadowPass : public FullScreenPass
+{
+public:
+    // Отступ начала теневого луча от поверхности по нормали - в размерах пикселя на глубине точки
+    static constexpr float OffsetPixels = 2.f;
+
+    ShadowPass(const RenderingGeometryConstPtr& geom, float shadow_factor);
+
+    // Перед кадром: пересобирает Bvh, если объекты (их версии, в том числе флаги теней) изменились с прошлой сборки
+    void UpdateObjects(const std::vector<SceneObject>& objects, ThreadPool& pool);
+
+    virtual void BeginFrame() override;
+    virtual void ProcessTile(const ScreenBuffer::TileSpan& span) override;
+
+    size_t LastFrameRays() const { return rays_.load(std::memory_order_relaxed); } // Теневых лучей за кадр
+
+private:
+    // Точка пикселя (x, y) кадра с глубиной z в координатах камеры (обратно к RenderingGeometry::TransformGeometry)
+    inline FastVector3D ViewPosition(size_t x, size_t y, float z) const
+    {
+        return FastVector3D((x - center_x_) * to_view_x_ * z, (y - center_y_) * to_view_y_ * z, z);
+    }
+
+private:
+    float shadow_factor_;
+    std::unique_ptr<Bvh> bvh_;
+    std::unique_ptr<Bvh> non_receivers_; // Объекты без SceneObject::ReceivesShadows, nullptr - если их нет
+    std::vector<uint64_t> objects_versions_; // С которыми собраны bvh_ и non_receivers_
+
+    // Кадр
+    float center_x_ = 0.f;
+    float center_y_ = 0.f;
+    float to_view_x_ = 0.f;
+    float to_view_y_ = 0.f;
+    Matrix4 view_to_src_;
+    FastVector3D camera_src_;
+    std::atomic<size_t> rays_;
+};
+
+} // namespace plane_render
@@ -0,0 +1,47 @@
+#pragma once
+
+#include "rasterization/graphics_types.hpp"
+
+#include <vector>
+
+namespace plane_render {
+
+// Билинейное растяжение кадра до размера вывода (динамическое разрешение).
+// Таблица столбцов (левый сосед и веса) считается один раз на размер кадра, ряд вывода - 16-битная SSE-арифметика
+// с весами в 1/256: по вертикали обе пары соседей сразу, потом по горизонтали
+class Upscaler
+{
+public:
+    Upscaler(size_t out_w, size_t out_h);
+    Upscaler(const Upscaler&) = delete;
+    Upscaler& operator=(const Upscaler&) = delete;
+
+    // Размер исходного кадра: от 2 x 2 до размера вывода
+    void SetSourceSize(size_t w, size_t h);
+
+    // Ряды вывода part из parts (части можно параллельно) из построчного кадра размера SetSourceSize
+    void UpscalePart(const Color* src, size_t part, size_t parts);
+
+    const Color* Pixels() const { return pixels_.data(); }
+
+private:
+    // Центр пикселя вывода i -> левый (верхний) сосед first и вес второго соседа (0..256)
+    static void Source(size_t i, size_t out_size, size_t src_size, size_t& first, int& weight);
+
+private:
+    size_t out_w_;
+    size_t out_h_;
+    size_t src_w_ = 0;
+    size_t src_h_ = 0;
+
+    std::vector<uint32_t> columns_;   // Левый сосед для столбца вывода
+    // Веса соседей для столбца вывода: 4 раза левого, 4 раза правого (по 16 бит)
+    struct alignas(16) ColumnWeights
+    {
+        int16_t w[8];
+    };
+    VectorAlignment16<ColumnWeights> weights_;
+    std::vector<Color> pixels_;
+};
+
+} // namespace plane_render
@@ -1,5 +1,7 @@
 #pragma once
 
+#include "common/lock_stats.hpp"
+
 #include <list>
 #include <atomic>
 #include <thread>
@@ -26,13 +28,14 @@ public:
             parent_ = nullptr;
         }
 
-        ListMTAccessor(ListMTAccessor&& another)
+        ListMTAccessor(ListMTAccessor&& another) : parent_(another.parent_)
         {
             another.parent_ = nullptr;
         }
         ListMTAccessor& operator=(ListMTAccessor&& another)
         {
             Release();
+            parent_ = another.parent_;
             another.parent_ = nullptr;
             return *this;
         }
@@ -41,13 +44,23 @@ public:
     private:
         ListMTAccessor(ListMT<T>* parent) : parent_(parent)
         {
+#ifdef LOCK_STATS_ENABLED
+            LockWaitCounter wait;
+#endif
             bool expected = false;
             while (!parent_->locked_.compare_exchange_strong(expected, true,
                         std::memory_order_acquire, std::memory_order_relaxed)) // Ждем, пока сможем захватить
             {
                 expected = false;
+#ifdef LOCK_STATS_ENABLED
+                wait.Failed();
+                wait.Yield();
+#endif
                 std::this_thread::yield();
             }
+#ifdef LOCK_STATS_ENABLED
+            wait.AddTo(parent_->lock_stats_); // Уже под спинлоком
+#endif
         }
         ListMTAccessor& operator=(const ListMTAccessor&) = delete;
         ListMTAccessor(const ListMTAccessor&) = delete; // Только для возврата объектов
@@ -74,9 +87,22 @@ public:
         return ListMTAccessor(this);
     }
 
+#ifdef LOCK_STATS_ENABLED
+    // Статистика с прошлого вызова, обнуляет ее. Только когда списком никто не пользуется
+    LockStats TakeLockStats()
+    {
+        LockStats stats = lock_stats_;
+        lock_stats_ = LockStats();
+        return stats;
+    }
+#endif
+
 private:
     std::atomic_bool locked_;
     std::list<T> list_;
+#ifdef LOCK_STATS_ENABLED
+    LockStats lock_stats_; // Пишется под спинлоком
+#endif
 };
 
 } // namespace plane_render
@@ -1,12 +1,14 @@
 ﻿#pragma once
 
 #include "threadpool/list_mt.hpp"
+#include "common/aligned_allocator.hpp"
 
 #include <thread>
 #include <vector>
 #include <condition_variable>
 #include <mutex>
 #include <functional>
+#include <atomic>
 
 namespace plane_render {
 
@@ -16,8 +18,20 @@ public:
     typedef std::function<void()> FunctionType;
     typedef std::pair<FunctionType, bool> TaskWrapper; // (таска; взята ли в работу)
 
+    // Загрузка потока с последнего ResetWorkerStats: по ней видна несбалансированность заданий
+    struct WorkerStats
+    {
+        uint64_t busy_ns = 0; // Выполнял задания
+        uint64_t idle_ns = 0; // Ждал их
+        size_t tasks = 0;
+    };
+
 public:
-    ThreadPool(size_t n_threads);
+    // pin_threads: поток i закрепляется за ядром (i+1) % ядер, ядро 0 остается вызывающему потоку
+    ThreadPool(size_t n_threads, bool pin_threads = false);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+    ~ThreadPool(); // Дожидается текущих заданий и останавливает потоки
 
     // Обе функции - с передачей владения
     void AddTask(const FunctionType&& task, bool join);
@@ -25,18 +39,41 @@ public:
 
     void Join();
 
+    size_t ThreadsCount() const { return threads_.size(); }
+
+    // Закрепляет текущий поток за ядром cpu (по модулю числа ядер). false - если не удалось
+    static bool PinCurrentThread(size_t cpu);
+    std::vector<WorkerStats> GetWorkerStats() const;
+    void ResetWorkerStats();
+#ifdef LOCK_STATS_ENABLED
+    // Ожидание на спинлоке списка заданий с прошлого вызова. Только после Join
+    LockStats TakeTasksLockStats() { return tasks_.TakeLockStats(); }
+#endif
+
 private:
-    bool IsEmptyTasks();
+    // Пишет только свой поток, по кэш-линии на поток
+    struct alignas(64) WorkerCounters
+    {
+        std::atomic<uint64_t> busy_ns{0};
+        std::atomic<uint64_t> idle_ns{0};
+        std::atomic<uint64_t> tasks{0};
+    };
 
-    void FinishAddTasks(bool join);
-    void ThreadFunction(size_t id);
+private:
+    void FinishAddTasks(size_t added, bool join);
+    void ThreadFunction(size_t id, bool pin);
 
 private:
     ListMT<TaskWrapper> tasks_;
+    std::vector<WorkerCounters, AlignmentAllocator<WorkerCounters, 64>> counters_;
 
     std::vector<std::thread> threads_;
-    std::vector<std::mutex> task_mutices_;
+
+    // Ожидание новых заданий. Счетчик меняется только под new_tasks_mutex_, иначе пробуждение может потеряться
+    std::mutex new_tasks_mutex_;
     std::condition_variable new_tasks_;
+    size_t free_tasks_ = 0; // Сколько заданий еще не взято в работу
+    bool stop_ = false;
 
     std::mutex cv_join_mutex_;
     std::condition_variable cv_join_;
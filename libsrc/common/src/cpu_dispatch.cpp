@@ -0,0 +1,71 @@
+#include "cpu_dispatch.hpp"
+
+#include "logger.hpp"
+
+#include <cstdlib>
+#include <cstring>
+
+namespace plane_render {
+
+namespace {
+
+const Isa AllIsas[] = { Isa::Scalar, Isa::Sse41, Isa::Avx2, Isa::Avx512 };
+
+Isa ChooseIsa()
+{
+    Isa const detected = DetectIsa();
+    Isa isa = detected;
+
+    const char* limit = std::getenv("PLANE_RENDER_ISA");
+    if (limit)
+    {
+        bool known = false;
+        for (Isa candidate : AllIsas)
+        {
+            if (std::strcmp(limit, IsaName(candidate)) != 0)
+                continue;
+            known = true;
+            if (candidate < isa)
+                isa = candidate;
+        }
+        if (!known)
+            LOG(WARNING) << "Unknown PLANE_RENDER_ISA=" << limit << ", expected scalar, sse4.1, avx2 or avx512";
+    }
+
+    LOG(INFO) << "CPU dispatch: " << IsaName(isa) << " kernels (CPU supports " << IsaName(detected) << ")";
+    return isa;
+}
+
+} // namespace
+
+Isa DetectIsa()
+{
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw") && __builtin_cpu_supports("avx512vl"))
+        return Isa::Avx512;
+    if (__builtin_cpu_supports("avx2"))
+        return Isa::Avx2;
+    if (__builtin_cpu_supports("sse4.1"))
+        return Isa::Sse41;
+    return Isa::Scalar;
+}
+
+Isa ActiveIsa()
+{
+    static const Isa isa = ChooseIsa(); // Потокобезопасно с C++11
+    return isa;
+}
+
+const char* IsaName(Isa isa)
+{
+    switch (isa)
+    {
+    case Isa::Scalar: return "scalar";
+    case Isa::Sse41:  return "sse4.1";
+    case Isa::Avx2:   return "avx2";
+    case Isa::Avx512: return "avx512";
+    }
+    return "unknown";
+}
+
+} // namespace plane_render
@@ -0,0 +1,190 @@
+#include "perf_counters.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace plane_render {
+
+namespace {
+
+#ifdef __linux__
+struct EventDescription
+{
+    uint32_t type;
+    uint64_t config;
+    size_t group;
+};
+
+const EventDescription Events[PerfCounters::EventsCount] =
+{
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES, 0 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS, 0 },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16), 0 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES, 0 },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES, 0 },
+    { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, 1 },
+};
+static_assert(PerfCounters::GroupsCount == 2, "Events table uses groups 0 and 1");
+
+int OpenEvent(const EventDescription& event, int group_fd)
+{
+    perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = event.type;
+    attr.config = event.config;
+    attr.exclude_kernel = 1; // Хватает perf_event_paranoid <= 2
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0 /* этот поток */, -1, group_fd, 0));
+}
+#endif
+
+} // namespace
+
+struct PerfCounters::ThreadCounters
+{
+    int leaders[GroupsCount] = { -1, -1 };
+    std::vector<int> fds;
+    int position[EventsCount]; // Место в ответе read своей группы, -1 - не открыт
+    ThreadTotals* totals = nullptr;
+
+    ~ThreadCounters()
+    {
+#ifdef __linux__
+        for (int fd : fds)
+            close(fd);
+#endif
+    }
+};
+
+thread_local std::unique_ptr<PerfCounters::ThreadCounters> PerfCounters::local_;
+
+PerfCounters& PerfCounters::Instance()
+{
+    static PerfCounters counters;
+    return counters;
+}
+
+const char* PerfCounters::EventName(Event event)
+{
+    static const char* const names[EventsCount] =
+        { "cycles", "instructions", "l1d_misses", "llc_misses", "branch_misses", "context_switches" };
+    return names[event];
+}
+
+PerfCounters::ThreadCounters& PerfCounters::Local()
+{
+    if (local_)
+        return *local_;
+
+    local_.reset(new ThreadCounters);
+    size_t group_sizes[GroupsCount] = {};
+    for (size_t e = 0; e < EventsCount; e++)
+    {
+        local_->position[e] = -1;
+#ifdef __linux__
+        const size_t group = Events[e].group;
+        int const fd = OpenEvent(Events[e], local_->leaders[group]);
+        if (fd < 0)
+            continue;
+        if (local_->leaders[group] < 0)
+            local_->leaders[group] = fd;
+        local_->fds.push_back(fd);
+        local_->position[e] = static_cast<int>(group_sizes[group]++);
+        available_mask_.fetch_or(1u << e, std::memory_order_relaxed);
+#endif
+    }
+
+    std::unique_ptr<ThreadTotals> totals(new ThreadTotals);
+    local_->totals = totals.get();
+    std::lock_guard<std::mutex> lock(totals_mutex_);
+    totals_.push_back(std::move(totals));
+    return *local_;
+}
+
+void PerfCounters::Read(Sample& sample)
+{
+    ThreadCounters& local = Local();
+#ifdef __linux__
+    uint64_t buffer[3 + EventsCount]; // nr, time_enabled, time_running, значения
+    for (size_t group = 0; group < GroupsCount; group++)
+    {
+        if (local.leaders[group] < 0 || read(local.leaders[group], buffer, sizeof(buffer)) <= 0)
+            continue;
+        sample.enabled[group] = buffer[1];
+        sample.running[group] = buffer[2];
+        for (size_t e = 0; e < EventsCount; e++)
+            if (local.position[e] >= 0 && Events[e].group == group)
+                sample.values[e] = buffer[3 + local.position[e]];
+    }
+#else
+    (void)local;
+    (void)sample;
+#endif
+}
+
+void PerfCounters::Add(const char* stage, const Sample& begin, const Sample& end)
+{
+    ThreadTotals& totals = *Local().totals;
+    auto it = totals.stages.begin();
+    for (; it != totals.stages.end() && it->name != stage; it++)
+    {}
+    if (it == totals.stages.end())
+        it = totals.stages.insert(totals.stages.end(), { stage, 0, Values() });
+
+    it->samples++;
+#ifdef __linux__
+    for (size_t e = 0; e < EventsCount; e++)
+    {
+        // Если группа делила счетчики с другими (мультиплексирование) - экстраполируем на все время
+        const size_t group = Events[e].group;
+        uint64_t const running = end.running[group] - begin.running[group];
+        if (running == 0)
+            continue;
+        double const scale = static_cast<double>(end.enabled[group] - begin.enabled[group]) / running;
+        it->totals.values[e] += (end.values[e] - begin.values[e]) * scale;
+    }
+#endif
+}
+
+std::vector<PerfCounters::StageTotals> PerfCounters::Totals() const
+{
+    std::vector<StageTotals> result;
+    std::lock_guard<std::mutex> lock(totals_mutex_);
+    for (const auto& thread : totals_)
+        for (const auto& stage : thread->stages)
+        {
+            auto it = result.begin();
+            for (; it != result.end() && it->name != stage.name; it++)
+            {}
+            if (it == result.end())
+            {
+                result.emplace_back();
+                it = result.end() - 1;
+                it->name = stage.name;
+            }
+            it->samples += stage.samples;
+            for (size_t e = 0; e < EventsCount; e++)
+                it->totals.values[e] += stage.totals.values[e];
+        }
+
+    std::sort(result.begin(), result.end(), [](const StageTotals& a, const StageTotals& b) { return a.name < b.name; });
+    return result;
+}
+
+void PerfCounters::Reset()
+{
+    std::lock_guard<std::mutex> lock(totals_mutex_);
+    for (auto& thread : totals_)
+        thread->stages.clear();
+}
+
+} // namespace plane_render
@@ -0,0 +1,107 @@
+#include "profiler.hpp"
+
+#include <algorithm>
+#include <cstdio>
+
+namespace plane_render {
+
+namespace {
+
+void WriteJsonString(FILE* file, const std::string& str)
+{
+    fputc('"', file);
+    for (char c : str)
+    {
+        if (c == '"' || c == '\\')
+            fputc('\\', file);
+        fputc(c, file);
+    }
+    fputc('"', file);
+}
+
+} // namespace
+
+thread_local Profiler::ThreadBuffer* Profiler::local_buffer_ = nullptr;
+thread_local std::string Profiler::local_thread_name_;
+
+Profiler& Profiler::Instance()
+{
+    static Profiler profiler;
+    return profiler;
+}
+
+Profiler::Profiler() :
+    start_(Clock::now())
+{}
+
+void Profiler::SetThreadName(const std::string& name)
+{
+    local_thread_name_ = name;
+    if (local_buffer_)
+        local_buffer_->name = name;
+}
+
+Profiler::ThreadBuffer& Profiler::LocalBuffer()
+{
+    if (!local_buffer_)
+    {
+        std::unique_ptr<ThreadBuffer> buffer(new ThreadBuffer);
+        buffer->events.resize(RingCapacity);
+
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffer->id = buffers_.size();
+        buffer->name = local_thread_name_.empty() ? "thread " + std::to_string(buffer->id) : local_thread_name_;
+        local_buffer_ = buffer.get();
+        buffers_.push_back(std::move(buffer));
+    }
+    return *local_buffer_;
+}
+
+void Profiler::Record(const char* name, uint64_t start_ns, uint64_t end_ns, int64_t value)
+{
+    ThreadBuffer& buffer = LocalBuffer();
+    uint64_t const index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index & (RingCapacity - 1)] = { name, start_ns, end_ns - start_ns, value };
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+bool Profiler::WriteChromeTrace(const std::string& filename) const
+{
+    FILE* file = fopen(filename.c_str(), "w");
+    if (!file)
+        return false;
+
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+    fprintf(file, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"args\":{\"name\":\"plane_render\"}}");
+    for (const auto& buffer : buffers_)
+    {
+        fprintf(file, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%zu,\"args\":{\"name\":", buffer->id);
+        WriteJsonString(file, buffer->name);
+        fprintf(file, "}}");
+
+        // Из кольца - только последние RingCapacity событий, по порядку записи
+        uint64_t const written = buffer->written.load(std::memory_order_acquire);
+        uint64_t const first = written > RingCapacity ? written - RingCapacity : 0;
+        for (uint64_t i = first; i < written; i++)
+        {
+            const Event& e = buffer->events[i & (RingCapacity - 1)];
+            fprintf(file, ",\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%zu,\"ts\":%.3f,\"dur\":%.3f",
+                    e.name, buffer->id, e.start_ns / 1000., e.duration_ns / 1000.);
+            if (e.value != NoValue)
+                fprintf(file, ",\"args\":{\"value\":%lld}", static_cast<long long>(e.value));
+            fputc('}', file);
+        }
+    }
+    fprintf(file, "\n]}\n");
+    return fclose(file) == 0;
+}
+
+void Profiler::Reset()
+{
+    std::lock_guard<std::mutex> lock(buffers_mutex_);
+    for (auto& buffer : buffers_)
+        buffer->written.store(0, std::memory_order_relaxed);
+}
+
+} // namespace plane_render
@@ -0,0 +1,444 @@
+#include "bvh.hpp"
+
+#include "common/profiler.hpp"
+
+#include <algorithm>
+#include <limits>
+#include <memory>
+
+namespace plane_render {
+
+namespace {
+
+constexpr float Inf = std::numeric_limits<float>::infinity();
+
+// Параллелепипед на __m128 (четвертая компонента не используется)
+struct Box
+{
+    __m128 mins = _mm_set1_ps(Inf);
+    __m128 maxs = _mm_set1_ps(-Inf);
+
+    inline void Grow(__m128 p)
+    {
+        mins = _mm_min_ps(mins, p);
+        maxs = _mm_max_ps(maxs, p);
+    }
+    inline void Grow(const Box& b)
+    {
+        mins = _mm_min_ps(mins, b.mins);
+        maxs = _mm_max_ps(maxs, b.maxs);
+    }
+    // Половина площади поверхности: для SAH важны только отношения. Пустой - 0
+    inline float HalfArea() const
+    {
+        Vector4D d = _mm_max_ps(_mm_sub_ps(maxs, mins), _mm_setzero_ps());
+        return d.x*d.y + d.y*d.z + d.z*d.x;
+    }
+};
+
+// Наибольшая и наименьшая из трех младших компонент
+inline float Max3(__m128 v)
+{
+    v = _mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)));
+    return _mm_cvtss_f32(_mm_max_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2))));
+}
+inline float Min3(__m128 v)
+{
+    v = _mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 0, 2, 1)));
+    return _mm_cvtss_f32(_mm_min_ps(v, _mm_shuffle_ps(v, v, _MM_SHUFFLE(3, 1, 0, 2))));
+}
+
+} // namespace
+
+struct Bvh::BuildContext
+{
+    VectorAlignment16<Box> boxes;  // Описывающий параллелепипед треугольника
+    Vec4DynamicArray centroids;    // Центр его параллелепипеда
+    std::vector<uint32_t> order;   // Треугольники подряд по листьям
+};
+
+struct Bvh::BuildNode
+{
+    size_t begin = 0; // Треугольники ctx.order[begin, end)
+    size_t end = 0;
+    float mins[4];
+    float maxs[4];
+    uint16_t axis = 0;
+    size_t depth = 0; // Корень - 0
+    std::unique_ptr<BuildNode> children[2]; // Пусто - лист
+};
+
+Bvh::Bvh(const std::vector<SceneObject>& objects, ThreadPool& pool, const std::function<bool(size_t)>& use) :
+    isa_(ActiveIsa())
+{
+    PROFILE_SCOPE("bvh build");
+    for (uint32_t o = 0; o < objects.size(); o++)
+    {
+        if (use && !use(o))
+            continue;
+        const SceneObject& obj = objects[o];
+        const IndicesList& indices = obj.LodIndices(0);
+        const Vec4DynamicArray& coords = obj.SourceCoords();
+        for (uint32_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            sources_.push_back({ o, i });
+            for (size_t k = 0; k < 3; k++)
+                corners_.push_back(coords[indices[i + k]] + obj.Position());
+        }
+    }
+    CHECK(sources_.size() < std::numeric_limits<uint32_t>::max());
+
+    size_t const count = sources_.size();
+    BuildContext ctx;
+    ctx.boxes.resize(count);
+    ctx.centroids.resize(count);
+    ctx.order.resize(count);
+    size_t const parts = pool.ThreadsCount();
+    for (size_t part = 0; part < parts; part++)
+    {
+        pool.AddTask([this, &ctx, part, parts, count]()
+        {
+            for (size_t t = count*part/parts; t < count*(part+1)/parts; t++)
+            {
+                Box box;
+                for (size_t k = 0; k < 3; k++)
+                    box.Grow(corners_[3*t + k]);
+                ctx.boxes[t] = box;
+                ctx.centroids[t] = _mm_mul_ps(_mm_add_ps(box.mins, box.maxs), _mm_set1_ps(0.5f));
+                ctx.order[t] = static_cast<uint32_t>(t);
+            }
+        }, false);
+    }
+    pool.Join();
+
+    // Верх дерева - здесь, пока поддеревья не станут достаточно мелкими, чтобы их хватило на все потоки
+    BuildNode root;
+    root.end = count;
+    std::vector<BuildNode*> deferred;
+    size_t const defer_below = std::max<size_t>(count / (4*parts), 1024);
+    BuildNodeSubtree(ctx, root, defer_below, &deferred);
+    for (BuildNode* node : deferred)
+        pool.AddTask([this, &ctx, node]() { BuildNodeSubtree(ctx, *node, 0, nullptr); }, false);
+    pool.Join();
+
+    if (count > 0)
+        Flatten(root, ctx, 0);
+}
+
+void Bvh::BuildNodeSubtree(BuildContext& ctx, BuildNode& node, size_t defer_below, std::vector<BuildNode*>* deferred)
+{
+    Box box, centroids;
+    for (size_t i = node.begin; i < node.end; i++)
+    {
+        box.Grow(ctx.boxes[ctx.order[i]]);
+        centroids.Grow(ctx.centroids[ctx.order[i]]);
+    }
+    _mm_storeu_ps(node.mins, box.mins);
+    _mm_storeu_ps(node.maxs, box.maxs);
+
+    size_t const count = node.end - node.begin;
+    if (count <= LeafSize)
+        return;
+    if (deferred && count < defer_below)
+    {
+        deferred->push_back(&node);
+        return;
+    }
+
+    // Ось - по наибольшему разбросу центров, разбиение - по границам корзин с наименьшей SAH:
+    // площадь левой части * треугольников в ней + то же для правой
+    Vector4D const extent = _mm_sub_ps(centroids.maxs, centroids.mins);
+    uint16_t const axis = extent.x >= extent.y && extent.x >= extent.z ? 0 : (extent.y >= extent.z ? 1 : 2);
+    node.axis = axis;
+    float const lo = Vector4D(centroids.mins).vals[axis];
+    float const scale = extent.vals[axis] > 0.f ? Bins / extent.vals[axis] : 0.f;
+    auto bin_of = [&ctx, axis, lo, scale](uint32_t t)
+    {
+        return std::min(static_cast<size_t>((ctx.centroids[t].vals[axis] - lo) * scale), Bins - 1);
+    };
+
+    // Уровней до листьев при делении пополам. SAH может отщеплять от вырожденных мешей (полосы, одинаковые
+    // параллелепипеды) по корзине за уровень, поэтому, как только они едва помещаются в MaxDepth (стек обхода),
+    // дальше - только по медиане центров: у половины уровней на один меньше, и листья не глубже MaxDepth - 1
+    size_t levels = 0;
+    for (size_t leaves = (count + LeafSize - 1) / LeafSize; leaves > 1; leaves = (leaves + 1) / 2)
+        levels++;
+    bool const median = node.depth + levels >= MaxDepth - 1;
+
+    size_t split = node.begin + count / 2; // Если центры не различаются - пополам по порядку
+    if (median && scale > 0.f)
+    {
+        auto const centroid_less = [&ctx, axis](uint32_t a, uint32_t b)
+        {
+            return ctx.centroids[a].vals[axis] < ctx.centroids[b].vals[axis];
+        };
+        std::nth_element(ctx.order.begin() + node.begin, ctx.order.begin() + split, ctx.order.begin() + node.end,
+                         centroid_less);
+    }
+    else if (scale > 0.f)
+    {
+        Box bin_boxes[Bins];
+        size_t bin_counts[Bins] = {};
+        for (size_t i = node.begin; i < node.end; i++)
+        {
+            size_t const b = bin_of(ctx.order[i]);
+            bin_boxes[b].Grow(ctx.boxes[ctx.order[i]]);
+            bin_counts[b]++;
+        }
+
+        float right_cost[Bins]; // Для разбиения перед корзиной b: правая часть - корзины b..Bins-1
+        Box right;
+        size_t right_count = 0;
+        for (size_t b = Bins - 1; b > 0; b--)
+        {
+            right.Grow(bin_boxes[b]);
+            right_count += bin_counts[b];
+            right_cost[b] = right.HalfArea() * right_count;
+        }
+
+        float best_cost = Inf;
+        size_t best_bin = 0;
+        Box left;
+        size_t left_count = 0;
+        for (size_t b = 1; b < Bins; b++)
+        {
+            left.Grow(bin_boxes[b - 1]);
+            left_count += bin_counts[b - 1];
+            float const cost = left.HalfArea() * left_count + right_cost[b];
+            if (left_count > 0 && left_count < count && cost < best_cost)
+            {
+                best_cost = cost;
+                best_bin = b;
+            }
+        }
+        if (best_bin > 0)
+        {
+            auto const middle = std::partition(ctx.order.begin() + node.begin, ctx.order.begin() + node.end,
+                                               [&bin_of, best_bin](uint32_t t) { return bin_of(t) < best_bin; });
+            split = middle - ctx.order.begin();
+        }
+    }
+
+    for (size_t c = 0; c < 2; c++)
+    {
+        node.children[c].reset(new BuildNode());
+        node.children[c]->begin = c == 0 ? node.begin : split;
+        node.children[c]->end = c == 0 ? split : node.end;
+        node.children[c]->depth = node.depth + 1;
+        BuildNodeSubtree(ctx, *node.children[c], defer_below, deferred);
+    }
+}
+
+void Bvh::Flatten(const BuildNode& node, const BuildContext& ctx, size_t depth)
+{
+    CHECK(depth < MaxDepth); // Стек обхода: BuildNodeSubtree глубже не строит
+    size_t const index = nodes_.size();
+    nodes_.emplace_back();
+    Node& flat = nodes_.back();
+    std::copy(node.mins, node.mins + 3, flat.mins);
+    std::copy(node.maxs, node.maxs + 3, flat.maxs);
+    flat.axis = node.axis;
+
+    if (!node.children[0])
+    {
+        DCHECK(node.end - node.begin <= LeafSize);
+        flat.offset = static_cast<uint32_t>(blocks_.size());
+        flat.count = static_cast<uint16_t>(node.end - node.begin);
+        blocks_.emplace_back();
+        TriangleBlock& block = blocks_.back();
+        for (size_t lane = 0; lane < LeafSize; lane++)
+        {
+            uint32_t const t = node.begin + lane < node.end ? ctx.order[node.begin + lane] : ctx.order[node.begin];
+            bool const empty = node.begin + lane >= node.end;
+            Vector4D const a = corners_[3*t];
+            Vector4D const e1 = empty ? Vector4D(0.f, 0.f, 0.f, 0.f) : Vector4D(corners_[3*t + 1] - a);
+            Vector4D const e2 = empty ? Vector4D(0.f, 0.f, 0.f, 0.f) : Vector4D(corners_[3*t + 2] - a);
+            for (size_t k = 0; k < 3; k++)
+            {
+                block.a[k][lane] = a.vals[k];
+                block.e1[k][lane] = e1.vals[k];
+                block.e2[k][lane] = e2.vals[k];
+            }
+            block.id[lane] = t;
+        }
+        return;
+    }
+
+    flat.count = 0;
+    Flatten(*node.children[0], ctx, depth + 1);
+    uint32_t const right = static_cast<uint32_t>(nodes_.size());
+    nodes_[index].offset = right; // flat мог стать недействительным после роста nodes_
+    Flatten(*node.children[1], ctx, depth + 1);
+}
+
+FastVector3D Bvh::GeometricNormal(uint32_t triangle) const
+{
+    FastVector3D const a = corners_[3*triangle];
+    FastVector3D const e1 = corners_[3*triangle + 1] - a;
+    FastVector3D const e2 = corners_[3*triangle + 2] - a;
+    return e1.Cross(e2);
+}
+
+bool Bvh::Intersect(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max, RayHit& hit) const
+{
+    return Traverse<false>(origin, dir, t_min, t_max, &hit);
+}
+
+bool Bvh::Occluded(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max) const
+{
+    return Traverse<true>(origin, dir, t_min, t_max, nullptr);
+}
+
+template<bool AnyHit>
+bool Bvh::Traverse(const FastVector3D& origin, const FastVector3D& dir, float t_min, float t_max, RayHit* hit) const
+{
+    if (nodes_.empty())
+        return false;
+
+    __m128 const inv_dir = _mm_div_ps(_mm_set1_ps(1.f), dir);
+    bool const negative[3] = { dir.x < 0.f, dir.y < 0.f, dir.z < 0.f };
+    bool found = false;
+
+    uint32_t stack[MaxDepth];
+    size_t stack_size = 0;
+    uint32_t current = 0;
+    while (true)
+    {
+        const Node& node = nodes_[current];
+
+        // Пересечение с параллелепипедом (slab test), четвертая дорожка - границы самого луча
+        __m128 const t1 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.mins), origin), inv_dir);
+        __m128 const t2 = _mm_mul_ps(_mm_sub_ps(_mm_load_ps(node.maxs), origin), inv_dir);
+        float const t_near = Max3(_mm_blend_ps(_mm_min_ps(t1, t2), _mm_set1_ps(t_min), 8));
+        float const t_far = Min3(_mm_blend_ps(_mm_max_ps(t1, t2), _mm_set1_ps(t_max), 8));
+        bool const visit = t_near <= t_far && t_near <= t_max && t_far >= t_min;
+
+        if (visit && node.count == 0)
+        {
+            // Сначала ближний по направлению луча потомок
+            uint32_t near_child = current + 1;
+            uint32_t far_child = node.offset;
+            if (negative[node.axis])
+                std::swap(near_child, far_child);
+            DCHECK(stack_size < sizeof(stack) / sizeof(stack[0]));
+            stack[stack_size++] = far_child;
+            current = near_child;
+            continue;
+        }
+        if (visit && IntersectBlock(blocks_[node.offset], origin, dir, t_min, t_max, hit))
+        {
+            found = true;
+            if (AnyHit)
+                return true;
+        }
+        if (stack_size == 0)
+            break;
+        current = stack[--stack_size];
+    }
+    return found;
+}
+
+bool Bvh::IntersectBlock(const TriangleBlock& block, const FastVector3D& origin, const FastVector3D& dir,
+                         float t_min, float& t_max, RayHit* hit) const
+{
+    if (isa_ >= Isa::Avx2)
+        return IntersectBlockAvx2(block, origin, dir, t_min, t_max, hit);
+    return IntersectBlockScalar(block, origin, dir, t_min, t_max, hit);
+}
+
+// Мёллер-Трумбор, двусторонний. Порядок операций - как в IntersectBlockAvx2
+bool Bvh::IntersectBlockScalar(const TriangleBlock& block, const FastVector3D& origin, const FastVector3D& dir,
+                               float t_min, float& t_max, RayHit* hit) const
+{
+    bool found = false;
+    for (size_t i = 0; i < LeafSize; i++)
+    {
+        float const e1x = block.e1[0][i], e1y = block.e1[1][i], e1z = block.e1[2][i];
+        float const e2x = block.e2[0][i], e2y = block.e2[1][i], e2z = block.e2[2][i];
+        float const px = dir.y*e2z - dir.z*e2y;
+        float const py = dir.z*e2x - dir.x*e2z;
+        float const pz = dir.x*e2y - dir.y*e2x;
+        float const det = e1x*px + e1y*py + e1z*pz;
+        if (std::abs(det) <= GraphicsEps)
+            continue;
+        float const inv_det = 1.f / det;
+
+        float const sx = origin.x - block.a[0][i], sy = origin.y - block.a[1][i], sz = origin.z - block.a[2][i];
+        float const u = (sx*px + sy*py + sz*pz) * inv_det;
+        float const qx = sy*e1z - sz*e1y;
+        float const qy = sz*e1x - sx*e1z;
+        float const qz = sx*e1y - sy*e1x;
+        float const v = (dir.x*qx + dir.y*qy + dir.z*qz) * inv_det;
+        float const t = (e2x*qx + e2y*qy + e2z*qz) * inv_det;
+        if (u < 0.f || v < 0.f || u + v > 1.f || t <= t_min || t >= t_max)
+            continue;
+
+        t_max = t;
+        found = true;
+        if (hit)
+            *hit = RayHit{ t, u, v, block.id[i] };
+    }
+    return found;
+}
+
+bool Bvh::IntersectBlockAvx2(const TriangleBlock& block, const FastVector3D& origin, const FastVector3D& dir,
+                             float t_min, float& t_max, RayHit* hit) const
+{
+    static_assert(LeafSize == 8, "Block is one AVX register per component");
+    __m256 const dx = _mm256_set1_ps(dir.x), dy = _mm256_set1_ps(dir.y), dz = _mm256_set1_ps(dir.z);
+    __m256 const e1x = _mm256_load_ps(block.e1[0]), e1y = _mm256_load_ps(block.e1[1]), e1z = _mm256_load_ps(block.e1[2]);
+    __m256 const e2x = _mm256_load_ps(block.e2[0]), e2y = _mm256_load_ps(block.e2[1]), e2z = _mm256_load_ps(block.e2[2]);
+
+    __m256 const px = _mm256_sub_ps(_mm256_mul_ps(dy, e2z), _mm256_mul_ps(dz, e2y));
+    __m256 const py = _mm256_sub_ps(_mm256_mul_ps(dz, e2x), _mm256_mul_ps(dx, e2z));
+    __m256 const pz = _mm256_sub_ps(_mm256_mul_ps(dx, e2y), _mm256_mul_ps(dy, e2x));
+    __m256 const det = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e1x, px), _mm256_mul_ps(e1y, py)), _mm256_mul_ps(e1z, pz));
+    __m256 const abs_det = _mm256_andnot_ps(_mm256_set1_ps(-0.f), det);
+    __m256 mask = _mm256_cmp_ps(abs_det, _mm256_set1_ps(GraphicsEps), _CMP_GT_OQ);
+    if (!_mm256_movemask_ps(mask))
+        return false;
+    __m256 const inv_det = _mm256_div_ps(_mm256_set1_ps(1.f), det);
+
+    __m256 const sx = _mm256_sub_ps(_mm256_set1_ps(origin.x), _mm256_load_ps(block.a[0]));
+    __m256 const sy = _mm256_sub_ps(_mm256_set1_ps(origin.y), _mm256_load_ps(block.a[1]));
+    __m256 const sz = _mm256_sub_ps(_mm256_set1_ps(origin.z), _mm256_load_ps(block.a[2]));
+    __m256 const u = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(sx, px), _mm256_mul_ps(sy, py)),
+                                                 _mm256_mul_ps(sz, pz)), inv_det);
+    __m256 const qx = _mm256_sub_ps(_mm256_mul_ps(sy, e1z), _mm256_mul_ps(sz, e1y));
+    __m256 const qy = _mm256_sub_ps(_mm256_mul_ps(sz, e1x), _mm256_mul_ps(sx, e1z));
+    __m256 const qz = _mm256_sub_ps(_mm256_mul_ps(sx, e1y), _mm256_mul_ps(sy, e1x));
+    __m256 const v = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, qx), _mm256_mul_ps(dy, qy)),
+                                                 _mm256_mul_ps(dz, qz)), inv_det);
+    __m256 const t = _mm256_mul_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(e2x, qx), _mm256_mul_ps(e2y, qy)),
+                                                 _mm256_mul_ps(e2z, qz)), inv_det);
+
+    __m256 const zero = _mm256_setzero_ps();
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(u, zero, _CMP_GE_OQ), _mm256_cmp_ps(v, zero, _CMP_GE_OQ)));
+    mask = _mm256_and_ps(mask, _mm256_cmp_ps(_mm256_add_ps(u, v), _mm256_set1_ps(1.f), _CMP_LE_OQ));
+    mask = _mm256_and_ps(mask, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(t_min), _CMP_GT_OQ),
+                                             _mm256_cmp_ps(t, _mm256_set1_ps(t_max), _CMP_LT_OQ)));
+    int lanes = _mm256_movemask_ps(mask);
+    if (!lanes)
+        return false;
+
+    // Ближайшее из попаданий: минимум t по дорожкам, при равенстве - младшая дорожка (как в скалярном)
+    __m256 t_masked = _mm256_blendv_ps(_mm256_set1_ps(Inf), t, mask);
+    __m256 t_min_all = _mm256_min_ps(t_masked, _mm256_permute2f128_ps(t_masked, t_masked, 1));
+    t_min_all = _mm256_min_ps(t_min_all, _mm256_permute_ps(t_min_all, _MM_SHUFFLE(1, 0, 3, 2)));
+    t_min_all = _mm256_min_ps(t_min_all, _mm256_permute_ps(t_min_all, _MM_SHUFFLE(2, 3, 0, 1)));
+    lanes &= _mm256_movemask_ps(_mm256_cmp_ps(t_masked, t_min_all, _CMP_EQ_OQ));
+    size_t const lane = __builtin_ctz(lanes);
+
+    alignas(32) float t_lanes[LeafSize], u_lanes[LeafSize], v_lanes[LeafSize];
+    _mm256_store_ps(t_lanes, t);
+    t_max = t_lanes[lane];
+    if (hit)
+    {
+        _mm256_store_ps(u_lanes, u);
+        _mm256_store_ps(v_lanes, v);
+        *hit = RayHit{ t_lanes[lane], u_lanes[lane], v_lanes[lane], block.id[lane] };
+    }
+    return true;
+}
+
+} // namespace plane_render
@@ -0,0 +1,383 @@
+#include "mesh_simplifier.hpp"
+
+#include "common/logger.hpp"
+
+#include <array>
+#include <queue>
+#include <limits>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include <unordered_map>
+
+namespace plane_render {
+
+namespace {
+
+constexpr size_t InvalidId = std::numeric_limits<size_t>::max();
+
+// Во сколько раз ошибка ухода с границы меша дороже ошибки на поверхности
+constexpr double BoundaryWeight = 10.0;
+
+// Геометрия считается в double: квадрики плохо обусловлены
+struct Vec3d
+{
+    double x = 0;
+    double y = 0;
+    double z = 0;
+
+    Vec3d operator-(const Vec3d& v) const { return { x - v.x, y - v.y, z - v.z }; }
+    Vec3d operator*(double val) const { return { x*val, y*val, z*val }; }
+    double Dot(const Vec3d& v) const { return x*v.x + y*v.y + z*v.z; }
+    Vec3d Cross(const Vec3d& v) const { return { y*v.z - z*v.y, z*v.x - x*v.z, x*v.y - y*v.x }; }
+    double Norm() const { return std::sqrt(Dot(*this)); }
+};
+
+// Симметричная матрица 4x4 - храним только верхний треугольник
+struct Quadric
+{
+    double a[10] = {};
+
+    // Плоскость n*p + d = 0 (|n| = 1) с весом weight
+    void AddPlane(const Vec3d& n, double d, double weight)
+    {
+        a[0] += weight*n.x*n.x; a[1] += weight*n.x*n.y; a[2] += weight*n.x*n.z; a[3] += weight*n.x*d;
+        a[4] += weight*n.y*n.y; a[5] += weight*n.y*n.z; a[6] += weight*n.y*d;
+        a[7] += weight*n.z*n.z; a[8] += weight*n.z*d;
+        a[9] += weight*d*d;
+    }
+
+    Quadric& operator+=(const Quadric& q)
+    {
+        for (size_t i = 0; i < 10; i++)
+            a[i] += q.a[i];
+        return *this;
+    }
+
+    // p^T * Q * p для p = (x, y, z, 1)
+    double Error(const Vec3d& p) const
+    {
+        return a[0]*p.x*p.x + 2*a[1]*p.x*p.y + 2*a[2]*p.x*p.z + 2*a[3]*p.x
+             + a[4]*p.y*p.y + 2*a[5]*p.y*p.z + 2*a[6]*p.y
+             + a[7]*p.z*p.z + 2*a[8]*p.z
+             + a[9];
+    }
+};
+
+// Кандидат на стягивание: from -> to. stamp - версии вершин на момент расчета (иначе запись устарела)
+struct Collapse
+{
+    double cost;
+    size_t from;
+    size_t to;
+    size_t stamp_from;
+    size_t stamp_to;
+
+    bool operator>(const Collapse& c) const { return cost > c.cost; }
+};
+
+struct PositionKey
+{
+    uint32_t bits[3];
+
+    bool operator==(const PositionKey& k) const
+    {
+        return bits[0] == k.bits[0] && bits[1] == k.bits[1] && bits[2] == k.bits[2];
+    }
+};
+
+struct PositionKeyHash
+{
+    size_t operator()(const PositionKey& k) const
+    {
+        size_t h = k.bits[0];
+        h = h*0x9E3779B1u + k.bits[1];
+        h = h*0x9E3779B1u + k.bits[2];
+        return h;
+    }
+};
+
+PositionKey MakeKey(const Vector4D& pos)
+{
+    PositionKey key;
+    for (size_t i = 0; i < 3; i++)
+    {
+        float val = pos.vals[i] + 0.f; // -0.f -> +0.f
+        memcpy(&key.bits[i], &val, sizeof(float));
+    }
+    return key;
+}
+
+inline uint64_t EdgeKey(size_t a, size_t b)
+{
+    if (a > b)
+        std::swap(a, b);
+    return (static_cast<uint64_t>(a) << 32) | static_cast<uint64_t>(b);
+}
+
+class Simplifier
+{
+public:
+    Simplifier(const Vec4DynamicArray& positions, const IndicesList& indices) :
+        indices_(indices),
+        vertex_group_(positions.size(), InvalidId)
+    {
+        DCHECK(indices_.size() % 3 == 0);
+        WeldVertices(positions);
+        BuildTriangles();
+        BuildQuadrics();
+    }
+
+    IndicesList Run(size_t target_triangles)
+    {
+        while (alive_triangles_ > target_triangles && !heap_.empty())
+        {
+            Collapse c = heap_.top();
+            heap_.pop();
+
+            if (!group_alive_[c.from] || !group_alive_[c.to] ||
+                stamp_[c.from] != c.stamp_from || stamp_[c.to] != c.stamp_to)
+                continue; // Устаревшая запись
+
+            if (!CanCollapse(c.from, c.to))
+                continue;
+            ApplyCollapse(c.from, c.to);
+        }
+
+        IndicesList result;
+        result.reserve(alive_triangles_*3);
+        for (size_t t = 0; t < tri_groups_.size(); t++)
+        {
+            if (!tri_alive_[t])
+                continue;
+            for (size_t k = 0; k < 3; k++)
+            {
+                // Если вершина осталась на месте - сохраняем ее атрибуты, иначе берем любую из новой группы
+                size_t v = indices_[3*t + k];
+                size_t g = tri_groups_[t][k];
+                result.push_back(vertex_group_[v] == g ? v : group_repr_[g]);
+            }
+        }
+        return result;
+    }
+
+private:
+    void WeldVertices(const Vec4DynamicArray& positions)
+    {
+        std::unordered_map<PositionKey, size_t, PositionKeyHash> groups;
+        for (size_t v : indices_)
+        {
+            if (vertex_group_[v] != InvalidId)
+                continue;
+
+            auto it = groups.emplace(MakeKey(positions[v]), group_pos_.size());
+            if (it.second)
+            {
+                group_pos_.push_back({ positions[v].x, positions[v].y, positions[v].z });
+                group_repr_.push_back(v);
+            }
+            vertex_group_[v] = it.first->second;
+        }
+
+        group_alive_.assign(group_pos_.size(), true);
+        stamp_.assign(group_pos_.size(), 0);
+        group_tris_.resize(group_pos_.size());
+        quadrics_.resize(group_pos_.size());
+    }
+
+    void BuildTriangles()
+    {
+        size_t tri_count = indices_.size() / 3;
+        tri_groups_.resize(tri_count);
+        tri_alive_.assign(tri_count, false);
+        for (size_t t = 0; t < tri_count; t++)
+        {
+            auto& tri = tri_groups_[t];
+            for (size_t k = 0; k < 3; k++)
+                tri[k] = vertex_group_[indices_[3*t + k]];
+            if (tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2])
+                continue; // Вырожденный уже после склейки
+
+            tri_alive_[t] = true;
+            alive_triangles_++;
+            for (size_t k = 0; k < 3; k++)
+                group_tris_[tri[k]].push_back(t);
+        }
+    }
+
+    void BuildQuadrics()
+    {
+        // (сколько раз встретилось ребро; треугольник, где встретилось впервые)
+        std::unordered_map<uint64_t, std::pair<size_t, size_t>> edges;
+        for (size_t t = 0; t < tri_groups_.size(); t++)
+        {
+            if (!tri_alive_[t])
+                continue;
+            const auto& tri = tri_groups_[t];
+
+            Vec3d n = TriangleNormal(group_pos_[tri[0]], group_pos_[tri[1]], group_pos_[tri[2]]);
+            double len = n.Norm();
+            if (len > 0)
+            {
+                n = n * (1 / len);
+                double d = -n.Dot(group_pos_[tri[0]]);
+                for (size_t k = 0; k < 3; k++)
+                    quadrics_[tri[k]].AddPlane(n, d, len / 2); // Вес - площадь
+            }
+
+            for (size_t k = 0; k < 3; k++)
+            {
+                auto it = edges.emplace(EdgeKey(tri[k], tri[(k+1) % 3]), std::make_pair(0, t));
+                it.first->second.first++;
+            }
+        }
+
+        // Граничные ребра: добавляем плоскость, перпендикулярную грани, чтобы граница не "съезжала"
+        for (const auto& edge : edges)
+        {
+            if (edge.second.first != 1)
+                continue;
+
+            size_t a = static_cast<size_t>(edge.first >> 32);
+            size_t b = static_cast<size_t>(edge.first & 0xFFFFFFFFu);
+            const auto& tri = tri_groups_[edge.second.second];
+            Vec3d n = TriangleNormal(group_pos_[tri[0]], group_pos_[tri[1]], group_pos_[tri[2]]);
+            Vec3d e = group_pos_[b] - group_pos_[a];
+            Vec3d m = e.Cross(n);
+            double len = m.Norm();
+            if (len == 0)
+                continue;
+            m = m * (1 / len);
+            double d = -m.Dot(group_pos_[a]);
+            quadrics_[a].AddPlane(m, d, BoundaryWeight*e.Dot(e));
+            quadrics_[b].AddPlane(m, d, BoundaryWeight*e.Dot(e));
+        }
+
+        for (const auto& edge : edges)
+            PushEdge(static_cast<size_t>(edge.first >> 32), static_cast<size_t>(edge.first & 0xFFFFFFFFu));
+    }
+
+    static Vec3d TriangleNormal(const Vec3d& p0, const Vec3d& p1, const Vec3d& p2)
+    {
+        return (p1 - p0).Cross(p2 - p0);
+    }
+
+    void PushEdge(size_t a, size_t b)
+    {
+        Quadric q = quadrics_[a];
+        q += quadrics_[b];
+
+        double cost_ab = q.Error(group_pos_[b]); // a -> b
+        double cost_ba = q.Error(group_pos_[a]); // b -> a
+        if (cost_ab <= cost_ba)
+            heap_.push({ cost_ab, a, b, stamp_[a], stamp_[b] });
+        else
+            heap_.push({ cost_ba, b, a, stamp_[b], stamp_[a] });
+    }
+
+    // Запрещаем стягивания, переворачивающие соседние треугольники
+    bool CanCollapse(size_t from, size_t to) const
+    {
+        for (size_t t : group_tris_[from])
+        {
+            if (!tri_alive_[t])
+                continue;
+            const auto& tri = tri_groups_[t];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+                continue; // Этот треугольник исчезнет
+
+            Vec3d p[3];
+            Vec3d p_new[3];
+            for (size_t k = 0; k < 3; k++)
+            {
+                p[k] = group_pos_[tri[k]];
+                p_new[k] = (tri[k] == from) ? group_pos_[to] : p[k];
+            }
+
+            Vec3d n_old = TriangleNormal(p[0], p[1], p[2]);
+            Vec3d n_new = TriangleNormal(p_new[0], p_new[1], p_new[2]);
+            if (n_old.Dot(n_new) <= 0)
+                return false;
+        }
+        return true;
+    }
+
+    void ApplyCollapse(size_t from, size_t to)
+    {
+        for (size_t t : group_tris_[from])
+        {
+            if (!tri_alive_[t])
+                continue;
+            auto& tri = tri_groups_[t];
+            if (tri[0] == to || tri[1] == to || tri[2] == to)
+            {
+                tri_alive_[t] = false;
+                alive_triangles_--;
+                continue;
+            }
+
+            for (size_t k = 0; k < 3; k++)
+            {
+                if (tri[k] == from)
+                    tri[k] = to;
+            }
+            group_tris_[to].push_back(t);
+        }
+
+        quadrics_[to] += quadrics_[from];
+        group_alive_[from] = false;
+        group_tris_[from].clear();
+        group_tris_[from].shrink_to_fit();
+        stamp_[to]++;
+
+        // Чистим список треугольников to и пересчитываем ребра к соседям
+        auto& to_tris = group_tris_[to];
+        to_tris.erase(std::remove_if(to_tris.begin(), to_tris.end(), [this](size_t t) { return !tri_alive_[t]; }),
+                      to_tris.end());
+        std::sort(to_tris.begin(), to_tris.end());
+        to_tris.erase(std::unique(to_tris.begin(), to_tris.end()), to_tris.end());
+
+        std::vector<size_t> neighbours;
+        for (size_t t : to_tris)
+        {
+            for (size_t g : tri_groups_[t])
+            {
+                if (g != to)
+                    neighbours.push_back(g);
+            }
+        }
+        std::sort(neighbours.begin(), neighbours.end());
+        neighbours.erase(std::unique(neighbours.begin(), neighbours.end()), neighbours.end());
+
+        for (size_t n : neighbours)
+            PushEdge(to, n);
+    }
+
+private:
+    const IndicesList& indices_;
+
+    // Группы - вершины, склеенные по координатам
+    std::vector<size_t> vertex_group_; // vertex -> group
+    std::vector<Vec3d> group_pos_;
+    std::vector<size_t> group_repr_; // Любая вершина группы (для атрибутов стянутых вершин)
+    std::vector<bool> group_alive_;
+    std::vector<size_t> stamp_;
+    std::vector<std::vector<size_t>> group_tris_;
+    std::vector<Quadric> quadrics_;
+
+    std::vector<std::array<size_t, 3>> tri_groups_;
+    std::vector<bool> tri_alive_;
+    size_t alive_triangles_ = 0;
+
+    std::priority_queue<Collapse, std::vector<Collapse>, std::greater<Collapse>> heap_;
+};
+
+} // namespace
+
+IndicesList SimplifyMesh(const Vec4DynamicArray& positions, const IndicesList& indices, size_t target_triangles)
+{
+    Simplifier simplifier(positions, indices);
+    return simplifier.Run(target_triangles);
+}
+
+} // namespace plane_render
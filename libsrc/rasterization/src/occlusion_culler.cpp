@@ -0,0 +1,157 @@
+#include "occlusion_culler.hpp"
+
+#include "rasterization/screen_buffer.hpp"
+#include "common/profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+namespace plane_render {
+
+constexpr size_t OcclusionCuller::DefaultWidth;
+constexpr size_t OcclusionCuller::DefaultHeight;
+constexpr float OcclusionCuller::MinOccluderShare;
+
+OcclusionCuller::OcclusionCuller(const RenderingGeometryConstPtr& geom, size_t width, size_t height) :
+    geom_(geom),
+    width_(width),
+    height_(height),
+    stride_((width + 3) & ~size_t(3)),
+    depth_(stride_*height, ScreenBuffer::ClearZ)
+{
+    DCHECK(width > 0 && height > 0);
+}
+
+void OcclusionCuller::Clear()
+{
+    std::fill(depth_.begin(), depth_.end(), ScreenBuffer::ClearZ);
+}
+
+void OcclusionCuller::AddOccluder(const SceneObject& obj)
+{
+    PROFILE_SCOPE("occluder", obj.LodIndices(0).size() / 3);
+    float const scale_x = static_cast<float>(width_) / geom_->Width();
+    float const scale_y = static_cast<float>(height_) / geom_->Height();
+    const VerticesVector& vertices = obj.Vertices();
+    const IndicesList& indices = obj.LodIndices(0);
+    for (size_t t = 0; t + 2 < indices.size(); t += 3)
+    {
+        const Vertex& A = vertices[indices[t]];
+        const Vertex& B = vertices[indices[t + 1]];
+        const Vertex& C = vertices[indices[t + 2]];
+        // Как в основном растеризаторе: у таких вершин нет pixel_pos
+        if (A.vertex_coords.z > -GraphicsEps || B.vertex_coords.z > -GraphicsEps || C.vertex_coords.z > -GraphicsEps)
+            continue;
+        RasterizeTriangle(A, B, C, scale_x, scale_y);
+    }
+}
+
+void OcclusionCuller::RasterizeTriangle(const Vertex& A, const Vertex& B, const Vertex& C, float scale_x, float scale_y)
+{
+    // Пиксели кадра -> пиксели буфера: центры пикселей совпадают по краям экрана
+    float px[3] = { (A.pixel_pos.x + 0.5f)*scale_x - 0.5f, (B.pixel_pos.x + 0.5f)*scale_x - 0.5f, (C.pixel_pos.x + 0.5f)*scale_x - 0.5f };
+    float py[3] = { (A.pixel_pos.y + 0.5f)*scale_y - 0.5f, (B.pixel_pos.y + 0.5f)*scale_y - 0.5f, (C.pixel_pos.y + 0.5f)*scale_y - 0.5f };
+    float const area = (px[1] - px[0])*(py[2] - py[0]) - (py[1] - py[0])*(px[2] - px[0]);
+    if (!(std::abs(area) > 0.f))
+        return;
+    if (area < 0.f) // Обход - против часовой, чтобы внутри все реберные функции были >= 0
+    {
+        std::swap(px[1], px[2]);
+        std::swap(py[1], py[2]);
+    }
+
+    long const x0 = std::max(0L, static_cast<long>(std::ceil(std::min({ px[0], px[1], px[2] })))) & ~3L;
+    long const x1 = std::min(static_cast<long>(width_) - 1, static_cast<long>(std::floor(std::max({ px[0], px[1], px[2] }))));
+    long const y0 = std::max(0L, static_cast<long>(std::ceil(std::min({ py[0], py[1], py[2] }))));
+    long const y1 = std::min(static_cast<long>(height_) - 1, static_cast<long>(std::floor(std::max({ py[0], py[1], py[2] }))));
+    if (x0 > x1 || y0 > y1)
+        return;
+
+    // Ребро i - от вершины i к следующей: E(x, y) = ux*(y - py) - uy*(x - px). В регистре - 4 соседних пикселя ряда
+    __m128 const lanes = _mm_set_ps(3.f, 2.f, 1.f, 0.f);
+    __m128 row_e[3], step_x4[3], step_y[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        size_t const j = (i + 1) % 3;
+        float const ux = px[j] - px[i];
+        float const uy = py[j] - py[i];
+        float const e = ux*(static_cast<float>(y0) - py[i]) - uy*(static_cast<float>(x0) - px[i]);
+        row_e[i] = _mm_sub_ps(_mm_set1_ps(e), _mm_mul_ps(lanes, _mm_set1_ps(uy)));
+        step_x4[i] = _mm_set1_ps(-4.f*uy);
+        step_y[i] = _mm_set1_ps(ux);
+    }
+
+    // Глубина с запасом - самая дальняя вершина: заслонитель не может оказаться ближе, чем есть
+    __m128 const z = _mm_set1_ps(std::min({ A.vertex_coords.z, B.vertex_coords.z, C.vertex_coords.z }));
+    __m128 const zero = _mm_setzero_ps();
+    for (long y = y0; y <= y1; y++)
+    {
+        float* row = depth_.data() + static_cast<size_t>(y)*stride_;
+        __m128 e0 = row_e[0];
+        __m128 e1 = row_e[1];
+        __m128 e2 = row_e[2];
+        // Блоки выровнены и не выходят за stride_, дорожки за x1 - вне треугольника
+        for (long x = x0; x <= x1; x += 4)
+        {
+            __m128 const inside = _mm_and_ps(_mm_and_ps(_mm_cmpge_ps(e0, zero), _mm_cmpge_ps(e1, zero)), _mm_cmpge_ps(e2, zero));
+            if (_mm_movemask_ps(inside))
+            {
+                __m128 const d = _mm_load_ps(row + x);
+                _mm_store_ps(row + x, _mm_blendv_ps(d, _mm_max_ps(d, z), inside));
+            }
+            e0 = _mm_add_ps(e0, step_x4[0]);
+            e1 = _mm_add_ps(e1, step_x4[1]);
+            e2 = _mm_add_ps(e2, step_x4[2]);
+        }
+        for (size_t i = 0; i < 3; i++)
+            row_e[i] = _mm_add_ps(row_e[i], step_y[i]);
+    }
+}
+
+bool OcclusionCuller::IsOccluded(const FastVector3D& center_src, float radius) const
+{
+    Vector4D const c = geom_->ViewMatrix() * Vector4D(center_src.x, center_src.y, center_src.z, 1.f);
+    float const z_near = c.z + radius;
+    if (z_near > -GraphicsEps)
+        return false; // Задевает плоскость камеры
+
+    // Экстремумы x/z и y/z на кубе вокруг сферы - в его углах (z везде одного знака)
+    float qx_min = std::numeric_limits<float>::max(), qx_max = -qx_min;
+    float qy_min = qx_min, qy_max = -qx_min;
+    for (float dz : { -radius, radius })
+     for (float d : { -radius, radius })
+     {
+         float const qx = (c.x + d) / (c.z + dz);
+         float const qy = (c.y + d) / (c.z + dz);
+         qx_min = std::min(qx_min, qx);
+         qx_max = std::max(qx_max, qx);
+         qy_min = std::min(qy_min, qy);
+         qy_max = std::max(qy_max, qy);
+     }
+
+    // Как RenderingGeometry::SetPixelPos, но сразу в пиксели буфера. Прямоугольник - с запасом в пиксель
+    float const k = 1.f / std::tan(geom_->GetFov());
+    float const half_w = width_ / 2.f;
+    float const half_h = height_ / 2.f;
+    float const w = static_cast<float>(width_);
+    float const h = static_cast<float>(height_);
+    auto to_pixel = [](float v, float limit) { return static_cast<long>(std::floor(std::min(std::max(v, -2.f), limit + 1.f) + 0.5f)); };
+    long const x0 = std::max(0L, to_pixel(half_w - 0.5f + half_w*k*qx_min, w) - 1);
+    long const x1 = std::min(static_cast<long>(width_) - 1, to_pixel(half_w - 0.5f + half_w*k*qx_max, w) + 1);
+    long const y0 = std::max(0L, to_pixel(half_h - 0.5f + half_h*k*geom_->GetRatio()*qy_min, h) - 1);
+    long const y1 = std::min(static_cast<long>(height_) - 1, to_pixel(half_h - 0.5f + half_h*k*geom_->GetRatio()*qy_max, h) + 1);
+    if (x0 > x1 || y0 > y1)
+        return false; // За экраном - не наше дело
+
+    for (long y = y0; y <= y1; y++)
+    {
+        const float* row = depth_.data() + static_cast<size_t>(y)*stride_;
+        for (long x = x0; x <= x1; x++)
+            if (!(row[x] > z_near))
+                return false;
+    }
+    return true;
+}
+
+} // namespace plane_render
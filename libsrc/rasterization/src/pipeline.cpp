@@ -1,19 +1,88 @@
 #include "pipeline.hpp"
 
 #include "fragment_shader.hpp"
+#include "common/profiler.hpp"
+#include "common/perf_counters.hpp"
 
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+#include <numeric>
 
 namespace plane_render {
 
+constexpr float PipelineOptions::ResolutionScaleStep;
+
 RasterizationPipeline::RasterizationPipeline(const RenderingGeometryPtr& geom,
-                                             std::vector<SceneObject>&& objects, const std::string& perf_filename) :
+                                             std::vector<SceneObject>&& objects, const std::string& perf_filename,
+                                             const PipelineOptions& options) :
     geom_(geom),
     objects_(std::move(objects)),
-    pool_(ThreadsCount),
-    rasterizer_(geom_),
-    perf_output_(perf_filename, std::ios_base::out)
-{}
+    pool_(options.threads, options.pin_threads),
+    rasterizer_(geom_, options.layout, options.clear_mode),
+    trace_filename_(options.trace_filename),
+    frame_cache_(options.frame_cache),
+    dirty_rects_(options.dirty_rects),
+    dirty_rects_max_share_(options.dirty_rects_max_share),
+    depth_prepass_(options.depth_prepass),
+    front_to_back_(options.front_to_back),
+    meshlet_culling_(options.meshlet_culling),
+    objects_rects_(objects_.size()),
+    refresh_period_(std::max<size_t>(options.reprojection_refresh_period, 1)),
+    reprojection_max_dirty_share_(options.reprojection_max_dirty_share),
+    output_width_(geom_->Width()),
+    output_height_(geom_->Height()),
+    dynamic_resolution_(options.dynamic_resolution),
+    target_frame_ms_(options.target_frame_ms),
+    min_scale_(std::min(std::max(options.min_resolution_scale, PipelineOptions::ResolutionScaleStep), 1.f)),
+    max_occluders_(options.max_occluders),
+    culled_(objects_.size(), 0)
+{
+    if (dynamic_resolution_)
+        upscaler_.reset(new Upscaler(output_width_, output_height_));
+    if (options.shadow_map)
+    {
+        shadow_map_.reset(new ShadowMap(options.shadow_map_size));
+        for (auto& obj : objects_)
+            obj.GetFS()->SetShadowMap(shadow_map_.get());
+    }
+    if (options.occlusion_culling)
+        occlusion_culler_.reset(new OcclusionCuller(geom_, options.occlusion_width, options.occlusion_height));
+    if (options.sort_last)
+        for (size_t th = 0; th < pool_.ThreadsCount(); th++)
+            thread_rasterizers_.emplace_back(new Rasterizer(geom_, ScreenBuffer::Layout::Tiled, ScreenBuffer::ClearMode::Lazy,
+                                                            ScreenBuffer::Sharing::Private));
+    if (options.sort_last && depth_prepass_)
+    {
+        LOG(WARNING) << "Depth prepass in sort-last mode sees only each thread's own triangles: disabled";
+        depth_prepass_ = false;
+    }
+    if (options.reprojection && ActiveIsa() < Isa::Avx2)
+        LOG(WARNING) << "Reprojection needs AVX2, CPU dispatch level is " << IsaName(ActiveIsa()) << ": disabled";
+    else if (options.reprojection && 1.f / refresh_period_ >= reprojection_max_dirty_share_)
+        LOG(WARNING) << "Reprojection refresh period " << refresh_period_ << " redraws more than max dirty share "
+                     << reprojection_max_dirty_share_ << " of tiles every frame: disabled";
+    else if (options.reprojection)
+        reprojector_.reset(new Reprojector(geom_, ScreenBuffer::TileSide, rasterizer_.TilesX(), rasterizer_.TilesCount()));
+    if (options.ray_traced_shadows)
+    {
+        shadow_pass_ = new ShadowPass(geom_, options.shadow_factor);
+        AddPass(std::unique_ptr<FullScreenPass>(shadow_pass_));
+    }
+    if (!perf_filename.empty())
+        perf_output_.open(perf_filename, std::ios_base::out);
+    Profiler::SetThreadName("main");
+    if (!trace_filename_.empty())
+        Profiler::Instance().SetEnabled(true);
+}
+
+RasterizationPipeline::~RasterizationPipeline()
+{
+    pool_.Join();
+    if (!trace_filename_.empty() && !Profiler::Instance().WriteChromeTrace(trace_filename_))
+        LOG(ERROR) << "Can't write trace to " << trace_filename_;
+}
 
 void RasterizationPipeline::MoveCam(float dx, float dy, float dz)
 {
@@ -27,28 +96,439 @@ void RasterizationPipeline::MoveAt(float dx, float dy, float dz)
     Update();
 }
 
+bool RasterizationPipeline::ObjectsUpToDate() const
+{
+    if (!frame_valid_)
+        return false;
+    for (size_t i = 0; i < objects_.size(); i++)
+        if (objects_[i].Version() != frame_objects_versions_[i])
+            return false;
+    return true;
+}
+
+bool RasterizationPipeline::FrameUpToDate() const
+{
+    return frame_valid_ && geom_->Version() == frame_geom_version_ && ObjectsUpToDate();
+}
+
+void RasterizationPipeline::RememberFrameVersions()
+{
+    frame_geom_version_ = geom_->Version();
+    frame_objects_versions_.resize(objects_.size());
+    for (size_t i = 0; i < objects_.size(); i++)
+        frame_objects_versions_[i] = objects_[i].Version();
+    frame_view_ = geom_->ViewMatrix();
+    frame_light_src_ = geom_->LightPosSrc();
+    frame_valid_ = true;
+}
+
 void RasterizationPipeline::Update()
 {
-    rasterizer_.Clear();
+    if (frame_cache_ && FrameUpToDate())
+    {
+        last_stats_ = FrameStats();
+        last_stats_.cached = true;
+        last_stats_.reused = 1.;
+        return;
+    }
+
+    PROFILE_SCOPE("frame");
+    last_stats_ = FrameStats();
+    if (dynamic_resolution_)
+        ApplyResolutionScale();
+    if (shadow_map_)
+    {
+        auto const t0 = std::chrono::steady_clock::now();
+        if (shadow_map_->Update(objects_, geom_->LightPosSrc(), pool_))
+        {
+            frame_valid_ = false;
+            last_stats_.shadow_map = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        }
+        shadow_map_->SetCameraView(geom_->ViewMatrix());
+    }
+    if (!(dirty_rects_ && RenderDirtyRegion()) && !(reprojector_ && RenderReprojected()))
+        RenderFull();
+    if (!passes_.empty())
+    {
+        PROFILE_SCOPE("passes");
+        auto const t0 = std::chrono::steady_clock::now();
+        if (shadow_pass_)
+            shadow_pass_->UpdateObjects(objects_, pool_);
+        for (auto& pass : passes_)
+            RunPass(*pass);
+        last_stats_.passes = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+        if (shadow_pass_)
+            last_stats_.shadow_rays = shadow_pass_->LastFrameRays();
+    }
+    if (Upscaled())
+    {
+        PROFILE_SCOPE("upscale");
+        auto const t0 = std::chrono::steady_clock::now();
+        const Color* frame = rasterizer_.GetPixels();
+        RunParts([this, frame](size_t part, size_t parts) { upscaler_->UpscalePart(frame, part, parts); });
+        last_stats_.upscale = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+    }
+    last_stats_.total = last_stats_.clear + last_stats_.vs + last_stats_.fs + last_stats_.reproject + last_stats_.upscale +
+                        last_stats_.passes + last_stats_.shadow_map;
+    last_stats_.scale = static_cast<float>(geom_->Width()) / output_width_;
+    RememberFrameVersions();
+    if (dynamic_resolution_)
+        ChooseResolutionScale();
+#ifdef LOCK_STATS_ENABLED
+    last_stats_.row_locks = rasterizer_.TakeRowLockStats(last_stats_.hottest_row, last_stats_.hottest_row_locks);
+    last_stats_.task_locks = pool_.TakeTasksLockStats();
+#endif
+
+    if (!perf_output_.is_open())
+        return;
+    perf_output_ << last_stats_.total << "\t" << last_stats_.clear << "\t" << last_stats_.vs << "\t" << last_stats_.fs
+                 << "\t" << last_stats_.triangles << "\t" << last_stats_.reused << "\t" << last_stats_.scale
+                 << "\t" << last_stats_.occluded;
+    for (const auto& obj : objects_)
+        perf_output_ << "\t" << obj.CurrentLod();
+#ifdef LOCK_STATS_ENABLED
+    auto print_locks = [this](const LockStats& s)
+    {
+        perf_output_ << "\t" << s.acquires << "\t" << s.failed_cas << "\t" << s.yields << "\t" << s.wait_ns / 1e6;
+    };
+    print_locks(last_stats_.row_locks);
+    perf_output_ << "\t" << last_stats_.hottest_row;
+    print_locks(last_stats_.hottest_row_locks);
+    print_locks(last_stats_.task_locks);
+#endif
+    perf_output_ << "\n"; // Без flush на каждом кадре
+}
+
+void RasterizationPipeline::RenderFull()
+{
+    using Clock = std::chrono::steady_clock;
+    size_t const threads_count = pool_.ThreadsCount();
+
+    auto const tc = Clock::now();
+    {
+        PROFILE_SCOPE("clear");
+        if (rasterizer_.GetClearMode() == ScreenBuffer::ClearMode::Lazy)
+            rasterizer_.Clear(); // Только смена кадра, сами плитки очистятся при растеризации
+        else
+        {
+            for (size_t th = 0; th < threads_count; th++)
+                pool_.AddTask([this, th, threads_count]()
+                              {
+                                  PROFILE_SCOPE("clear part");
+                                  PERF_COUNTERS_SCOPE("clear part");
+                                  rasterizer_.ClearPart(th, threads_count);
+                              }, false);
+            pool_.Join();
+        }
+    }
+
+    auto const t0 = Clock::now();
+    ShadeObjects();
+
+    auto const tv = Clock::now();
+    RasterizeObjects([this](size_t i) { return !culled_[i]; });
+
+    auto const t1 = Clock::now();
+    last_stats_.clear = std::chrono::duration<double, std::milli>(t0 - tc).count();
+    last_stats_.vs = std::chrono::duration<double, std::milli>(tv - t0).count();
+    last_stats_.fs = std::chrono::duration<double, std::milli>(t1 - tv).count();
+}
+
+bool RasterizationPipeline::RenderDirtyRegion()
+{
+    // Вершины неизменившихся объектов с прошлого кадра годятся, только если не двигались камера и свет
+    if (!frame_valid_ || geom_->Version() != frame_geom_version_)
+        return false;
+    // У скрытых в прошлом кадре объектов вершин нет, а изменившийся заслонитель мог их открыть
+    if (std::find(culled_.begin(), culled_.end(), 1) != culled_.end())
+        return false;
+
+    using Clock = std::chrono::steady_clock;
+    auto const t0 = Clock::now();
+    ScreenRect dirty;
+    for (size_t i = 0; i < objects_.size(); i++)
+    {
+        if (objects_[i].Version() == frame_objects_versions_[i])
+            continue;
+        dirty.Extend(objects_rects_[i]); // Где объект был
+        ShadeObject(i);
+        dirty.Extend(objects_rects_[i]); // Где он теперь
+    }
+
+    size_t const screen_area = static_cast<size_t>(geom_->Width()) * geom_->Height();
+    if (dirty.Area() > dirty_rects_max_share_ * screen_area)
+        return false; // Вершинный шейдер для изменившихся объектов повторится - не страшно
+
+    auto const tv = Clock::now();
+    {
+        PROFILE_SCOPE("clear", dirty.Area());
+        rasterizer_.ClearRect(dirty);
+    }
+
+    auto const tc = Clock::now();
+    rasterizer_.SetScissor(dirty);
+    RasterizeObjects([this, &dirty](size_t i) { return objects_rects_[i].Intersects(dirty); });
+    rasterizer_.ResetScissor();
+
+    auto const t1 = Clock::now();
+    last_stats_.vs = std::chrono::duration<double, std::milli>(tv - t0).count();
+    last_stats_.clear = std::chrono::duration<double, std::milli>(tc - tv).count();
+    last_stats_.fs = std::chrono::duration<double, std::milli>(t1 - tc).count();
+    last_stats_.reused = 1. - static_cast<double>(dirty.Area()) / screen_area;
+    return true;
+}
+
+bool RasterizationPipeline::RenderReprojected()
+{
+    // Двигаться могла только камера: объекты и свет - как в прошлом кадре
+    if (!ObjectsUpToDate() || memcmp(&frame_light_src_, &geom_->LightPosSrc(), sizeof(FastVector3D)) != 0)
+        return false;
+
+    using Clock = std::chrono::steady_clock;
+    auto const t0 = Clock::now();
+    std::vector<size_t> reused(pool_.ThreadsCount());
+    {
+        PROFILE_SCOPE("reproject");
+        const Color* prev_colors = rasterizer_.GetPixels();
+        const float* prev_z = rasterizer_.GetDepth();
+        reprojector_->Begin(frame_view_, rasterizer_.TilesX(), rasterizer_.TilesCount());
+        RunParts([this](size_t part, size_t parts) { reprojector_->ClearPart(part, parts); });
+        RunParts([this, prev_colors, prev_z](size_t part, size_t parts)
+                 {
+                     PROFILE_SCOPE("splat");
+                     reprojector_->SplatPart(prev_colors, prev_z, part, parts);
+                 });
+        RunParts([this, &reused](size_t part, size_t parts)
+                 {
+                     reused[part] = reprojector_->ResolvePart(refresh_phase_, refresh_period_, part, parts);
+                 });
+    }
+
+    const std::vector<uint8_t>& dirty = reprojector_->DirtyTiles();
+    size_t const dirty_count = dirty.size() - std::count(dirty.begin(), dirty.end(), 0);
+    if (dirty_count > reprojection_max_dirty_share_ * dirty.size())
+        return false; // Буфер кадра еще не тронут
+    refresh_phase_ = (refresh_phase_ + 1) % refresh_period_;
+
+    auto const tr = Clock::now();
+    ShadeObjects();
+
+    auto const tv = Clock::now();
+    {
+        PROFILE_SCOPE("clear");
+        if (rasterizer_.GetClearMode() == ScreenBuffer::ClearMode::Lazy)
+            rasterizer_.Clear(); // Смена кадра: LoadPart пометит все плитки готовыми
+        RunParts([this, &dirty](size_t part, size_t parts)
+                 {
+                     rasterizer_.LoadPart(reprojector_->Colors(), reprojector_->Depth(), dirty, part, parts);
+                 });
+    }
+
+    auto const tc = Clock::now();
+    rasterizer_.SetTileMask(dirty.data());
+    RasterizeObjects([this](size_t i) { return !culled_[i]; });
+    rasterizer_.SetTileMask(nullptr);
+
+    auto const t1 = Clock::now();
+    last_stats_.reproject = std::chrono::duration<double, std::milli>(tr - t0).count();
+    last_stats_.vs = std::chrono::duration<double, std::milli>(tv - tr).count();
+    last_stats_.clear = std::chrono::duration<double, std::milli>(tc - tv).count();
+    last_stats_.fs = std::chrono::duration<double, std::milli>(t1 - tc).count();
+    last_stats_.reused = static_cast<double>(std::accumulate(reused.begin(), reused.end(), size_t(0))) /
+                         (static_cast<size_t>(geom_->Width()) * geom_->Height());
+    return true;
+}
+
+void RasterizationPipeline::ApplyResolutionScale()
+{
+    ScreenDimension const w = std::max<ScreenDimension>(2, static_cast<ScreenDimension>(std::lround(output_width_ * scale_)));
+    ScreenDimension const h = std::max<ScreenDimension>(2, static_cast<ScreenDimension>(std::lround(output_height_ * scale_)));
+    if (w == geom_->Width() && h == geom_->Height())
+        return;
+
+    geom_->SetRenderSize(w, h);
+    rasterizer_.Resize();
+    for (auto& rasterizer : thread_rasterizers_)
+        rasterizer->Resize();
+    upscaler_->SetSourceSize(w, h);
+    frame_valid_ = false; // Прошлый кадр другого размера: ни перерисовки части, ни репроекции
+}
+
+void RasterizationPipeline::ChooseResolutionScale()
+{
+    // Вершины и растяжение от разрешения кадра не зависят, остальное - пропорционально числу пикселей (scale^2)
+    double const pixels_ms = last_stats_.clear + last_stats_.fs + last_stats_.reproject + last_stats_.passes;
+    double const budget_ms = target_frame_ms_ - last_stats_.vs - last_stats_.upscale;
+    if (pixels_ms <= 0)
+        return;
+
+    float const step = PipelineOptions::ResolutionScaleStep;
+    float wanted = std::floor(static_cast<float>(scale_ * std::sqrt(std::max(budget_ms, 0.) / pixels_ms)) / step) * step;
+    if (wanted > scale_)
+    {
+        // Вверх - с запасом и по одному шагу, чтобы не качаться. Смена размера - это кадр целиком:
+        // время кадра, собранного из прошлого (перерисовка части, репроекция), пересчитываем на весь экран
+        double const full_ms = pixels_ms / std::max(1. - last_stats_.reused, 0.1);
+        if (0.85 * budget_ms < full_ms * (scale_ + step) * (scale_ + step) / (scale_ * scale_))
+            return;
+        wanted = scale_ + step;
+    }
+    scale_ = std::min(std::max(wanted, min_scale_), 1.f);
+}
+
+void RasterizationPipeline::RunParts(const std::function<void(size_t, size_t)>& f)
+{
+    size_t const parts = pool_.ThreadsCount();
+    for (size_t part = 0; part < parts; part++)
+        pool_.AddTask([&f, part, parts]() { f(part, parts); }, false);
+    pool_.Join();
+}
 
-    auto const t0 = std::chrono::system_clock::now();
-    for (auto& obj : objects_)
+void RasterizationPipeline::ShadeObject(size_t index, bool cull_meshlets)
+{
+    SceneObject& obj = objects_[index];
     {
+        PROFILE_SCOPE("lod select");
+        obj.SelectLod(geom_->ProjectedRadius(obj.BoundingCenter(), obj.BoundingRadius()));
+    }
+    if (meshlet_culling_ && cull_meshlets)
+    {
+        PROFILE_SCOPE("meshlet culling", obj.Meshlets().size());
+        last_stats_.culled_meshlets += obj.CullMeshlets();
+    }
+    {
+        PROFILE_SCOPE("vertex shading", obj.Vertices().size());
+        PERF_COUNTERS_SCOPE("vertex shading");
         obj.Update();
     }
+    if (dirty_rects_)
+        objects_rects_[index] = obj.ScreenBounds();
+}
+
+void RasterizationPipeline::ShadeObjects()
+{
+    std::fill(culled_.begin(), culled_.end(), 0);
+    if (!occlusion_culler_)
+    {
+        for (size_t i = 0; i < objects_.size(); i++)
+            ShadeObject(i);
+        return;
+    }
+
+    // Заслонители - самые крупные на экране. Охватывающие камеру (небо) ничего не заслоняют - изнутри видны задние грани
+    std::vector<std::pair<float, size_t>> occluders;
+    float const min_radius = OcclusionCuller::MinOccluderShare * geom_->Width();
+    for (size_t i = 0; i < objects_.size(); i++)
+    {
+        const SceneObject& obj = objects_[i];
+        float const r = obj.BoundingRadius();
+        if (FastVector3D(obj.BoundingCenter() - geom_->CameraPosSrc()).NormSq() <= r*r)
+            continue;
+        float const projected = geom_->ProjectedRadius(obj.BoundingCenter(), r);
+        if (projected >= min_radius)
+            occluders.push_back({ -projected, i });
+    }
+    std::sort(occluders.begin(), occluders.end());
+    if (occluders.size() > max_occluders_)
+        occluders.resize(max_occluders_);
+
+    std::vector<uint8_t> is_occluder(objects_.size(), 0);
+    {
+        PROFILE_SCOPE("occluders");
+        occlusion_culler_->Clear();
+        for (const auto& occluder : occluders)
+        {
+            ShadeObject(occluder.second, false); // Заслонителю нужны все вершины нулевого уровня
+            occlusion_culler_->AddOccluder(objects_[occluder.second]);
+            is_occluder[occluder.second] = 1;
+        }
+    }
+    for (size_t i = 0; i < objects_.size(); i++)
+    {
+        if (is_occluder[i])
+            continue;
+        if (occlusion_culler_->IsOccluded(objects_[i].BoundingCenter(), objects_[i].BoundingRadius()))
+        {
+            culled_[i] = 1;
+            last_stats_.occluded++;
+        }
+        else
+            ShadeObject(i);
+    }
+}
+
+void RasterizationPipeline::RasterizeObjects(const std::function<bool(size_t)>& draw)
+{
+    std::vector<size_t> order;
+    for (size_t i = 0; i < objects_.size(); i++)
+        if (draw(i))
+        {
+            order.push_back(i);
+            last_stats_.triangles += objects_[i].VisibleTrianglesCount();
+        }
+    if (front_to_back_)
+    {
+        std::vector<float> distance(objects_.size());
+        for (size_t i : order)
+            distance[i] = geom_->SurfaceDistance(objects_[i].BoundingCenter(), objects_[i].BoundingRadius());
+        std::stable_sort(order.begin(), order.end(), [&distance](size_t a, size_t b) { return distance[a] < distance[b]; });
+    }
+    if (!thread_rasterizers_.empty())
+    {
+        RasterizeSortLast(order);
+        return;
+    }
 
-    auto tv = std::chrono::system_clock::now();
-    std::chrono::duration<double, std::milli> const vs = tv - t0;
+    if (depth_prepass_)
+    {
+        // Сначала только глубина всех объектов, затем шейдер - лишь для ближайшего фрагмента пикселя
+        PROFILE_SCOPE("depth prepass");
+        rasterizer_.SetPass(Rasterizer::Pass::DepthOnly);
+        for (size_t i : order)
+            RasterizeObject(objects_[i]);
+        last_stats_.depth_fragments = rasterizer_.TakeFragments();
+        rasterizer_.SetPass(Rasterizer::Pass::ShadeEqual);
+    }
 
-    for (auto& obj : objects_)
+    for (size_t i : order)
+        RasterizeObject(objects_[i]);
+    last_stats_.shaded_fragments = rasterizer_.TakeFragments();
+    rasterizer_.SetPass(Rasterizer::Pass::Shade);
+}
+
+void RasterizationPipeline::RasterizeObject(const SceneObject& obj)
+{
+    size_t const threads_count = pool_.ThreadsCount();
+    if (front_to_back_ || meshlet_culling_)
     {
+        // Задания - по отрезкам видимых мешлетов (пул берет их в порядке добавления), не больше TrianglesPerTask
+        PROFILE_SCOPE("binning");
+        PERF_COUNTERS_SCOPE("binning");
+        size_t const per_task = std::max<size_t>(obj.TrianglesPerTask(), 1);
+        for (const auto& range : MeshletRanges(obj))
+            for (size_t start = range.first; start < range.first + range.second; start += per_task)
+            {
+                size_t const count = std::min(per_task, range.first + range.second - start);
+                pool_.AddTask([this, &obj, start, count]()
+                              {
+                                  PROFILE_SCOPE("raster+shading", count);
+                                  PERF_COUNTERS_SCOPE("raster+shading");
+                                  rasterizer_.Rasterize(obj, obj.MeshletIndices(), start*3, count);
+                              }, false);
+            }
+    }
+    else
+    {
+        // Раздача треугольников по заданиям
+        PROFILE_SCOPE("binning");
+        PERF_COUNTERS_SCOPE("binning");
         size_t ind_count = obj.Indices().size();
         DCHECK(ind_count % 3 == 0);
         size_t triang_count = ind_count / 3;
-        size_t triangles_per_thread = triang_count / ThreadsCount + 1; // +1, чтобы точно все нарисовались
+        size_t triangles_per_thread = triang_count / threads_count + 1; // +1, чтобы точно все нарисовались
 
         for (size_t st = 0; st < triangles_per_thread; st += obj.TrianglesPerTask())
-         for (size_t th = 0; th < ThreadsCount; th++)
+         for (size_t th = 0; th < threads_count; th++)
          {
              size_t start = th*triangles_per_thread + st; // Номер первого треугольника
              size_t count = obj.TrianglesPerTask(); // Сколько треугольников
@@ -57,16 +537,150 @@ void RasterizationPipeline::Update()
 
              pool_.AddTask([this, &obj, start, count]()
                            {
+                                // Отсечение, растеризация и фрагментный шейдер - вместе, попиксельно
+                                PROFILE_SCOPE("raster+shading", count);
+                                PERF_COUNTERS_SCOPE("raster+shading"); // По заданию
                                 rasterizer_.Rasterize(obj, start*3, count);
                            }, false);
          }
+    }
+
+    PROFILE_SCOPE("join");
+    pool_.Join();
+}
+
+void RasterizationPipeline::RasterizeSortLast(const std::vector<size_t>& order)
+{
+    // Задание потока - непрерывная часть треугольников всех объектов в порядке растеризации: соседние
+    // треугольники (мешлеты) попадают в один буфер и задевают меньше плиток при сведении
+    struct Piece
+    {
+        size_t object;
+        size_t start; // Первый треугольник (в SceneObject::MeshletIndices, если задания по мешлетам)
+        size_t count;
+    };
+    bool const by_meshlets = front_to_back_ || meshlet_culling_;
+    size_t const threads_count = thread_rasterizers_.size();
+    std::vector<std::vector<Piece>> parts(threads_count);
+    {
+        PROFILE_SCOPE("binning");
+        std::vector<Piece> pieces;
+        size_t total = 0;
+        for (size_t i : order)
+        {
+            const SceneObject& obj = objects_[i];
+            if (by_meshlets)
+            {
+                for (const auto& range : MeshletRanges(obj))
+                    pieces.push_back({ i, range.first, range.second });
+            }
+            else
+                pieces.push_back({ i, 0, obj.TrianglesCount() });
+        }
+        for (const Piece& piece : pieces)
+            total += piece.count;
 
+        size_t th = 0;
+        size_t done = 0;
+        for (Piece piece : pieces)
+            while (piece.count > 0)
+            {
+                size_t const part_end = total*(th + 1)/threads_count;
+                size_t const count = std::min(piece.count, part_end - done);
+                if (count > 0)
+                    parts[th].push_back({ piece.object, piece.start, count });
+                piece.start += count;
+                piece.count -= count;
+                done += count;
+                if (done == part_end)
+                    th++;
+            }
+    }
+
+    std::vector<const Rasterizer*> sources;
+    for (auto& rasterizer : thread_rasterizers_)
+    {
+        rasterizer->Clear(); // Lazy: только смена кадра
+        rasterizer->SetScissor(rasterizer_.Scissor());
+        rasterizer->SetTileMask(rasterizer_.TileMask());
+        sources.push_back(rasterizer.get());
+    }
+    for (size_t th = 0; th < threads_count; th++)
+        pool_.AddTask([this, &parts, th, by_meshlets]()
+                      {
+                          for (const Piece& piece : parts[th])
+                          {
+                              PROFILE_SCOPE("raster+shading", piece.count);
+                              PERF_COUNTERS_SCOPE("raster+shading");
+                              const SceneObject& obj = objects_[piece.object];
+                              thread_rasterizers_[th]->Rasterize(obj, by_meshlets ? obj.MeshletIndices() : obj.Indices(),
+                                                                 piece.start*3, piece.count);
+                          }
+                      }, false);
+    {
+        PROFILE_SCOPE("join");
         pool_.Join();
     }
-    auto const t1 = std::chrono::system_clock::now();
-    std::chrono::duration<double, std::milli> const fs = t1 - tv;
-    perf_output_ << (vs+fs).count() << "\t" << vs.count() << "\t" << fs.count() << std::endl;
-    LOG(INFO) << (vs+fs).count() << "\t" << vs.count() << "\t" << fs.count() << std::endl;
+    for (auto& rasterizer : thread_rasterizers_)
+        last_stats_.shaded_fragments += rasterizer->TakeFragments();
+
+    PROFILE_SCOPE("composite");
+    auto const t0 = std::chrono::steady_clock::now();
+    RunParts([this, &sources](size_t part, size_t parts) { rasterizer_.CompositePart(sources, part, parts); });
+    last_stats_.composite = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count();
+}
+
+std::vector<std::pair<size_t, size_t>> RasterizationPipeline::MeshletRanges(const SceneObject& obj) const
+{
+    const SceneObject::MeshletsList& meshlets = obj.Meshlets();
+    const IndicesList& visible = obj.VisibleMeshlets();
+    std::vector<std::pair<float, size_t>> order(visible.size());
+    for (size_t i = 0; i < visible.size(); i++)
+    {
+        const SceneObject::Meshlet& meshlet = meshlets[visible[i]];
+        float const distance = front_to_back_ ? geom_->SurfaceDistance(meshlet.center + obj.Position(), meshlet.radius) : 0.f;
+        order[i] = { distance, visible[i] };
+    }
+    if (front_to_back_)
+        std::sort(order.begin(), order.end());
+
+    std::vector<std::pair<size_t, size_t>> ranges;
+    for (const auto& item : order)
+    {
+        const SceneObject::Meshlet& meshlet = meshlets[item.second];
+        if (!ranges.empty() && ranges.back().first + ranges.back().second == meshlet.first)
+            ranges.back().second += meshlet.count;
+        else
+            ranges.push_back({ meshlet.first, meshlet.count });
+    }
+    return ranges;
+}
+
+void RasterizationPipeline::AddPass(std::unique_ptr<FullScreenPass>&& pass)
+{
+    if (dirty_rects_ || reprojector_)
+        LOG(WARNING) << "Full screen passes can't reuse previous frame colors: dirty rects and reprojection disabled";
+    dirty_rects_ = false;
+    reprojector_.reset();
+    passes_.push_back(std::move(pass));
+    frame_valid_ = false;
+}
+
+void RasterizationPipeline::RunPass(FullScreenPass& pass)
+{
+    pass.BeginFrame();
+
+    // Задание - ряд плиток: плиток много меньше, чем пикселей, а ряды по стоимости выравниваются пулом
+    size_t const tiles_x = rasterizer_.TilesX();
+    size_t const tiles_count = rasterizer_.TilesCount();
+    for (size_t first = 0; first < tiles_count; first += tiles_x)
+        pool_.AddTask([this, &pass, first, tiles_x]()
+                      {
+                          PROFILE_SCOPE("pass tiles", tiles_x);
+                          for (size_t tile = first; tile < first + tiles_x; tile++)
+                              pass.ProcessTile(rasterizer_.GetTile(tile));
+                      }, false);
+    pool_.Join();
 }
 
 } // namespace plane_render
@@ -10,21 +10,25 @@
 
 namespace plane_render {
 
-Rasterizer::Rasterizer(const RenderingGeometryConstPtr& geom) :
+Rasterizer::Rasterizer(const RenderingGeometryConstPtr& geom, ScreenBuffer::Layout layout,
+                       ScreenBuffer::ClearMode clear_mode, ScreenBuffer::Sharing sharing) :
     geom_(geom),
-    screen_buffer_(geom_->Width(), geom_->Height())
+    screen_buffer_(geom_->Width(), geom_->Height(), layout, clear_mode, sharing),
+    isa_(ActiveIsa()),
+    fragments_(0)
 {
     DCHECK(geom_);
+    ResetScissor();
     Clear();
 }
 
-void Rasterizer::Rasterize(const SceneObject& obj, size_t start, size_t count)
+void Rasterizer::Rasterize(const SceneObject& obj, const IndicesList& indices, size_t start, size_t count)
 {
     const VerticesVector& vertices = obj.Vertices();
-    const IndicesList& indices = obj.Indices();
 
     DCHECK(indices.size() % 3 == 0); // Треугольник - 3 точки
     DCHECK(start % 3 == 0);
+    size_t fragments = 0;
     for (size_t s = start; s < start+count*3 && s < indices.size(); s += 3)
     {
         const auto& A = vertices[indices[s]];
@@ -32,49 +36,113 @@ void Rasterizer::Rasterize(const SceneObject& obj, size_t start, size_t count)
         const auto& C = vertices[indices[s+2]];
         if (A.vertex_coords.z > -GraphicsEps || B.vertex_coords.z > -GraphicsEps || C.vertex_coords.z > -GraphicsEps)
             continue;
-        RasterizeTriangle(obj, A, B, C);
+        fragments += RasterizeTriangle(obj, A, B, C);
     }
+    fragments_.fetch_add(fragments, std::memory_order_relaxed); // Один раз на задание, а не на треугольник
 }
 
-void Rasterizer::RasterizeTriangle(const SceneObject& obj, const Vertex& A, const Vertex& B, const Vertex& C)
+void Rasterizer::CompositePart(const std::vector<const Rasterizer*>& sources, size_t part, size_t parts)
+{
+    std::vector<const ScreenBuffer*> buffers;
+    buffers.reserve(sources.size());
+    for (const Rasterizer* src : sources)
+        buffers.push_back(&src->screen_buffer_);
+    screen_buffer_.CompositePart(buffers, part, parts);
+}
+
+inline bool Rasterizer::ProcessPixel(const FragmentShader& fs, const TriangleSetup& setup, const BaricentricCoords& bc,
+                                     ScreenBuffer::Accessor& lines_acc, ScreenDimension x_dim) const
+{
+    switch (pass_)
+    {
+    case Pass::DepthOnly:
+    {
+        float const z = bc.AverageZ(*setup.v[0], *setup.v[1], *setup.v[2]);
+        if (z >= lines_acc.Z(x_dim))
+            lines_acc.Z(x_dim) = z;
+        return true;
+    }
+    case Pass::ShadeEqual:
+    {
+        // Видимый фрагмент дает ровно ту же z, что в DepthOnly: те же БЦ и AverageZ
+        if (bc.AverageZ(*setup.v[0], *setup.v[1], *setup.v[2]) != lines_acc.Z(x_dim))
+            return false;
+        lines_acc.Pixel(x_dim) = fs.ProcessFragment(bc.AverageVertices(*setup.v[0], *setup.v[1], *setup.v[2]));
+        return true;
+    }
+    case Pass::Shade:
+        break;
+    }
+
+    Vertex avg_vertex = bc.AverageVertices(*setup.v[0], *setup.v[1], *setup.v[2]);
+    if (avg_vertex.vertex_coords.z < lines_acc.Z(x_dim))
+        return false;
+    else
+        lines_acc.Z(x_dim) = avg_vertex.vertex_coords.z;
+
+    // Отправляем точку во фрагментный шейдер
+    lines_acc.Pixel(x_dim) = fs.ProcessFragment(avg_vertex);
+    return true;
+}
+
+bool Rasterizer::AnyMaskedTile(const PixelPoint& mins, const PixelPoint& maxs) const
+{
+    if (!tile_mask_)
+        return true;
+    size_t const tiles_x = screen_buffer_.TilesX();
+    for (size_t ty = mins.y / ScreenBuffer::TileSide; ty <= maxs.y / ScreenBuffer::TileSide; ty++)
+     for (size_t tx = mins.x / ScreenBuffer::TileSide; tx <= maxs.x / ScreenBuffer::TileSide; tx++)
+         if (tile_mask_[ty*tiles_x + tx])
+             return true;
+    return false;
+}
+
+size_t Rasterizer::RasterizeTriangle(const SceneObject& obj, const Vertex& A, const Vertex& B, const Vertex& C)
 {
     const FragmentShader& fs = *obj.GetFS();
 
-    // alias для координат в px
-    const auto& p1_px = A.pixel_pos;
-    const auto& p2_px = B.pixel_pos;
-    const auto& p3_px = C.pixel_pos;
-
-    // Определяем координаты описывающего прямоугольника
-    // px - без Clump, во float. Здесь переводим во вменяемый вид
-    PixelPoint mins = { (ScreenDimension) std::max(std::min({p1_px.x, p2_px.x, p3_px.x}), 0.f), 
-                        (ScreenDimension) std::max(std::min({p1_px.y, p2_px.y, p3_px.y}), 0.f) };
-    PixelPoint maxs = { (ScreenDimension) std::min(std::max({p1_px.x, p2_px.x, p3_px.x}), geom_->Width()-1.f),
-                        (ScreenDimension) std::min(std::max({p1_px.y, p2_px.y, p3_px.y}), geom_->Height()-1.f) };
-
-    // Проверяем, валиден ли треугольник - простая проверка
-    BaricentricCoords::BCPrecalculated bpc(A, B, C);
-    if (!bpc.IsValid()) // Вырожденные треугольники
-        return;
-
-    // TODO: переход к следующей строке, если не удалось заблокировать данную
-    // Управление растеризацией
-    // ScreenDimension rast_low = mins.y; // Растеризация - нижний край
-    // ScreenDimension rast_high = -1; // Растеризация - верхний край (первая из пропущенных строк)
-    // ScreenDimension notrast_low = -1; // Последний пропущенный ряд
-
-    // ScreenDimension memx_low = -1; // Запоминаем x, где попросили lock на нижнем крае
-    // ScreenDimension memx_high = -1; // То же, на первой пропущенной строке
-    
+    // Вырожденные треугольники и вышедшие за guard band отбрасываем
+    TriangleSetup setup(A, B, C);
+    if (!setup.IsValid())
+        return 0;
+
+    // Маленькие треугольники - без построчной растеризации
+    if (small_triangles_path_ && isa_ >= Isa::Avx2 && setup.IsSmall(SmallTriangleSide))
+    {
+        if (isa_ >= Isa::Avx512)
+            return RasterizeSmallTriangleAvx512(fs, setup);
+        else
+            return RasterizeSmallTriangleAvx2(fs, setup);
+    }
+
+    // Пиксели-кандидаты с обрезкой по экрану (scissor_ в него вписан)
+    PixelPoint mins = { std::max(setup.mins.x, scissor_.mins.x), std::max(setup.mins.y, scissor_.mins.y) };
+    PixelPoint maxs = { std::min(setup.maxs.x, scissor_.maxs.x), std::min(setup.maxs.y, scissor_.maxs.y) };
+    if (mins.x > maxs.x || mins.y > maxs.y || !AnyMaskedTile(mins, maxs))
+        return 0;
+
+    // Реберные функции (с bias) в начале ряда, дальше - только сложения
+    const auto& edges = setup.edges;
+    int64_t row_w[3];
+    for (size_t i = 0; i < 3; i++)
+        row_w[i] = edges[i].At(mins.x, mins.y) + edges[i].bias;
+
+    size_t fragments = 0;
     ScreenBuffer::Accessor lines_acc = screen_buffer_.GetAccessor();
-    for (ScreenDimension& y_dim = mins.y; y_dim <= maxs.y; y_dim++)
+    for (ScreenDimension y_dim = mins.y; y_dim <= maxs.y; y_dim++)
     {
+        int64_t w0 = row_w[0];
+        int64_t w1 = row_w[1];
+        int64_t w2 = row_w[2];
+        row_w[0] += edges[0].step_y;
+        row_w[1] += edges[1].step_y;
+        row_w[2] += edges[2].step_y;
+
         bool was_pixels = false;
-        for (ScreenDimension x_dim = mins.x; x_dim <= maxs.x; x_dim++)
+        for (ScreenDimension x_dim = mins.x; x_dim <= maxs.x;
+             x_dim++, w0 += edges[0].step_x, w1 += edges[1].step_x, w2 += edges[2].step_x)
         {
-            PixelPoint curr_point = { x_dim, y_dim };
-            BaricentricCoords bc(bpc, A, curr_point);
-            if (!bc.IsValid())
+            if ((w0 | w1 | w2) < 0) // Хотя бы одна реберная функция отрицательна
             {
                 if (!was_pixels)
                     continue;
@@ -83,23 +151,165 @@ void Rasterizer::RasterizeTriangle(const SceneObject& obj, const Vertex& A, cons
             }
 
             was_pixels = true;
+            if (!PixelMasked(x_dim, y_dim))
+                continue;
             if (lines_acc.LockedRow() == ScreenBuffer::Accessor::INVALID_ROW)
                 lines_acc.LockRow(y_dim);
-        
+
             // Проверяем, видна ли точка
             DCHECK((ScreenDimension) lines_acc.LockedRow() == y_dim);
-            Vertex avg_vertex = bc.AverageVertices(A, B, C);
-            if (avg_vertex.vertex_coords.z < lines_acc.Z(x_dim))
+            BaricentricCoords bc(_mm_set_ps(0.f, static_cast<float>(w2 - edges[2].bias),
+                                                 static_cast<float>(w1 - edges[1].bias),
+                                                 static_cast<float>(w0 - edges[0].bias)), setup.z_inv);
+            fragments += ProcessPixel(fs, setup, bc, lines_acc, x_dim);
+        }
+
+        lines_acc.ReleaseRow();
+    }
+    return fragments;
+}
+
+size_t Rasterizer::RasterizeSmallTriangleAvx2(const FragmentShader& fs, const TriangleSetup& setup)
+{
+    DCHECK(setup.IsSmall(SmallTriangleSide));
+
+    PixelPoint mins = { std::max(setup.mins.x, scissor_.mins.x), std::max(setup.mins.y, scissor_.mins.y) };
+    PixelPoint maxs = { std::min(setup.maxs.x, scissor_.maxs.x), std::min(setup.maxs.y, scissor_.maxs.y) };
+    if (mins.x > maxs.x || mins.y > maxs.y || !AnyMaskedTile(mins, maxs))
+        return 0;
+    DCHECK(maxs.x - mins.x < SmallTriangleSide && maxs.y - mins.y < SmallTriangleSide);
+
+    // Блок 4x2 пикселя: lane = 4*dy + dx
+    const __m256i lane_dx = _mm256_set_epi32(3, 2, 1, 0, 3, 2, 1, 0);
+    const __m256i lane_dy = _mm256_set_epi32(1, 1, 1, 1, 0, 0, 0, 0);
+
+    // Реберные функции в углу блока и их приращения малы - см. TriangleSetup::IsSmall
+    __m256i w_base[3];
+    __m256i bias[3];
+    for (size_t i = 0; i < 3; i++)
+    {
+        const auto& edge = setup.edges[i];
+        bias[i] = _mm256_set1_epi32(static_cast<int32_t>(edge.bias));
+        w_base[i] = _mm256_add_epi32(_mm256_set1_epi32(static_cast<int32_t>(edge.At(mins.x, mins.y) + edge.bias)),
+                                     _mm256_mullo_epi32(lane_dx, _mm256_set1_epi32(static_cast<int32_t>(edge.step_x))));
+    }
+
+    const int columns_mask = (1 << (maxs.x - mins.x + 1)) - 1;
+    const __m256 z_inv_0 = _mm256_set1_ps(setup.z_inv[0]);
+    const __m256 z_inv_1 = _mm256_set1_ps(setup.z_inv[1]);
+    const __m256 z_inv_2 = _mm256_set1_ps(setup.z_inv[2]);
+    const __m256 ones = _mm256_set1_ps(1.f);
+
+    size_t fragments = 0;
+    ScreenBuffer::Accessor lines_acc = screen_buffer_.GetAccessor();
+    for (ScreenDimension y0 = mins.y; y0 <= maxs.y; y0 += 2)
+    {
+        __m256i dy = _mm256_add_epi32(lane_dy, _mm256_set1_epi32(y0 - mins.y));
+        __m256i w[3];
+        for (size_t i = 0; i < 3; i++)
+            w[i] = _mm256_add_epi32(w_base[i], _mm256_mullo_epi32(dy, _mm256_set1_epi32(static_cast<int32_t>(setup.edges[i].step_y))));
+
+        // Покрытие: у всех трех реберных функций знаковый бит не выставлен + пиксель внутри прямоугольника
+        __m256i any_negative = _mm256_or_si256(_mm256_or_si256(w[0], w[1]), w[2]);
+        int mask = ~_mm256_movemask_ps(_mm256_castsi256_ps(any_negative)) & columns_mask;
+        if (y0 + 1 <= maxs.y)
+            mask |= (~_mm256_movemask_ps(_mm256_castsi256_ps(any_negative)) & (columns_mask << 4));
+        if (!mask)
+            continue;
+
+        // Переход к мировым БЦ сразу для всех пикселей блока (веса - без bias)
+        __m256 w_0 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(w[0], bias[0])), z_inv_0);
+        __m256 w_1 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(w[1], bias[1])), z_inv_1);
+        __m256 w_2 = _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_sub_epi32(w[2], bias[2])), z_inv_2);
+        __m256 inv_sum = _mm256_div_ps(ones, _mm256_add_ps(_mm256_add_ps(w_0, w_1), w_2));
+        alignas(32) float bc_0[8];
+        alignas(32) float bc_1[8];
+        alignas(32) float bc_2[8];
+        _mm256_store_ps(bc_0, _mm256_mul_ps(w_0, inv_sum));
+        _mm256_store_ps(bc_1, _mm256_mul_ps(w_1, inv_sum));
+        _mm256_store_ps(bc_2, _mm256_mul_ps(w_2, inv_sum));
+
+        while (mask)
+        {
+            int lane = __builtin_ctz(mask);
+            mask &= mask - 1;
+
+            ScreenDimension x_dim = mins.x + (lane & 3);
+            ScreenDimension y_dim = y0 + (lane >> 2);
+            if (!PixelMasked(x_dim, y_dim))
                 continue;
-            else
-                lines_acc.Z(x_dim) = avg_vertex.vertex_coords.z;
+            if (lines_acc.LockedRow() != static_cast<size_t>(y_dim))
+                lines_acc.LockRow(y_dim); // Предыдущий ряд отпускается внутри
 
-            // Отправляем точку во фрагментный шейдер
-            lines_acc.Pixel(x_dim) = fs.ProcessFragment(avg_vertex);
+            fragments += ProcessPixel(fs, setup, BaricentricCoords(bc_0[lane], bc_1[lane], bc_2[lane]), lines_acc, x_dim);
         }
+    }
+    return fragments;
+}
 
-        lines_acc.ReleaseRow();
+size_t Rasterizer::RasterizeSmallTriangleAvx512(const FragmentShader& fs, const TriangleSetup& setup)
+{
+    DCHECK(setup.IsSmall(SmallTriangleSide));
+    static_assert(SmallTriangleSide == 4, "Whole 4x4 rectangle is one 16-lane block");
+
+    PixelPoint mins = { std::max(setup.mins.x, scissor_.mins.x), std::max(setup.mins.y, scissor_.mins.y) };
+    PixelPoint maxs = { std::min(setup.maxs.x, scissor_.maxs.x), std::min(setup.maxs.y, scissor_.maxs.y) };
+    if (mins.x > maxs.x || mins.y > maxs.y || !AnyMaskedTile(mins, maxs))
+        return 0;
+    DCHECK(maxs.x - mins.x < SmallTriangleSide && maxs.y - mins.y < SmallTriangleSide);
+
+    // Блок 4x4 пикселя: lane = 4*dy + dx. Веса в int32 совпадают с путем AVX2 (сложение по модулю 2^32
+    // не зависит от порядка), float-операции те же - результат бит в бит тот же
+    const __m512i lane_dx = _mm512_set_epi32(3, 2, 1, 0, 3, 2, 1, 0, 3, 2, 1, 0, 3, 2, 1, 0);
+    const __m512i lane_dy = _mm512_set_epi32(3, 3, 3, 3, 2, 2, 2, 2, 1, 1, 1, 1, 0, 0, 0, 0);
+    __m512 w_f[3];
+    __m512i any_negative = _mm512_setzero_si512();
+    for (size_t i = 0; i < 3; i++)
+    {
+        const auto& edge = setup.edges[i];
+        __m512i bias = _mm512_set1_epi32(static_cast<int32_t>(edge.bias));
+        __m512i w = _mm512_add_epi32(_mm512_set1_epi32(static_cast<int32_t>(edge.At(mins.x, mins.y) + edge.bias)),
+                                     _mm512_add_epi32(_mm512_mullo_epi32(lane_dx, _mm512_set1_epi32(static_cast<int32_t>(edge.step_x))),
+                                                      _mm512_mullo_epi32(lane_dy, _mm512_set1_epi32(static_cast<int32_t>(edge.step_y)))));
+        any_negative = _mm512_or_si512(any_negative, w);
+        // maskz: безмасочный вариант в GCC 12 дает ложное -Wmaybe-uninitialized
+        w_f[i] = _mm512_mul_ps(_mm512_maskz_cvtepi32_ps(0xFFFF, _mm512_sub_epi32(w, bias)), _mm512_set1_ps(setup.z_inv[i]));
+    }
+
+    // Покрытие: у всех трех реберных функций знаковый бит не выставлен + пиксель внутри прямоугольника
+    const int columns_mask = (1 << (maxs.x - mins.x + 1)) - 1;
+    int rect_mask = 0;
+    for (ScreenDimension dy = 0; dy <= maxs.y - mins.y; dy++)
+        rect_mask |= columns_mask << (4*dy);
+    int mask = _mm512_cmpge_epi32_mask(any_negative, _mm512_setzero_si512()) & rect_mask;
+    if (!mask)
+        return 0;
+
+    __m512 inv_sum = _mm512_div_ps(_mm512_set1_ps(1.f), _mm512_add_ps(_mm512_add_ps(w_f[0], w_f[1]), w_f[2]));
+    alignas(64) float bc_0[16];
+    alignas(64) float bc_1[16];
+    alignas(64) float bc_2[16];
+    _mm512_store_ps(bc_0, _mm512_mul_ps(w_f[0], inv_sum));
+    _mm512_store_ps(bc_1, _mm512_mul_ps(w_f[1], inv_sum));
+    _mm512_store_ps(bc_2, _mm512_mul_ps(w_f[2], inv_sum));
+
+    size_t fragments = 0;
+    ScreenBuffer::Accessor lines_acc = screen_buffer_.GetAccessor();
+    while (mask)
+    {
+        int lane = __builtin_ctz(mask);
+        mask &= mask - 1;
+
+        ScreenDimension x_dim = mins.x + (lane & 3);
+        ScreenDimension y_dim = mins.y + (lane >> 2);
+        if (!PixelMasked(x_dim, y_dim))
+            continue;
+        if (lines_acc.LockedRow() != static_cast<size_t>(y_dim))
+            lines_acc.LockRow(y_dim); // Предыдущий ряд отпускается внутри
+
+        fragments += ProcessPixel(fs, setup, BaricentricCoords(bc_0[lane], bc_1[lane], bc_2[lane]), lines_acc, x_dim);
     }
+    return fragments;
 }
 
 } // namespace plane_render
@@ -1,7 +1,37 @@
 ﻿#include "rendering_geometry.hpp"
 
+#include <limits>
+#include <cstring>
+
 namespace plane_render {
 
+namespace {
+
+// Столбец j матрицы: m * v = (c0*x + c1*y) + (c2*z + c3*w) - тот же порядок сложений, что у _mm_dp_ps
+inline __m128 Column(const Matrix4& m, size_t j)
+{
+    return _mm_set_ps(m.coeffitients[3][j], m.coeffitients[2][j], m.coeffitients[1][j], m.coeffitients[0][j]);
+}
+
+// Полная маска для maskz-вариантов интринсиков AVX-512: безмасочные варианты в GCC 12 дают ложные
+// -Wuninitialized на _mm512_undefined_ps
+constexpr __mmask16 AllLanes = 0xFFFF;
+
+} // namespace
+
+Matrix4 InverseRigid(const Matrix4& m)
+{
+    const auto& c = m.coeffitients;
+    Matrix4 result = Matrix4::Identity();
+    for (size_t i = 0; i < 3; i++)
+    {
+        for (size_t j = 0; j < 3; j++)
+            result.coeffitients[i][j] = c[j][i];
+        result.coeffitients[i][3] = -(c[0][i]*c[0][3] + c[1][i]*c[1][3] + c[2][i]*c[2][3]);
+    }
+    return result;
+}
+
 RenderingGeometry::RenderingGeometry(ScreenDimension w, ScreenDimension h, float n_p, float f_p, float fov,
                                      const Vector3D& up) :
         up_(up),
@@ -46,23 +76,30 @@ void RenderingGeometry::LookAt(const Vector3D& pos, const Vector3D& at)
 */
 void RenderingGeometry::UpdateTransform()
 {
+    Matrix4 const old_space = result_space_;
+    FastVector3D const old_light = light_pos_;
+
     FastVector3D dir = static_cast<FastVector3D>(camera_pos_src_ - at_);
     if (dir.NormSq() == 0.f)
-    {
         result_space_ = Matrix4::Identity();
-        return;
-    }
     else
+    {
         dir = dir.Normalized();
-    
-    FastVector3D right = up_.Cross(dir).Normalized();
-    FastVector3D e2 = dir.Cross(right).Normalized();
-    result_space_ = { right.x, right.y, right.z, -camera_pos_src_.Dot(right),
-                      e2.x,    e2.y,    e2.z,    -camera_pos_src_.Dot(e2),
-                      dir.x,   dir.y,   dir.z,   -camera_pos_src_.Dot(dir),
-                      0.f,     0.f,     0.f,     1.f };
 
-    light_pos_ = result_space_ * light_pos_src_;
+        FastVector3D right = up_.Cross(dir).Normalized();
+        FastVector3D e2 = dir.Cross(right).Normalized();
+        result_space_ = { right.x, right.y, right.z, -camera_pos_src_.Dot(right),
+                          e2.x,    e2.y,    e2.z,    -camera_pos_src_.Dot(e2),
+                          dir.x,   dir.y,   dir.z,   -camera_pos_src_.Dot(dir),
+                          0.f,     0.f,     0.f,     1.f };
+
+        light_pos_ = result_space_ * light_pos_src_;
+    }
+
+    // Побитово: если совпало, кадр из этой геометрии получится тот же самый
+    if (std::memcmp(&old_space, &result_space_, sizeof(Matrix4)) != 0 ||
+        std::memcmp(&old_light, &light_pos_, sizeof(FastVector3D)) != 0)
+        version_++;
 }
 
 void RenderingGeometry::MoveAt(const Vector3D& at_shift)
@@ -79,8 +116,23 @@ void RenderingGeometry::MoveCam(const Vector3D& mov)
 
 void RenderingGeometry::SetLightSrcPos(const Vector3D& pos)
 {
+    FastVector3D const old_light = light_pos_;
     light_pos_src_ = pos;
     light_pos_ = result_space_ * light_pos_src_;
+    if (std::memcmp(&old_light, &light_pos_, sizeof(FastVector3D)) != 0)
+        version_++;
+}
+
+void RenderingGeometry::SetRenderSize(ScreenDimension w, ScreenDimension h)
+{
+    DCHECK(w > 0 && h > 0);
+    if (w == screen_width_ && h == screen_height_)
+        return;
+
+    screen_width_ = w;
+    screen_height_ = h;
+    SetToPixelsCoeffitients();
+    version_++;
 }
 
 void RenderingGeometry::SetToPixelsCoeffitients()
@@ -104,4 +156,122 @@ void RenderingGeometry::TransformGeometry(const Vector4D& src_vec4, Vertex& out_
     SetPixelPos(coords_screenspace, out_v);
 }
 
+void RenderingGeometry::TransformGeometry(const Vector4D* src, const FastVector3D& offset, Vertex* out, size_t count) const
+{
+    switch (ActiveIsa())
+    {
+    case Isa::Avx512:
+        TransformGeometryAvx512(src, offset, out, count);
+        break;
+    case Isa::Avx2:
+        TransformGeometryAvx2(src, offset, out, count);
+        break;
+    default: // Без AVX2 - поштучно (SSE4.1 нужен basic_math.hpp в любом случае)
+        for (size_t i = 0; i < count; i++)
+            TransformGeometry(src[i] + offset, out[i]);
+    }
+}
+
+void RenderingGeometry::TransformGeometryAvx2(const Vector4D* src, const FastVector3D& offset,
+                                              Vertex* out, size_t count) const
+{
+    // Две вершины в регистре, каждая - в своей 128-битной половине
+    __m256 view[4], persp[4];
+    for (size_t j = 0; j < 4; j++)
+    {
+        __m128 const view_column = Column(result_space_, j);
+        __m128 const persp_column = Column(perspective_, j);
+        view[j] = _mm256_broadcast_ps(&view_column);
+        persp[j] = _mm256_broadcast_ps(&persp_column);
+    }
+    __m256 const offset_x2 = _mm256_broadcast_ps(&offset.v4);
+    __m256 const mul_x2 = _mm256_broadcast_ps(&topixels_mul_);
+    __m256 const add_x2 = _mm256_broadcast_ps(&topixels_add_);
+    __m256 const steps = _mm256_set1_ps(SubpixelSteps);
+    __m256 const inv_steps = _mm256_set1_ps(1.f / SubpixelSteps);
+
+    size_t i = 0;
+    for (; i + 2 <= count; i += 2)
+    {
+        __m256 const v = _mm256_add_ps(_mm256_loadu_ps(&src[i].x), offset_x2);
+        __m256 const coords = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(view[0], _mm256_permute_ps(v, 0x00)), _mm256_mul_ps(view[1], _mm256_permute_ps(v, 0x55))),
+            _mm256_add_ps(_mm256_mul_ps(view[2], _mm256_permute_ps(v, 0xAA)), _mm256_mul_ps(view[3], _mm256_permute_ps(v, 0xFF))));
+        __m256 const coords4d = _mm256_add_ps(
+            _mm256_add_ps(_mm256_mul_ps(persp[0], _mm256_permute_ps(coords, 0x00)), _mm256_mul_ps(persp[1], _mm256_permute_ps(coords, 0x55))),
+            _mm256_add_ps(_mm256_mul_ps(persp[2], _mm256_permute_ps(coords, 0xAA)), _mm256_mul_ps(persp[3], _mm256_permute_ps(coords, 0xFF))));
+        __m256 pixel_pos = _mm256_add_ps(_mm256_mul_ps(_mm256_div_ps(coords4d, _mm256_permute_ps(coords, 0xAA)), mul_x2), add_x2);
+        pixel_pos = _mm256_round_ps(_mm256_mul_ps(pixel_pos, steps), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        pixel_pos = _mm256_mul_ps(pixel_pos, inv_steps);
+
+        // Точки с положительным и нулевым z не могут быть отображены - pixel_pos у них не трогаем
+        __m128 const lanes_coords[2] = { _mm256_castps256_ps128(coords), _mm256_extractf128_ps(coords, 1) };
+        __m128 const lanes_pixel[2] = { _mm256_castps256_ps128(pixel_pos), _mm256_extractf128_ps(pixel_pos, 1) };
+        for (size_t k = 0; k < 2; k++)
+        {
+            out[i + k].vertex_coords = lanes_coords[k];
+            if (out[i + k].vertex_coords.z <= -GraphicsEps)
+                out[i + k].SetPixelPos(lanes_pixel[k]);
+        }
+    }
+    for (; i < count; i++)
+        TransformGeometry(src[i] + offset, out[i]);
+}
+
+void RenderingGeometry::TransformGeometryAvx512(const Vector4D* src, const FastVector3D& offset,
+                                                Vertex* out, size_t count) const
+{
+    // Четыре вершины в регистре, по одной в 128-битной четверти
+    __m512 view[4], persp[4];
+    for (size_t j = 0; j < 4; j++)
+    {
+        view[j] = _mm512_maskz_broadcast_f32x4(AllLanes, Column(result_space_, j));
+        persp[j] = _mm512_maskz_broadcast_f32x4(AllLanes, Column(perspective_, j));
+    }
+    __m512 const offset_x4 = _mm512_maskz_broadcast_f32x4(AllLanes, offset.v4);
+    __m512 const mul_x4 = _mm512_maskz_broadcast_f32x4(AllLanes, topixels_mul_);
+    __m512 const add_x4 = _mm512_maskz_broadcast_f32x4(AllLanes, topixels_add_);
+    __m512 const steps = _mm512_set1_ps(SubpixelSteps);
+    __m512 const inv_steps = _mm512_set1_ps(1.f / SubpixelSteps);
+
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m512 const v = _mm512_add_ps(_mm512_loadu_ps(&src[i].x), offset_x4);
+        __m512 const coords = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(view[0], _mm512_maskz_permute_ps(AllLanes, v, 0x00)), _mm512_mul_ps(view[1], _mm512_maskz_permute_ps(AllLanes, v, 0x55))),
+            _mm512_add_ps(_mm512_mul_ps(view[2], _mm512_maskz_permute_ps(AllLanes, v, 0xAA)), _mm512_mul_ps(view[3], _mm512_maskz_permute_ps(AllLanes, v, 0xFF))));
+        __m512 const coords4d = _mm512_add_ps(
+            _mm512_add_ps(_mm512_mul_ps(persp[0], _mm512_maskz_permute_ps(AllLanes, coords, 0x00)), _mm512_mul_ps(persp[1], _mm512_maskz_permute_ps(AllLanes, coords, 0x55))),
+            _mm512_add_ps(_mm512_mul_ps(persp[2], _mm512_maskz_permute_ps(AllLanes, coords, 0xAA)), _mm512_mul_ps(persp[3], _mm512_maskz_permute_ps(AllLanes, coords, 0xFF))));
+        __m512 pixel_pos = _mm512_add_ps(_mm512_mul_ps(_mm512_div_ps(coords4d, _mm512_maskz_permute_ps(AllLanes, coords, 0xAA)), mul_x4), add_x4);
+        pixel_pos = _mm512_maskz_roundscale_ps(AllLanes, _mm512_mul_ps(pixel_pos, steps), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+        pixel_pos = _mm512_mul_ps(pixel_pos, inv_steps);
+
+        alignas(64) Vector4D lanes_coords[4];
+        alignas(64) Vector4D lanes_pixel[4];
+        _mm512_store_ps(&lanes_coords[0].x, coords);
+        _mm512_store_ps(&lanes_pixel[0].x, pixel_pos);
+        for (size_t k = 0; k < 4; k++)
+        {
+            out[i + k].vertex_coords = lanes_coords[k].v4;
+            if (out[i + k].vertex_coords.z <= -GraphicsEps)
+                out[i + k].SetPixelPos(lanes_pixel[k].v4);
+        }
+    }
+    for (; i < count; i++)
+        TransformGeometry(src[i] + offset, out[i]);
+}
+
+float RenderingGeometry::ProjectedRadius(const FastVector3D& center_src, float radius) const
+{
+    Vector4D center = result_space_ * Vector4D(center_src.ToVector3D(), 1.f);
+    float dist = -center.z; // Смотрим вдоль -z
+    if (dist - radius <= n_)
+        return std::numeric_limits<float>::infinity();
+
+    // ksi = x / (tan(fov) * dist), px = ksi * width / 2
+    return radius * screen_width_ / (2.f * std::tan(fov_) * dist);
+}
+
 } // namespace plane_render
\ No newline at end of file
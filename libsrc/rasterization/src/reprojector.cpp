@@ -0,0 +1,204 @@
+#include "reprojector.hpp"
+
+#include "screen_buffer.hpp"
+
+#include <cstring>
+
+namespace plane_render {
+
+namespace {
+
+// Ключи упорядочены так же, как глубины (ближе - больше), и все больше 0
+inline uint32_t DepthKey(float z)
+{
+    uint32_t bits;
+    memcpy(&bits, &z, sizeof(bits));
+    return (bits & 0x80000000u) ? ~bits : (bits | 0x80000000u);
+}
+
+inline float KeyDepth(uint32_t key)
+{
+    uint32_t bits = (key & 0x80000000u) ? (key & 0x7FFFFFFFu) : ~key;
+    float z;
+    memcpy(&z, &bits, sizeof(z));
+    return z;
+}
+
+inline uint64_t Pack(float z, const Color& color)
+{
+    uint32_t color_bits;
+    memcpy(&color_bits, &color, sizeof(color_bits));
+    return (static_cast<uint64_t>(DepthKey(z)) << 32) | color_bits;
+}
+
+inline void AtomicMax(std::atomic<uint64_t>& slot, uint64_t value)
+{
+    uint64_t current = slot.load(std::memory_order_relaxed);
+    while (current < value && !slot.compare_exchange_weak(current, value, std::memory_order_relaxed))
+        ;
+}
+
+} // namespace
+
+Reprojector::Reprojector(const RenderingGeometryConstPtr& geom, size_t tile_side, size_t tiles_x, size_t tiles_count) :
+    geom_(geom),
+    width_(geom_->Width()),
+    height_(geom_->Height()),
+    tile_side_(tile_side),
+    tiles_x_(tiles_x),
+    delta_(Matrix4::Identity()),
+    packed_(width_*height_),
+    colors_(width_*height_),
+    z_(width_*height_),
+    dirty_tiles_(tiles_count)
+{
+    DCHECK(tiles_x_ * tile_side_ >= width_ && tiles_count % tiles_x_ == 0);
+}
+
+void Reprojector::Begin(const Matrix4& prev_view, size_t tiles_x, size_t tiles_count)
+{
+    width_ = geom_->Width();
+    height_ = geom_->Height();
+    CHECK(width_*height_ <= packed_.size());
+    tiles_x_ = tiles_x;
+    dirty_tiles_.resize(tiles_count); // Не больше, чем при создании - без перевыделения
+    DCHECK(tiles_x_ * tile_side_ >= width_ && tiles_count % tiles_x_ == 0);
+
+    delta_ = geom_->ViewMatrix() * InverseRigid(prev_view);
+}
+
+void Reprojector::ClearPart(size_t part, size_t parts)
+{
+    size_t const count = width_*height_;
+    for (size_t i = count*part/parts; i < count*(part+1)/parts; i++)
+        packed_[i].store(0, std::memory_order_relaxed);
+}
+
+void Reprojector::SplatPart(const Color* prev_colors, const float* prev_z, size_t part, size_t parts)
+{
+    // Пиксель -> координаты камеры (обратно к RenderingGeometry::TransformGeometry):
+    // x = (px - cx) / half_w * tan(fov) * z, y = (py - cy) / half_h * tan(fov) / ratio * z
+    float const tan_fov = std::tan(geom_->GetFov());
+    float const ratio = geom_->GetRatio();
+    float const half_w = width_ / 2.f;
+    float const half_h = height_ / 2.f;
+    float const cx = half_w - 0.5f;
+    float const cy = half_h - 0.5f;
+
+    __m256 const to_view_x = _mm256_set1_ps(tan_fov / half_w);
+    __m256 const to_pixel_x = _mm256_set1_ps(half_w / tan_fov);
+    __m256 const to_pixel_y = _mm256_set1_ps(half_h * ratio / tan_fov);
+    __m256 const center_x = _mm256_set1_ps(cx);
+    __m256 const center_y = _mm256_set1_ps(cy);
+    __m256 const far_z = _mm256_set1_ps(-geom_->GetFar());
+    __m256 const clear_z = _mm256_set1_ps(ScreenBuffer::ClearZ);
+    __m256 const max_z = _mm256_set1_ps(-GraphicsEps);
+    __m256 const lanes = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+
+    __m256 d[3][4];
+    for (size_t i = 0; i < 3; i++)
+     for (size_t j = 0; j < 4; j++)
+         d[i][j] = _mm256_set1_ps(delta_.coeffitients[i][j]);
+
+    alignas(32) float z_in[8];
+    alignas(32) int32_t px[8];
+    alignas(32) int32_t py[8];
+    alignas(32) float z_out[8];
+    for (size_t y = height_*part/parts; y < height_*(part+1)/parts; y++)
+    {
+        __m256 const view_y_mul = _mm256_set1_ps((y - cy) / half_h * tan_fov / ratio);
+        for (size_t x = 0; x < width_; x += 8)
+        {
+            size_t const count = std::min<size_t>(8, width_ - x);
+            size_t const row = y*width_ + x;
+            std::fill(z_in, z_in + 8, ScreenBuffer::ClearZ);
+            memcpy(z_in, prev_z + row, count*sizeof(float));
+
+            __m256 z = _mm256_load_ps(z_in);
+            __m256 const empty = _mm256_cmp_ps(z, clear_z, _CMP_EQ_OQ);
+            z = _mm256_blendv_ps(z, far_z, empty);
+
+            __m256 const pixel_x = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x)), lanes);
+            __m256 const vx = _mm256_mul_ps(_mm256_mul_ps(_mm256_sub_ps(pixel_x, center_x), to_view_x), z);
+            __m256 const vy = _mm256_mul_ps(view_y_mul, z);
+
+            __m256 n[3];
+            for (size_t i = 0; i < 3; i++)
+                n[i] = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(d[i][0], vx), _mm256_mul_ps(d[i][1], vy)),
+                                     _mm256_add_ps(_mm256_mul_ps(d[i][2], z), d[i][3]));
+
+            // За камерой - не проецируем (NaN и огромные координаты отсеет проверка границ)
+            int const visible = _mm256_movemask_ps(_mm256_cmp_ps(n[2], max_z, _CMP_LE_OQ)) & ((1 << count) - 1);
+            if (!visible)
+                continue;
+
+            __m256 const inv_z = _mm256_div_ps(_mm256_set1_ps(1.f), n[2]);
+            __m256 const new_x = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(n[0], inv_z), to_pixel_x), center_x);
+            __m256 const new_y = _mm256_add_ps(_mm256_mul_ps(_mm256_mul_ps(n[1], inv_z), to_pixel_y), center_y);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(px), _mm256_cvtps_epi32(_mm256_round_ps(new_x, _MM_FROUND_TO_NEAREST_INT)));
+            _mm256_store_si256(reinterpret_cast<__m256i*>(py), _mm256_cvtps_epi32(_mm256_round_ps(new_y, _MM_FROUND_TO_NEAREST_INT)));
+            _mm256_store_ps(z_out, _mm256_blendv_ps(n[2], clear_z, empty)); // Пустой пиксель остается пустым
+
+            for (int mask = visible; mask; mask &= mask - 1)
+            {
+                int const lane = __builtin_ctz(mask);
+                if (px[lane] < 0 || py[lane] < 0 ||
+                    static_cast<size_t>(px[lane]) >= width_ || static_cast<size_t>(py[lane]) >= height_)
+                    continue;
+                AtomicMax(packed_[py[lane]*width_ + px[lane]], Pack(z_out[lane], prev_colors[row + lane]));
+            }
+        }
+    }
+}
+
+uint64_t Reprojector::FillCrack(size_t x, size_t y) const
+{
+    size_t const i = y*width_ + x;
+    uint64_t const left = x > 0 ? packed_[i - 1].load(std::memory_order_relaxed) : 0;
+    uint64_t const right = x + 1 < width_ ? packed_[i + 1].load(std::memory_order_relaxed) : 0;
+    if (left && right)
+        return std::max(left, right); // Ближний из соседей
+    uint64_t const up = y > 0 ? packed_[i - width_].load(std::memory_order_relaxed) : 0;
+    uint64_t const down = y + 1 < height_ ? packed_[i + width_].load(std::memory_order_relaxed) : 0;
+    if (up && down)
+        return std::max(up, down);
+    return 0;
+}
+
+size_t Reprojector::ResolvePart(size_t refresh_phase, size_t refresh_period, size_t part, size_t parts)
+{
+    DCHECK(refresh_period > 0);
+    size_t const tiles_y = dirty_tiles_.size() / tiles_x_;
+    size_t reused = 0;
+    for (size_t ty = tiles_y*part/parts; ty < tiles_y*(part+1)/parts; ty++)
+    {
+        uint8_t* row_tiles = dirty_tiles_.data() + ty*tiles_x_;
+        for (size_t tx = 0; tx < tiles_x_; tx++)
+            row_tiles[tx] = (ty*tiles_x_ + tx) % refresh_period == refresh_phase % refresh_period;
+
+        size_t const y1 = std::min((ty + 1)*tile_side_, height_);
+        for (size_t y = ty*tile_side_; y < y1; y++)
+         for (size_t x = 0; x < width_; x++)
+         {
+             size_t const i = y*width_ + x;
+             uint64_t value = packed_[i].load(std::memory_order_relaxed);
+             if (!value)
+                 value = FillCrack(x, y);
+             if (!value)
+             {
+                 row_tiles[x / tile_side_] = 1;
+                 continue; // Плитка будет очищена и перерисована
+             }
+             uint32_t const color_bits = static_cast<uint32_t>(value);
+             memcpy(static_cast<void*>(&colors_[i]), &color_bits, sizeof(Color));
+             z_[i] = KeyDepth(static_cast<uint32_t>(value >> 32));
+         }
+
+        for (size_t tx = 0; tx < tiles_x_; tx++)
+            if (!row_tiles[tx])
+                reused += (y1 - ty*tile_side_) * (std::min((tx + 1)*tile_side_, width_) - tx*tile_side_);
+    }
+    return reused;
+}
+
+} // namespace plane_render
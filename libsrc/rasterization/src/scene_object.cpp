@@ -2,21 +2,34 @@
 
 #include "fragment_shader.hpp"
 #include "graphics_types.hpp"
+#include "mesh_simplifier.hpp"
 
 #include "common/logger.hpp"
 
+#include <algorithm>
+#include <cmath>
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <limits>
+#include <numeric>
+#include <cstring>
+#include <unordered_map>
 
 namespace plane_render {
 
+constexpr size_t SceneObject::MeshletMaxVertices;
+constexpr size_t SceneObject::MeshletMaxTriangles;
+constexpr size_t SceneObject::MeshletNormalCells;
+
 void SceneObject::VertexShader::Update()
 {
     DCHECK(associated_object_->vert_src_coords_.size() == associated_object_->vertices_.size());
 
-    for (size_t i = 0; i < associated_object_->vert_src_coords_.size(); i++)
-        associated_object_->geom_->TransformGeometry(associated_object_->vert_src_coords_[i], associated_object_->vertices_[i]);
+    const FastVector3D& position = associated_object_->position_; // fourth = 0: w исходных координат не меняется
+    associated_object_->geom_->TransformGeometry(associated_object_->vert_src_coords_.data(), position,
+                                                 associated_object_->vertices_.data(),
+                                                 associated_object_->vert_src_coords_.size());
 }
 
 SceneObject::SceneObject(const RenderingGeometryConstPtr& geom, const std::string& obj_filename, float scale,
@@ -25,12 +38,36 @@ SceneObject::SceneObject(const RenderingGeometryConstPtr& geom, const std::strin
     triangles_per_task_(triangles_per_task)
 {
     LoadMeshFile(obj_filename, scale);
+    ComputeBounds();
+    BuildMesh();
+}
+
+SceneObject::SceneObject(const RenderingGeometryConstPtr& geom, const std::string& obj_filename, FitRadius fit,
+                         size_t triangles_per_task) :
+    geom_(geom),
+    triangles_per_task_(triangles_per_task)
+{
+    LoadMeshFile(obj_filename, 1.f);
+    ComputeBounds();
+    if (bounding_radius_ > 0.f)
+    {
+        // Как масштаб в LoadMeshFile: координаты, умноженные на 1, не меняются
+        float const scale = fit.radius / bounding_radius_;
+        for (auto& v : vert_src_coords_)
+        {
+            v.x *= scale;
+            v.y *= scale;
+            v.z *= scale;
+        }
+        ComputeBounds();
+    }
+    BuildMesh();
 }
 
 SceneObject::SceneObject(const RenderingGeometryConstPtr& geom, const std::vector<Vector3D>& vertices,
                          const std::vector<size_t>& indices, size_t triangles_per_task) : 
     geom_(geom),
-    indices_(indices),
+    lod_indices_{indices},
     triangles_per_task_(triangles_per_task)
 {
     CHECK(indices.size() % 3 == 0);
@@ -39,16 +76,31 @@ SceneObject::SceneObject(const RenderingGeometryConstPtr& geom, const std::vecto
         vert_src_coords_.emplace_back(v.x, v.y, v.z, 1.f);
         vertices_.emplace_back(TextureCoords{0, 0}, Vector3D{0, 1, 0}); // Фиктивная вершина
     }
+    ComputeBounds();
+    BuildMeshlets();
 }
 
 SceneObject::SceneObject(SceneObject&& another) :
     geom_(another.geom_),
     vert_src_coords_(another.vert_src_coords_),
     vertices_(another.vertices_),
-    indices_(another.indices_),
+    lod_indices_(another.lod_indices_),
+    lod_meshlets_(another.lod_meshlets_),
+    lod_meshlet_indices_(another.lod_meshlet_indices_),
+    lod_meshlet_vertices_(another.lod_meshlet_vertices_),
+    current_lod_(another.current_lod_),
+    visible_meshlets_(another.visible_meshlets_),
+    visible_triangles_(another.visible_triangles_),
+    bounding_center_(another.bounding_center_),
+    bounding_radius_(another.bounding_radius_),
+    position_(another.position_),
+    casts_shadows_(another.casts_shadows_),
+    receives_shadows_(another.receives_shadows_),
+    backface_culling_(another.backface_culling_),
     triangles_per_task_(another.triangles_per_task_),
     vs_(another.vs_),
-    fs_(another.fs_)
+    fs_(another.fs_),
+    version_(another.version_)
 {
     // Вершинный шейдер перенастраиваем на нас
     vs_->associated_object_ = this;
@@ -69,6 +121,9 @@ void SceneObject::LoadMeshFile(const std::string& obj_filename, float scale)
     if(!in.is_open())
         throw std::invalid_argument("can not find file " + std::string(obj_filename));
 
+    lod_indices_.resize(1);
+    IndicesList& indices = lod_indices_[0];
+
     std::string line;
     std::vector<Vector3D> pos;
     std::vector<TextureCoords> tex;
@@ -129,19 +184,19 @@ void SceneObject::LoadMeshFile(const std::string& obj_filename, float scale)
             auto const vcount = vert_src_coords_.size() - vsize;
             if (vcount == 3)
             {
-                indices_.push_back(vsize);
-                indices_.push_back(vsize + 1);
-                indices_.push_back(vsize + 2);
+                indices.push_back(vsize);
+                indices.push_back(vsize + 1);
+                indices.push_back(vsize + 2);
             }
             else if (vcount == 4)
             {
-                indices_.push_back(vsize);
-                indices_.push_back(vsize + 1);
-                indices_.push_back(vsize + 2);
+                indices.push_back(vsize);
+                indices.push_back(vsize + 1);
+                indices.push_back(vsize + 2);
 
-                indices_.push_back(vsize + 2);
-                indices_.push_back(vsize);
-                indices_.push_back(vsize + 3);
+                indices.push_back(vsize + 2);
+                indices.push_back(vsize);
+                indices.push_back(vsize + 3);
             }
             else
                 throw std::runtime_error("Faces not supported!");
@@ -149,7 +204,340 @@ void SceneObject::LoadMeshFile(const std::string& obj_filename, float scale)
     }
 
     DCHECK(vert_src_coords_.size() == vertices_.size());
-    DCHECK(indices_.size() % 3 == 0);
+    DCHECK(indices.size() % 3 == 0);
+}
+
+void SceneObject::ComputeBounds()
+{
+    if (vert_src_coords_.empty())
+        return;
+
+    // Центр - середина AABB: не оптимально, но для выбора LOD достаточно
+    FastVector3D mins = vert_src_coords_[0];
+    FastVector3D maxs = vert_src_coords_[0];
+    for (const auto& v : vert_src_coords_)
+    {
+        mins = _mm_min_ps(mins, v);
+        maxs = _mm_max_ps(maxs, v);
+    }
+    bounding_center_ = FastVector3D((mins + maxs) * 0.5f);
+    bounding_center_.fourth = 0.f;
+
+    float radius_sq = 0.f;
+    for (const auto& v : vert_src_coords_)
+    {
+        FastVector3D diff = v - bounding_center_;
+        radius_sq = std::max(radius_sq, diff.NormSq());
+    }
+    bounding_radius_ = std::sqrt(radius_sq);
+}
+
+void SceneObject::BuildMesh()
+{
+    BuildLods(); // До склейки: упрощение само склеивает вершины по координатам и от номеров зависит
+    WeldVertices();
+    BuildMeshlets();
+}
+
+void SceneObject::BuildLods()
+{
+    DCHECK(lod_indices_.size() == 1);
+
+    while (lod_indices_.size() < MaxLodLevels)
+    {
+        size_t prev_triangles = lod_indices_.back().size() / 3;
+        if (prev_triangles <= MinLodTriangles)
+            break;
+
+        IndicesList next = SimplifyMesh(vert_src_coords_, lod_indices_.back(), prev_triangles / 2);
+        if (next.size() / 3 > prev_triangles * 9 / 10) // Упрощать дальше не получается
+            break;
+        lod_indices_.push_back(std::move(next));
+    }
+}
+
+void SceneObject::WeldVertices()
+{
+    // Ключ - побитово координаты, нормаль и текстурные координаты: склеиваются только точные копии
+    struct Key
+    {
+        float v[8];
+        bool operator==(const Key& other) const { return memcmp(v, other.v, sizeof(v)) == 0; }
+    };
+    struct KeyHash
+    {
+        size_t operator()(const Key& key) const
+        {
+            uint32_t bits[8];
+            memcpy(bits, key.v, sizeof(bits));
+            size_t h = 0;
+            for (uint32_t b : bits)
+                h = h * 1000003u ^ b;
+            return h;
+        }
+    };
+
+    size_t const count = vert_src_coords_.size();
+    std::unordered_map<Key, size_t, KeyHash> unique;
+    unique.reserve(count);
+    IndicesList remap(count);
+    Vec4DynamicArray src;
+    VerticesVector vertices;
+    for (size_t v = 0; v < count; v++)
+    {
+        const Vector4D& p = vert_src_coords_[v];
+        const Vertex& vert = vertices_[v];
+        Key const key = { { p.x, p.y, p.z, vert.normal.x, vert.normal.y, vert.normal.z,
+                            vert.texture_coords.x, vert.texture_coords.y } };
+        auto const it = unique.emplace(key, src.size());
+        if (it.second)
+        {
+            src.push_back(p);
+            vertices.push_back(vert);
+        }
+        remap[v] = it.first->second;
+    }
+    if (src.size() == count)
+        return;
+
+    vert_src_coords_.swap(src);
+    vertices_.swap(vertices);
+    for (IndicesList& indices : lod_indices_)
+        for (size_t& index : indices)
+            index = remap[index];
+}
+
+void SceneObject::BuildMeshlets()
+{
+    lod_meshlets_.clear();
+    lod_meshlet_indices_.clear();
+    lod_meshlet_vertices_.clear();
+    std::vector<size_t> stamp(vert_src_coords_.size(), std::numeric_limits<size_t>::max()); // Последний мешлет вершины
+    size_t meshlet_id = 0; // Сквозной по уровням
+    for (const IndicesList& lod : lod_indices_)
+    {
+        size_t const triangles = lod.size() / 3;
+        lod_meshlets_.emplace_back();
+        lod_meshlet_indices_.emplace_back();
+        lod_meshlet_vertices_.emplace_back();
+        if (triangles == 0)
+            continue;
+
+        // Центры треугольников, нормированные в [0, 1] по их AABB
+        FastVec3DynamicArray centers(triangles);
+        FastVector3D mins(std::numeric_limits<float>::max(), std::numeric_limits<float>::max(), std::numeric_limits<float>::max());
+        FastVector3D maxs = mins * (-1.f);
+        for (size_t t = 0; t < triangles; t++)
+        {
+            centers[t] = FastVector3D((vert_src_coords_[lod[3*t]] + vert_src_coords_[lod[3*t + 1]] +
+                                       vert_src_coords_[lod[3*t + 2]]) * (1.f / 3));
+            centers[t].fourth = 0.f;
+            mins = _mm_min_ps(mins, centers[t]);
+            maxs = _mm_max_ps(maxs, centers[t]);
+        }
+
+        // Единичные нормали граней (лицевая сторона - обход против часовой), у вырожденных - нулевые
+        FastVec3DynamicArray normals(triangles);
+        for (size_t t = 0; t < triangles; t++)
+        {
+            FastVector3D const a = vert_src_coords_[lod[3*t]];
+            FastVector3D n = FastVector3D(vert_src_coords_[lod[3*t + 1]] - a).Cross(vert_src_coords_[lod[3*t + 2]] - a);
+            n.fourth = 0.f;
+            float const len_sq = n.NormSq();
+            normals[t] = len_sq > 0.f ? FastVector3D(n * (1.f / std::sqrt(len_sq))) : FastVector3D(0.f, 0.f, 0.f);
+        }
+
+        // Код Мортона центра по 10 бит на ось: соседние по коду треугольники близки в пространстве
+        auto const spread = [](uint32_t v)
+        {
+            v = (v | (v << 16)) & 0x030000FF;
+            v = (v | (v <<  8)) & 0x0300F00F;
+            v = (v | (v <<  4)) & 0x030C30C3;
+            v = (v | (v <<  2)) & 0x09249249;
+            return v;
+        };
+        auto const quantize = [](float v, float lo, float hi)
+        {
+            return static_cast<uint32_t>(hi > lo ? Clump((v - lo) / (hi - lo), 0.f, 1.f) * 1023.f : 0.f);
+        };
+        // Ячейка нормали в октаэдрической развертке MeshletNormalCells x MeshletNormalCells: старшие биты ключа.
+        // Тогда в мешлет попадают близкие грани одного направления - конус нормалей узкий
+        auto const normal_cell = [&normals](size_t t)
+        {
+            const FastVector3D& n = normals[t];
+            float const l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+            if (!(l1 > 0.f))
+                return uint64_t(0);
+            float u = n.x / l1;
+            float v = n.y / l1;
+            if (n.z < 0.f) // Нижняя полусфера отгибается к углам квадрата
+            {
+                float const folded_u = (1.f - std::abs(v)) * (u >= 0.f ? 1.f : -1.f);
+                v = (1.f - std::abs(u)) * (v >= 0.f ? 1.f : -1.f);
+                u = folded_u;
+            }
+            int const cells = static_cast<int>(MeshletNormalCells);
+            int const iu = std::min(cells - 1, static_cast<int>((u + 1.f) * 0.5f * cells));
+            int const iv = std::min(cells - 1, static_cast<int>((v + 1.f) * 0.5f * cells));
+            return static_cast<uint64_t>(iv * cells + iu);
+        };
+        std::vector<std::pair<uint64_t, size_t>> codes(triangles);
+        for (size_t t = 0; t < triangles; t++)
+            codes[t] = { (normal_cell(t) << 32) | spread(quantize(centers[t].x, mins.x, maxs.x)) |
+                         (spread(quantize(centers[t].y, mins.y, maxs.y)) << 1) |
+                         (spread(quantize(centers[t].z, mins.z, maxs.z)) << 2), t };
+        std::sort(codes.begin(), codes.end()); // При равных кодах - исходный порядок
+
+        IndicesList& indices = lod_meshlet_indices_.back();
+        indices.resize(lod.size());
+        for (size_t t = 0; t < triangles; t++)
+            for (size_t k = 0; k < 3; k++)
+                indices[3*t + k] = lod[3*codes[t].second + k];
+
+        // Жадно по порядку ключей: треугольник уходит в следующий мешлет, если в текущий не влезает или его нормаль
+        // из другой ячейки. Иначе на стыке ячеек конус мешлета охватывает несколько направлений и не отсекается
+        MeshletsList& meshlets = lod_meshlets_.back();
+        IndicesList& meshlet_vertices = lod_meshlet_vertices_.back();
+        Meshlet current;
+        for (size_t t = 0; t < triangles; t++)
+        {
+            size_t new_vertices = 0;
+            for (size_t k = 0; k < 3; k++)
+            {
+                size_t const v = indices[3*t + k];
+                if (stamp[v] != meshlet_id && (k < 1 || v != indices[3*t]) && (k < 2 || v != indices[3*t + 1]))
+                    new_vertices++;
+            }
+            bool const new_cell = t > 0 && (codes[t].first >> 32) != (codes[t - 1].first >> 32);
+            if (new_cell || current.count == MeshletMaxTriangles || current.vertex_count + new_vertices > MeshletMaxVertices)
+            {
+                meshlets.push_back(current);
+                current = Meshlet();
+                current.first = t;
+                current.vertex_first = meshlet_vertices.size();
+                meshlet_id++;
+            }
+            for (size_t k = 0; k < 3; k++)
+            {
+                size_t const v = indices[3*t + k];
+                if (stamp[v] == meshlet_id)
+                    continue;
+                stamp[v] = meshlet_id;
+                meshlet_vertices.push_back(v);
+                current.vertex_count++;
+            }
+            current.count++;
+        }
+        meshlets.push_back(current);
+        meshlet_id++;
+
+        for (Meshlet& meshlet : meshlets)
+        {
+            // Как ComputeBounds: центр - середина AABB вершин
+            const size_t* vertices = meshlet_vertices.data() + meshlet.vertex_first;
+            FastVector3D c_mins = vert_src_coords_[vertices[0]];
+            FastVector3D c_maxs = c_mins;
+            for (size_t i = 1; i < meshlet.vertex_count; i++)
+            {
+                c_mins = _mm_min_ps(c_mins, vert_src_coords_[vertices[i]]);
+                c_maxs = _mm_max_ps(c_maxs, vert_src_coords_[vertices[i]]);
+            }
+            meshlet.center = FastVector3D((c_mins + c_maxs) * 0.5f);
+            meshlet.center.fourth = 0.f;
+            float radius_sq = 0.f;
+            for (size_t i = 0; i < meshlet.vertex_count; i++)
+                radius_sq = std::max(radius_sq, FastVector3D(vert_src_coords_[vertices[i]] - meshlet.center).NormSq());
+            meshlet.radius = std::sqrt(radius_sq);
+
+            // Конус нормалей граней: ось - средняя нормаль, полуугол - до самой отклоненной
+            FastVec3DynamicArray cone_normals;
+            FastVector3D axis(0.f, 0.f, 0.f);
+            for (size_t t = meshlet.first; t < meshlet.first + meshlet.count; t++)
+            {
+                const FastVector3D& n = normals[codes[t].second];
+                if (!(n.NormSq() > 0.f))
+                    continue; // Вырожденный треугольник не рисуется
+                cone_normals.push_back(n);
+                axis = axis + n;
+            }
+            float const axis_len = std::sqrt(axis.NormSq());
+            if (cone_normals.empty() || !(axis_len > 0.f))
+                continue;
+            meshlet.cone_axis = axis * (1.f / axis_len);
+            float cone_cos = 1.f;
+            for (const FastVector3D& n : cone_normals)
+                cone_cos = std::min(cone_cos, meshlet.cone_axis.Dot(n));
+            meshlet.cone_cos = cone_cos;
+            meshlet.cone_sin = std::sqrt(std::max(0.f, 1.f - cone_cos*cone_cos));
+        }
+    }
+
+    ResetVisibleMeshlets();
+}
+
+void SceneObject::SelectLod(float projected_radius_px)
+{
+    float projected_area = 3.1415926f * projected_radius_px * projected_radius_px;
+    float max_triangles = projected_area / LodPixelsPerTriangle;
+
+    current_lod_ = 0;
+    while (current_lod_ + 1 < lod_indices_.size() && lod_indices_[current_lod_].size() / 3 > max_triangles)
+        current_lod_++;
+    ResetVisibleMeshlets();
+}
+
+void SceneObject::ResetVisibleMeshlets()
+{
+    visible_meshlets_.resize(Meshlets().size());
+    std::iota(visible_meshlets_.begin(), visible_meshlets_.end(), size_t(0));
+    visible_triangles_ = TrianglesCount();
+}
+
+size_t SceneObject::CullMeshlets()
+{
+    const MeshletsList& meshlets = Meshlets();
+    const Matrix4& view = geom_->ViewMatrix();
+    const FastVector3D& camera = geom_->CameraPosSrc();
+    // Боковые плоскости пирамиды видимости |x| <= -z*tan_x, |y| <= -z*tan_y (за ними нет центров пикселей)
+    float const tan_x = std::tan(geom_->GetFov());
+    float const tan_y = tan_x / geom_->GetRatio();
+    float const norm_x = 1.f / std::sqrt(1.f + tan_x*tan_x);
+    float const norm_y = 1.f / std::sqrt(1.f + tan_y*tan_y);
+
+    visible_meshlets_.clear();
+    visible_triangles_ = 0;
+    for (size_t m = 0; m < meshlets.size(); m++)
+    {
+        const Meshlet& meshlet = meshlets[m];
+        FastVector3D const center = meshlet.center + position_;
+        float const r = meshlet.radius * 1.01f; // Запас на округление pixel_pos
+
+        Vector4D const c = view * Vector4D(center.x, center.y, center.z, 1.f);
+        if (c.z - r > -GraphicsEps || (c.x + tan_x*c.z)*norm_x > r || (tan_x*c.z - c.x)*norm_x > r ||
+            (c.y + tan_y*c.z)*norm_y > r || (tan_y*c.z - c.y)*norm_y > r)
+            continue;
+
+        if (backface_culling_ && meshlet.cone_cos > 0.f)
+        {
+            // Из камеры сфера видна в конусе с полууглом b вокруг направления на центр. Все грани обращены
+            // обратной стороной, если угол между осью нормалей и этим направлением меньше 90 - (a + b)
+            FastVector3D const to_center = center - camera;
+            float const d = std::sqrt(to_center.NormSq());
+            if (d > r)
+            {
+                float const sin_b = r / d;
+                float const cos_b = std::sqrt(1.f - sin_b*sin_b);
+                float const cos_ab = meshlet.cone_cos*cos_b - meshlet.cone_sin*sin_b;
+                float const sin_ab = meshlet.cone_sin*cos_b + meshlet.cone_cos*sin_b;
+                if (cos_ab > 0.f && to_center.Dot(meshlet.cone_axis) > d*sin_ab)
+                    continue;
+            }
+        }
+
+        visible_meshlets_.push_back(m);
+        visible_triangles_ += meshlet.count;
+    }
+    return meshlets.size() - visible_meshlets_.size();
 }
 
 void SceneObject::Update()
@@ -157,4 +545,42 @@ void SceneObject::Update()
     vs_->Update();
 }
 
+ScreenRect SceneObject::ScreenBounds() const
+{
+    float min_x = std::numeric_limits<float>::infinity();
+    float min_y = min_x;
+    float max_x = -min_x;
+    float max_y = -min_x;
+    auto const extend = [&](const Vertex& v)
+    {
+        if (v.vertex_coords.z > -GraphicsEps)
+            return;
+        // NaN в std::min/max не проходит
+        min_x = std::min(min_x, v.pixel_pos.x);
+        min_y = std::min(min_y, v.pixel_pos.y);
+        max_x = std::max(max_x, v.pixel_pos.x);
+        max_y = std::max(max_y, v.pixel_pos.y);
+    };
+    if (visible_meshlets_.size() == Meshlets().size())
+        for (const auto& v : vertices_)
+            extend(v);
+    else // Только вершины рисуемых мешлетов: треугольники отсеченных не растеризуются, прямоугольник их не покрывает
+        for (size_t m : visible_meshlets_)
+            for (size_t i = Meshlets()[m].vertex_first; i < Meshlets()[m].vertex_first + Meshlets()[m].vertex_count; i++)
+                extend(vertices_[MeshletVertices()[i]]);
+
+    ScreenRect rect;
+    if (min_x > max_x || min_y > max_y)
+        return rect;
+
+    // Центры покрытых пикселей лежат внутри [min, max], обрезаем до int - уже в пределах экрана
+    float const w = static_cast<float>(geom_->Width() - 1);
+    float const h = static_cast<float>(geom_->Height() - 1);
+    rect.mins = { static_cast<ScreenDimension>(Clump(std::floor(min_x), 0.f, w + 1)),
+                  static_cast<ScreenDimension>(Clump(std::floor(min_y), 0.f, h + 1)) };
+    rect.maxs = { static_cast<ScreenDimension>(Clump(std::ceil(max_x), -1.f, w)),
+                  static_cast<ScreenDimension>(Clump(std::ceil(max_y), -1.f, h)) };
+    return rect;
+}
+
 } // namespace plane_render
\ No newline at end of file
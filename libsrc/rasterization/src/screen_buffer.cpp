@@ -1,15 +1,182 @@
 #include "screen_buffer.hpp"
 
+#include "common/profiler.hpp"
+#include "common/cpu_dispatch.hpp"
+
+#include <algorithm>
+
 namespace plane_render {
 
-ScreenBuffer::Accessor::Accessor(Accessor&& ac) : row_(ac.row_), buffer_(ac.buffer_)
-{}
+namespace {
+
+// Ядра заполнения count элементов по 4 байта: выровненная середина - non-temporal записями (мимо кэша),
+// невыровненные голова и хвост - обычными. Вариант выбирается в конструкторе ScreenBuffer по ActiveIsa()
+template<typename T>
+uint32_t FillBits(T value)
+{
+    static_assert(sizeof(T) == 4, "Fill kernels work with 4-byte elements");
+    uint32_t bits;
+    memcpy(&bits, &value, sizeof(bits));
+    return bits;
+}
+
+template<typename T>
+void FillScalar(T* dst, size_t count, T value)
+{
+    std::fill(dst, dst + count, value);
+}
+
+template<typename T>
+void StreamFillSse41(T* dst, size_t count, T value)
+{
+    __m128i const value_x4 = _mm_set1_epi32(FillBits(value));
+    size_t i = 0;
+    for (; i < count && reinterpret_cast<uintptr_t>(dst + i) % sizeof(__m128i) != 0; i++)
+        dst[i] = value;
+    for (; i + 4 <= count; i += 4)
+        _mm_stream_si128(reinterpret_cast<__m128i*>(dst + i), value_x4);
+    for (; i < count; i++)
+        dst[i] = value;
+}
+
+template<typename T>
+PLANE_RENDER_TARGET_AVX2 void StreamFillAvx2(T* dst, size_t count, T value)
+{
+    __m256i const value_x8 = _mm256_set1_epi32(FillBits(value));
+    size_t i = 0;
+    for (; i < count && reinterpret_cast<uintptr_t>(dst + i) % sizeof(__m256i) != 0; i++)
+        dst[i] = value;
+    for (; i + 8 <= count; i += 8)
+        _mm256_stream_si256(reinterpret_cast<__m256i*>(dst + i), value_x8);
+    for (; i < count; i++)
+        dst[i] = value;
+}
+
+// Запись целой кэш-линии за раз: голова до выравнивания длиннее, поэтому короткие куски - через AVX2
+template<typename T>
+PLANE_RENDER_TARGET_AVX512 void StreamFillAvx512(T* dst, size_t count, T value)
+{
+    if (count < 32)
+    {
+        StreamFillAvx2(dst, count, value);
+        return;
+    }
+    __m512i const value_x16 = _mm512_set1_epi32(FillBits(value));
+    size_t i = 0;
+    for (; reinterpret_cast<uintptr_t>(dst + i) % sizeof(__m512i) != 0; i++)
+        dst[i] = value;
+    for (; i + 16 <= count; i += 16)
+        _mm512_stream_si512(reinterpret_cast<__m512i*>(dst + i), value_x16);
+    for (; i < count; i++)
+        dst[i] = value;
+}
+
+// Ряд пикселей из плиток ряда row_tiles: ряд плитки - ровно 32 байта (TileSide пикселей), плитки выровнены
+using Tile = ScreenBuffer::Tile;
+constexpr size_t TileSide = ScreenBuffer::TileSide;
+static_assert(TileSide*sizeof(Color) == 2*sizeof(__m128i), "Tile row must fit 2 SSE registers");
+
+void DetileRowScalar(Color* dst, const Tile* row_tiles, size_t row_in_tile, size_t width)
+{
+    size_t x = 0;
+    for (size_t t = 0; x < width; t++, x += TileSide)
+        memcpy(dst + x, row_tiles[t].pixels + row_in_tile, (std::min(x + TileSide, width) - x)*sizeof(Color));
+}
+
+void DetileRowSse41(Color* dst, const Tile* row_tiles, size_t row_in_tile, size_t width)
+{
+    size_t x = 0;
+    for (size_t t = 0; x + TileSide <= width; t++, x += TileSide)
+    {
+        const __m128i* src = reinterpret_cast<const __m128i*>(row_tiles[t].pixels + row_in_tile);
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x), _mm_load_si128(src));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + x) + 1, _mm_load_si128(src + 1));
+    }
+    if (x < width)
+        memcpy(dst + x, row_tiles[x / TileSide].pixels + row_in_tile, (width - x)*sizeof(Color));
+}
+
+// Для AVX-512 тот же: ряды соседних плиток не лежат подряд, 64-байтные записи ничего не дают
+PLANE_RENDER_TARGET_AVX2 void DetileRowAvx2(Color* dst, const Tile* row_tiles, size_t row_in_tile, size_t width)
+{
+    size_t x = 0;
+    for (size_t t = 0; x + TileSide <= width; t++, x += TileSide)
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + x),
+                            _mm256_load_si256(reinterpret_cast<const __m256i*>(row_tiles[t].pixels + row_in_tile)));
+    if (x < width)
+        memcpy(dst + x, row_tiles[x / TileSide].pixels + row_in_tile, (width - x)*sizeof(Color));
+}
+
+// Сведение ряда: непустой пиксель src заменяет пиксель dst, если он не дальше (z камеры не меньше) - как более
+// поздний фрагмент при растеризации в общий буфер. Цвет - те же 4 байта, что и float, поэтому выбирается той же
+// маской сравнения глубин
+void CompositeRowScalar(Color* dst, float* dst_z, const Color* src, const float* src_z, size_t count)
+{
+    for (size_t i = 0; i < count; i++)
+        if (src_z[i] >= dst_z[i] && src_z[i] != ScreenBuffer::ClearZ)
+        {
+            dst_z[i] = src_z[i];
+            dst[i] = src[i];
+        }
+}
+
+void CompositeRowSse41(Color* dst, float* dst_z, const Color* src, const float* src_z, size_t count)
+{
+    static_assert(sizeof(Color) == sizeof(float), "Colors are blended as floats");
+    __m128 const clear_z = _mm_set1_ps(ScreenBuffer::ClearZ);
+    size_t i = 0;
+    for (; i + 4 <= count; i += 4)
+    {
+        __m128 const z = _mm_loadu_ps(dst_z + i);
+        __m128 const new_z = _mm_loadu_ps(src_z + i);
+        __m128 const closer = _mm_and_ps(_mm_cmpge_ps(new_z, z), _mm_cmpneq_ps(new_z, clear_z));
+        __m128 const colors = _mm_loadu_ps(reinterpret_cast<const float*>(dst + i));
+        __m128 const new_colors = _mm_loadu_ps(reinterpret_cast<const float*>(src + i));
+        _mm_storeu_ps(dst_z + i, _mm_blendv_ps(z, new_z, closer));
+        _mm_storeu_ps(reinterpret_cast<float*>(dst + i), _mm_blendv_ps(colors, new_colors, closer));
+    }
+    CompositeRowScalar(dst + i, dst_z + i, src + i, src_z + i, count - i);
+}
+
+// Для AVX-512 тот же: ряд плитки - ровно 8 пикселей
+PLANE_RENDER_TARGET_AVX2 void CompositeRowAvx2(Color* dst, float* dst_z, const Color* src, const float* src_z, size_t count)
+{
+    __m256 const clear_z = _mm256_set1_ps(ScreenBuffer::ClearZ);
+    size_t i = 0;
+    for (; i + 8 <= count; i += 8)
+    {
+        __m256 const z = _mm256_loadu_ps(dst_z + i);
+        __m256 const new_z = _mm256_loadu_ps(src_z + i);
+        __m256 const closer = _mm256_and_ps(_mm256_cmp_ps(new_z, z, _CMP_GE_OQ), _mm256_cmp_ps(new_z, clear_z, _CMP_NEQ_OQ));
+        __m256 const colors = _mm256_loadu_ps(reinterpret_cast<const float*>(dst + i));
+        __m256 const new_colors = _mm256_loadu_ps(reinterpret_cast<const float*>(src + i));
+        _mm256_storeu_ps(dst_z + i, _mm256_blendv_ps(z, new_z, closer));
+        _mm256_storeu_ps(reinterpret_cast<float*>(dst + i), _mm256_blendv_ps(colors, new_colors, closer));
+    }
+    CompositeRowSse41(dst + i, dst_z + i, src + i, src_z + i, count - i);
+}
+
+} // namespace
+
+constexpr float ScreenBuffer::ClearZ;
+
+ScreenBuffer::Accessor::Accessor(Accessor&& ac) :
+    row_(ac.row_), buffer_(ac.buffer_), row_offset_(ac.row_offset_), tile_row_(ac.tile_row_),
+    row_in_tile_(ac.row_in_tile_), ready_tile_(ac.ready_tile_)
+{
+    ac.row_ = INVALID_ROW; // Ряд теперь отпускаем мы
+}
 
 ScreenBuffer::Accessor& ScreenBuffer::Accessor::operator=(Accessor&& ac)
 {
     ReleaseRow();
     row_ = ac.row_;
     buffer_ = ac.buffer_;
+    row_offset_ = ac.row_offset_;
+    tile_row_ = ac.tile_row_;
+    row_in_tile_ = ac.row_in_tile_;
+    ready_tile_ = ac.ready_tile_;
+    ac.row_ = INVALID_ROW;
     return *this;
 }
 
@@ -21,20 +188,93 @@ ScreenBuffer::Accessor::~Accessor()
 ScreenBuffer::Accessor::Accessor(ScreenBuffer* buff) : buffer_(buff)
 {}
 
-ScreenBuffer::ScreenBuffer(size_t w, size_t h) : width_(w), height_(h), locks_(height_)
+ScreenBuffer::ScreenBuffer(size_t w, size_t h, Layout layout, ClearMode clear_mode, Sharing sharing) :
+    width_(w), height_(h), max_width_(w), max_height_(h), layout_(layout), clear_mode_(clear_mode), sharing_(sharing),
+    locks_(height_)
 {
-    pixels_ = new Color[w*h];
-    z_buffer_ = new float[w*h];
-    CHECK(pixels_ && z_buffer_);
+    tiles_x_ = (w + TileSide - 1) / TileSide;
+    tiles_count_ = tiles_x_ * ((h + TileSide - 1) / TileSide);
+
+    // Выравнивание под AVX (non-temporal записи) и кэш-линию
+    pixels_ = static_cast<Color*>(_mm_malloc(w*h*sizeof(Color), 64));
+    CHECK(pixels_);
+    if (layout_ == Layout::Tiled)
+    {
+        tiles_ = static_cast<Tile*>(_mm_malloc(tiles_count_*sizeof(Tile), alignof(Tile)));
+        CHECK(tiles_);
+    }
+    else
+    {
+        z_buffer_ = static_cast<float*>(_mm_malloc(w*h*sizeof(float), 64));
+        CHECK(z_buffer_);
+    }
+
+    if (clear_mode_ == ClearMode::Lazy)
+    {
+        tile_epochs_ = std::vector<std::atomic<uint64_t>>(tiles_count_);
+        for (auto& epoch : tile_epochs_)
+            epoch.store(NeverEpoch);
+        tile_clean_.assign(tiles_count_, 0);
+    }
 
     for (size_t i = 0; i < height_; i++)
         locks_[i].store(false);
+#ifdef LOCK_STATS_ENABLED
+    row_lock_stats_.resize(height_);
+#endif
+
+    switch (ActiveIsa())
+    {
+    case Isa::Scalar:
+        fill_colors_ = FillScalar<Color>;
+        fill_z_ = FillScalar<float>;
+        detile_row_ = DetileRowScalar;
+        composite_row_ = CompositeRowScalar;
+        break;
+    case Isa::Sse41:
+        fill_colors_ = StreamFillSse41<Color>;
+        fill_z_ = StreamFillSse41<float>;
+        detile_row_ = DetileRowSse41;
+        composite_row_ = CompositeRowSse41;
+        break;
+    case Isa::Avx2:
+        fill_colors_ = StreamFillAvx2<Color>;
+        fill_z_ = StreamFillAvx2<float>;
+        detile_row_ = DetileRowAvx2;
+        composite_row_ = CompositeRowAvx2;
+        break;
+    case Isa::Avx512:
+        fill_colors_ = StreamFillAvx512<Color>;
+        fill_z_ = StreamFillAvx512<float>;
+        detile_row_ = DetileRowAvx2;
+        composite_row_ = CompositeRowAvx2;
+        break;
+    }
 }
 
 ScreenBuffer::~ScreenBuffer()
 {
-    delete[] pixels_;
-    delete[] z_buffer_;
+    _mm_free(pixels_);
+    _mm_free(z_buffer_);
+    _mm_free(tiles_);
+    _mm_free(z_detiled_);
+}
+
+void ScreenBuffer::Resize(size_t w, size_t h)
+{
+    CHECK(w > 0 && h > 0 && w <= max_width_ && h <= max_height_);
+    for (size_t row = 0; row < height_; row++)
+        DCHECK(!locks_[row].load());
+
+    width_ = w;
+    height_ = h;
+    tiles_x_ = (w + TileSide - 1) / TileSide;
+    tiles_count_ = tiles_x_ * ((h + TileSide - 1) / TileSide);
+
+    // Номера плиток теперь означают другие места экрана: ни одна не считается очищенной
+    for (auto& epoch : tile_epochs_)
+        epoch.store(NeverEpoch, std::memory_order_relaxed);
+    std::fill(tile_clean_.begin(), tile_clean_.end(), 0);
 }
 
 void ScreenBuffer::Clear()
@@ -42,9 +282,284 @@ void ScreenBuffer::Clear()
     for (size_t row = 0; row < height_; row++)
         DCHECK(!locks_[row].load());
 
-    for (size_t i = 0; i < width_*height_; i++)
-        z_buffer_[i] = -std::numeric_limits<float>::max();
-    memset(pixels_, 0, width_*height_*sizeof(Color));
+    if (clear_mode_ == ClearMode::Lazy)
+        frame_++; // Все плитки с меньшим номером становятся грязными
+    else
+        ClearPart(0, 1);
+}
+
+void ScreenBuffer::ClearPart(size_t part, size_t parts)
+{
+    DCHECK(clear_mode_ == ClearMode::Eager && part < parts);
+
+    if (layout_ == Layout::Tiled)
+    {
+        for (size_t t = tiles_count_*part/parts; t < tiles_count_*(part+1)/parts; t++)
+        {
+            fill_colors_(tiles_[t].pixels, TilePixels, Color());
+            fill_z_(tiles_[t].z, TilePixels, ClearZ);
+        }
+    }
+    else
+    {
+        size_t const first = width_ * (height_*part/parts);
+        size_t const count = width_ * (height_*(part+1)/parts) - first;
+        fill_colors_(pixels_ + first, count, Color());
+        fill_z_(z_buffer_ + first, count, ClearZ);
+    }
+    _mm_sfence(); // Non-temporal записи должны стать видны до синхронизации с другими потоками
+}
+
+void ScreenBuffer::ClearRect(const ScreenRect& rect)
+{
+    for (size_t row = 0; row < height_; row++)
+        DCHECK(!locks_[row].load());
+    if (rect.IsEmpty())
+        return;
+    DCHECK(rect.mins.x >= 0 && rect.mins.y >= 0 &&
+           static_cast<size_t>(rect.maxs.x) < width_ && static_cast<size_t>(rect.maxs.y) < height_);
+
+    size_t const x0 = rect.mins.x;
+    size_t const x1 = rect.maxs.x + 1;
+    for (size_t y = rect.mins.y; y <= static_cast<size_t>(rect.maxs.y); y++)
+    {
+        if (layout_ == Layout::Linear)
+        {
+            std::fill(pixels_ + y*width_ + x0, pixels_ + y*width_ + x1, Color());
+            std::fill(z_buffer_ + y*width_ + x0, z_buffer_ + y*width_ + x1, ClearZ);
+            continue;
+        }
+
+        Tile* row_tiles = tiles_ + (y / TileSide) * tiles_x_;
+        size_t const row_in_tile = (y % TileSide) * TileSide;
+        for (size_t x = x0; x < x1; x++)
+        {
+            row_tiles[x / TileSide].pixels[row_in_tile + x % TileSide] = Color();
+            row_tiles[x / TileSide].z[row_in_tile + x % TileSide] = ClearZ;
+        }
+    }
+}
+
+void ScreenBuffer::LoadPart(const Color* colors, const float* z, const std::vector<uint8_t>& clear_tiles,
+                            size_t part, size_t parts)
+{
+    DCHECK(part < parts && clear_tiles.size() == tiles_count_);
+
+    size_t const tiles_y = tiles_count_ / tiles_x_;
+    for (size_t ty = tiles_y*part/parts; ty < tiles_y*(part+1)/parts; ty++)
+    {
+        size_t const y0 = ty * TileSide;
+        size_t const y1 = std::min(y0 + TileSide, height_);
+        for (size_t tx = 0; tx < tiles_x_; tx++)
+        {
+            size_t const tile = ty*tiles_x_ + tx;
+            size_t const x0 = tx * TileSide;
+            size_t const x1 = std::min(x0 + TileSide, width_);
+            if (clear_mode_ == ClearMode::Lazy)
+            {
+                tile_epochs_[tile].store(frame_, std::memory_order_relaxed); // Растеризация начнется после Join
+                tile_clean_[tile] = 0;
+            }
+
+            if (clear_tiles[tile])
+            {
+                ClearTile(tile);
+                continue;
+            }
+            for (size_t y = y0; y < y1; y++)
+            {
+                if (layout_ == Layout::Tiled)
+                {
+                    memcpy(tiles_[tile].pixels + (y % TileSide)*TileSide, colors + y*width_ + x0, (x1 - x0)*sizeof(Color));
+                    memcpy(tiles_[tile].z + (y % TileSide)*TileSide, z + y*width_ + x0, (x1 - x0)*sizeof(float));
+                }
+                else
+                {
+                    memcpy(pixels_ + y*width_ + x0, colors + y*width_ + x0, (x1 - x0)*sizeof(Color));
+                    memcpy(z_buffer_ + y*width_ + x0, z + y*width_ + x0, (x1 - x0)*sizeof(float));
+                }
+            }
+        }
+    }
+}
+
+void ScreenBuffer::CompositePart(const std::vector<const ScreenBuffer*>& sources, size_t part, size_t parts)
+{
+    DCHECK(part < parts);
+    DCHECK(std::all_of(sources.begin(), sources.end(), [this](const ScreenBuffer* src)
+                       {
+                           return src->width_ == width_ && src->height_ == height_ && src->clear_mode_ == ClearMode::Lazy;
+                       }));
+
+    // По плитке за раз: она остается в кэше, пока в нее сводятся все источники
+    size_t const tiles_y = tiles_count_ / tiles_x_;
+    for (size_t tile = tiles_y*part/parts * tiles_x_; tile < tiles_y*(part+1)/parts * tiles_x_; tile++)
+    {
+        auto const touched = [tile](const ScreenBuffer* src) { return src->TileTouched(tile); };
+        if (std::none_of(sources.begin(), sources.end(), touched))
+            continue;
+        TileSpan const dst = GetTile(tile);
+        for (const ScreenBuffer* src : sources)
+        {
+            if (!touched(src))
+                continue;
+            TileSpan const from = src->TileAt(tile);
+            for (size_t y = 0; y < dst.height; y++)
+                composite_row_(dst.pixels + y*dst.stride, dst.z + y*dst.stride,
+                               from.pixels + y*from.stride, from.z + y*from.stride, dst.width);
+        }
+    }
+}
+
+ScreenBuffer::TileSpan ScreenBuffer::GetTile(size_t tile)
+{
+    DCHECK(tile < tiles_count_);
+    if (clear_mode_ == ClearMode::Lazy && tile_epochs_[tile].load(std::memory_order_acquire) < frame_)
+        LazyClearTile(tile);
+    return TileAt(tile);
+}
+
+bool ScreenBuffer::TileTouched(size_t tile) const
+{
+    return clear_mode_ != ClearMode::Lazy || tile_epochs_[tile].load(std::memory_order_acquire) >= frame_;
+}
+
+ScreenBuffer::TileSpan ScreenBuffer::TileAt(size_t tile) const
+{
+    DCHECK(tile < tiles_count_);
+    TileSpan span;
+    span.x0 = (tile % tiles_x_) * TileSide;
+    span.y0 = (tile / tiles_x_) * TileSide;
+    span.width = std::min(span.x0 + TileSide, width_) - span.x0;
+    span.height = std::min(span.y0 + TileSide, height_) - span.y0;
+    if (layout_ == Layout::Tiled)
+    {
+        span.stride = TileSide;
+        span.pixels = tiles_[tile].pixels;
+        span.z = tiles_[tile].z;
+    }
+    else
+    {
+        span.stride = width_;
+        span.pixels = pixels_ + span.y0*width_ + span.x0;
+        span.z = z_buffer_ + span.y0*width_ + span.x0;
+    }
+    return span;
+}
+
+#ifdef LOCK_STATS_ENABLED
+LockStats ScreenBuffer::TakeRowLockStats(size_t& hottest_row, LockStats& hottest)
+{
+    LockStats total;
+    hottest_row = 0;
+    hottest = LockStats();
+    for (size_t row = 0; row < height_; row++)
+    {
+        total += row_lock_stats_[row];
+        if (row_lock_stats_[row].wait_ns > hottest.wait_ns)
+        {
+            hottest = row_lock_stats_[row];
+            hottest_row = row;
+        }
+        row_lock_stats_[row] = LockStats();
+    }
+    return total;
+}
+#endif
+
+const Color* ScreenBuffer::GetPixels() const
+{
+    PROFILE_SCOPE("resolve"); // Для Linear + Eager - пустой
+
+    ResolveLazy();
+    if (layout_ == Layout::Tiled)
+        Detile();
+    return pixels_;
+}
+
+const float* ScreenBuffer::GetDepth() const
+{
+    ResolveLazy();
+    if (layout_ == Layout::Linear)
+        return z_buffer_;
+
+    if (!z_detiled_)
+    {
+        z_detiled_ = static_cast<float*>(_mm_malloc(max_width_*max_height_*sizeof(float), 64));
+        CHECK(z_detiled_);
+    }
+    for (size_t row = 0; row < height_; row++)
+    {
+        const Tile* row_tiles = tiles_ + (row / TileSide) * tiles_x_;
+        const size_t row_in_tile = (row % TileSide) * TileSide;
+        for (size_t x = 0; x < width_; x += TileSide)
+            memcpy(z_detiled_ + row*width_ + x, row_tiles[x / TileSide].z + row_in_tile,
+                   (std::min(x + TileSide, width_) - x)*sizeof(float));
+    }
+    return z_detiled_;
+}
+
+void ScreenBuffer::ResolveLazy() const
+{
+    if (clear_mode_ != ClearMode::Lazy)
+        return;
+    // Эпоха не меняется: если к плитке еще обратятся в этом кадре, LazyClearTile снимет отметку о чистоте
+    for (size_t t = 0; t < tiles_count_; t++)
+        if (tile_epochs_[t].load(std::memory_order_relaxed) < frame_ && !tile_clean_[t])
+        {
+            ClearTile(t);
+            tile_clean_[t] = 1;
+        }
+}
+
+void ScreenBuffer::ClearTile(size_t tile) const
+{
+    if (layout_ == Layout::Tiled)
+    {
+        std::fill(std::begin(tiles_[tile].pixels), std::end(tiles_[tile].pixels), Color());
+        std::fill(std::begin(tiles_[tile].z), std::end(tiles_[tile].z), ClearZ);
+        return;
+    }
+
+    size_t const x0 = (tile % tiles_x_) * TileSide;
+    size_t const y0 = (tile / tiles_x_) * TileSide;
+    size_t const x1 = std::min(x0 + TileSide, width_);
+    size_t const y1 = std::min(y0 + TileSide, height_);
+    for (size_t y = y0; y < y1; y++)
+    {
+        std::fill(pixels_ + y*width_ + x0, pixels_ + y*width_ + x1, Color());
+        std::fill(z_buffer_ + y*width_ + x0, z_buffer_ + y*width_ + x1, ClearZ);
+    }
+}
+
+void ScreenBuffer::LazyClearTile(size_t tile)
+{
+    // Плитку очищает тот, кто первым пометил ее ClearingEpoch. Строки плитки при этом
+    // могут быть заблокированы другими потоками - но они сами ждут здесь же, пока плитка не будет готова
+    std::atomic<uint64_t>& epoch = tile_epochs_[tile];
+    uint64_t current = epoch.load(std::memory_order_acquire);
+    while (current < frame_)
+    {
+        if (current == ClearingEpoch)
+        {
+            std::this_thread::yield();
+            current = epoch.load(std::memory_order_acquire);
+        }
+        else if (epoch.compare_exchange_weak(current, ClearingEpoch, std::memory_order_acquire, std::memory_order_acquire))
+        {
+            if (!tile_clean_[tile]) // Чистую с прошлых кадров второй раз не пишем
+                ClearTile(tile);
+            tile_clean_[tile] = 0; // К ней обращаются - дальше она может стать грязной
+            epoch.store(frame_, std::memory_order_release);
+            return;
+        }
+    }
+}
+
+void ScreenBuffer::Detile() const
+{
+    for (size_t row = 0; row < height_; row++)
+        detile_row_(pixels_ + row*width_, tiles_ + (row / TileSide) * tiles_x_, (row % TileSide) * TileSide, width_);
 }
 
-} // namespace plane_render
\ No newline at end of file
+} // namespace plane_render
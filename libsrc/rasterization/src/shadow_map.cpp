@@ -0,0 +1,260 @@
+#include "shadow_map.hpp"
+
+#include "common/profiler.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+namespace plane_render {
+
+constexpr float ShadowMap::DepthBias;
+constexpr float ShadowMap::MaxFov;
+constexpr size_t ShadowMap::BandsPerThread;
+constexpr size_t ShadowMap::PcfRadius;
+
+namespace {
+
+constexpr size_t VerticesPerTask = 16384;
+
+} // namespace
+
+ShadowMap::ShadowMap(size_t size) :
+    size_(size),
+    inv_z_(size*size, 0.f),
+    camera_to_src_(Matrix4::Identity()),
+    light_src_(0.f, 0.f, 0.f)
+{
+    DCHECK(size > 0);
+}
+
+bool ShadowMap::Update(const std::vector<SceneObject>& objects, const FastVector3D& light_src, ThreadPool& pool)
+{
+    bool changed = !valid_ || objects_versions_.size() != objects.size() ||
+                   light_src.x != light_src_.x || light_src.y != light_src_.y || light_src.z != light_src_.z;
+    for (size_t i = 0; i < objects.size() && !changed; i++)
+        changed = objects[i].Version() != objects_versions_[i];
+    if (!changed)
+        return false;
+
+    PROFILE_SCOPE("shadow map");
+    valid_ = true;
+    light_src_ = light_src;
+    objects_versions_.resize(objects.size());
+    for (size_t i = 0; i < objects.size(); i++)
+        objects_versions_[i] = objects[i].Version();
+
+    if (!SetupLight(objects, light_src))
+    {
+        std::fill(inv_z_.begin(), inv_z_.end(), 0.f); // Нечему отбрасывать тень
+        return true;
+    }
+
+    // Вершины в координаты света - как вершинный шейдер, но всегда нулевой уровень детализации
+    light_vertices_.resize(objects.size());
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        const SceneObject& obj = objects[i];
+        VerticesVector& out = light_vertices_[i];
+        if (!obj.CastsShadows())
+        {
+            out.clear();
+            continue;
+        }
+
+        size_t const count = obj.SourceCoords().size();
+        out.resize(count, Vertex(TextureCoords{0.f, 0.f}, Vector3D{0.f, 0.f, 0.f}));
+        for (size_t begin = 0; begin < count; begin += VerticesPerTask)
+            pool.AddTask([this, &obj, &out, begin, count]()
+            {
+                light_geom_->TransformGeometry(obj.SourceCoords().data() + begin, obj.Position(), out.data() + begin,
+                                               std::min(VerticesPerTask, count - begin));
+            }, false);
+    }
+    pool.Join();
+
+    // Полосы рядов не пересекаются - пишут в карту без блокировок
+    size_t const bands = std::min(size_, std::max<size_t>(1, pool.ThreadsCount() * BandsPerThread));
+    for (size_t band = 0; band < bands; band++)
+        pool.AddTask([this, &objects, band, bands]() { RenderBand(objects, size_*band/bands, size_*(band+1)/bands); },
+                     false);
+    pool.Join();
+    return true;
+}
+
+bool ShadowMap::SetupLight(const std::vector<SceneObject>& objects, const FastVector3D& light_src)
+{
+    // Описанная сфера объединения описанных сфер
+    bool found = false;
+    FastVector3D center(0.f, 0.f, 0.f);
+    float radius = 0.f;
+    for (const SceneObject& obj : objects)
+    {
+        if (!obj.CastsShadows() || obj.LodIndices(0).empty())
+            continue;
+        FastVector3D const c = obj.BoundingCenter();
+        float const r = obj.BoundingRadius();
+        if (!found)
+        {
+            found = true;
+            center = c;
+            radius = r;
+            continue;
+        }
+
+        float const d = std::sqrt(FastVector3D(c - center).NormSq());
+        if (d + r <= radius)
+            continue;
+        if (d + radius <= r)
+        {
+            center = c;
+            radius = r;
+            continue;
+        }
+        float const new_radius = (d + r + radius) / 2.f;
+        center = center + FastVector3D(c - center) * ((new_radius - radius) / d);
+        radius = new_radius;
+    }
+    if (!found)
+    {
+        light_geom_.reset();
+        return false;
+    }
+
+    FastVector3D const to_center = center - light_src;
+    float const dist = std::sqrt(to_center.NormSq());
+    // Сфера целиком в конусе обзора (с запасом на округление пикселей), иначе - свет внутри сферы
+    float const fov = dist > radius * 1.05f ? std::min(std::asin(radius / dist) * 1.05f, MaxFov) : MaxFov;
+    float const near_plane = std::max(dist - radius, std::max(dist, radius) * 1e-3f);
+    float const far_plane = std::max(dist + radius, near_plane * 2.f);
+
+    FastVector3D const at = dist > GraphicsEps ? center : light_src + FastVector3D(0.f, 0.f, -1.f);
+    bool const vertical = dist > GraphicsEps && std::abs(to_center.y) > 0.99f * dist;
+    Vector3D const up = vertical ? Vector3D{1.f, 0.f, 0.f} : Vector3D{0.f, 1.f, 0.f};
+
+    light_geom_ = std::make_shared<RenderingGeometry>(size_, size_, near_plane, far_plane, fov, up);
+    light_geom_->LookAt(light_src.ToVector3D(), at.ToVector3D());
+    return true;
+}
+
+void ShadowMap::RenderBand(const std::vector<SceneObject>& objects, size_t y0, size_t y1)
+{
+    std::fill(inv_z_.begin() + y0*size_, inv_z_.begin() + y1*size_, 0.f);
+
+    float const last_x = static_cast<float>(size_ - 1);
+    float const band_min_y = static_cast<float>(y0);
+    float const band_max_y = static_cast<float>(y1 - 1);
+    for (size_t i = 0; i < objects.size(); i++)
+    {
+        if (!objects[i].CastsShadows())
+            continue;
+        const IndicesList& indices = objects[i].LodIndices(0);
+        const VerticesVector& vertices = light_vertices_[i];
+        for (size_t t = 0; t + 2 < indices.size(); t += 3)
+        {
+            const Vertex& A = vertices[indices[t]];
+            const Vertex& B = vertices[indices[t + 1]];
+            const Vertex& C = vertices[indices[t + 2]];
+            // Как в основном растеризаторе: треугольники, задевающие плоскость света, не рисуются
+            if (A.vertex_coords.z > -GraphicsEps || B.vertex_coords.z > -GraphicsEps || C.vertex_coords.z > -GraphicsEps)
+                continue;
+
+            // Дешевая проверка до TriangleSetup: большинство треугольников не задевают полосу
+            if (std::max({A.pixel_pos.y, B.pixel_pos.y, C.pixel_pos.y}) < band_min_y ||
+                std::min({A.pixel_pos.y, B.pixel_pos.y, C.pixel_pos.y}) > band_max_y ||
+                std::max({A.pixel_pos.x, B.pixel_pos.x, C.pixel_pos.x}) < 0.f ||
+                std::min({A.pixel_pos.x, B.pixel_pos.x, C.pixel_pos.x}) > last_x)
+                continue;
+
+            TriangleSetup setup(A, B, C);
+            if (setup.IsValid())
+                RasterizeDepth(setup, y0, y1);
+        }
+    }
+}
+
+void ShadowMap::RasterizeDepth(const TriangleSetup& setup, size_t y0, size_t y1)
+{
+    PixelPoint const mins = { std::max<ScreenDimension>(setup.mins.x, 0),
+                              std::max(setup.mins.y, static_cast<ScreenDimension>(y0)) };
+    PixelPoint const maxs = { std::min(setup.maxs.x, static_cast<ScreenDimension>(size_ - 1)),
+                              std::min(setup.maxs.y, static_cast<ScreenDimension>(y1 - 1)) };
+    if (mins.x > maxs.x || mins.y > maxs.y)
+        return;
+
+    // 1/z линейна по экрану: в начале покрытой части ряда - по реберным функциям, дальше - приращением по x
+    const auto& edges = setup.edges;
+    double const inv_area = 1.0 / setup.area;
+    double iz[3];
+    for (size_t i = 0; i < 3; i++)
+        iz[i] = 1.0 / setup.v[i]->vertex_coords.z;
+    float const step_x = static_cast<float>((edges[0].step_x*iz[0] + edges[1].step_x*iz[1] + edges[2].step_x*iz[2]) * inv_area);
+
+    int64_t row_w[3];
+    for (size_t i = 0; i < 3; i++)
+        row_w[i] = edges[i].At(mins.x, mins.y) + edges[i].bias;
+
+    for (ScreenDimension y_dim = mins.y; y_dim <= maxs.y; y_dim++)
+    {
+        int64_t w0 = row_w[0];
+        int64_t w1 = row_w[1];
+        int64_t w2 = row_w[2];
+        row_w[0] += edges[0].step_y;
+        row_w[1] += edges[1].step_y;
+        row_w[2] += edges[2].step_y;
+
+        float* row = inv_z_.data() + static_cast<size_t>(y_dim)*size_;
+        bool was_pixels = false;
+        float inv = 0.f;
+        for (ScreenDimension x_dim = mins.x; x_dim <= maxs.x;
+             x_dim++, w0 += edges[0].step_x, w1 += edges[1].step_x, w2 += edges[2].step_x)
+        {
+            if ((w0 | w1 | w2) < 0)
+            {
+                if (!was_pixels)
+                    continue;
+                else
+                    break; // Покрытая часть ряда закончилась
+            }
+
+            if (!was_pixels)
+            {
+                was_pixels = true;
+                inv = static_cast<float>(((w0 - edges[0].bias)*iz[0] + (w1 - edges[1].bias)*iz[1] +
+                                          (w2 - edges[2].bias)*iz[2]) * inv_area);
+            }
+            else
+                inv += step_x;
+
+            if (inv < row[x_dim]) // z < 0: ближе к свету - меньше 1/z, пустое - 0
+                row[x_dim] = inv;
+        }
+    }
+}
+
+float ShadowMap::Visibility(const FastVector3D& camera_coords) const
+{
+    if (!light_geom_)
+        return 1.f;
+
+    Vector4D const src = camera_to_src_ * Vector4D(camera_coords.x, camera_coords.y, camera_coords.z, 1.f);
+    Vertex v(_mm_setzero_ps(), _mm_setzero_ps(), _mm_setzero_ps());
+    light_geom_->TransformGeometry(src, v);
+    float const z = v.vertex_coords.z;
+    if (!(z <= -GraphicsEps))
+        return 1.f; // За светом
+
+    // В тени - если заслоняющее ближе к свету больше чем на DepthBias от расстояния
+    float const threshold = (1.f / z) * (1.f + DepthBias);
+    long const cx = std::lround(v.pixel_pos.x);
+    long const cy = std::lround(v.pixel_pos.y);
+    long const side = static_cast<long>(size_);
+    long const r = static_cast<long>(PcfRadius);
+    size_t lit = 0;
+    for (long y = cy - r; y <= cy + r; y++)
+     for (long x = cx - r; x <= cx + r; x++)
+         if (x < 0 || y < 0 || x >= side || y >= side || !(inv_z_[y*size_ + x] < threshold))
+             lit++;
+    return static_cast<float>(lit) / ((2*PcfRadius + 1) * (2*PcfRadius + 1));
+}
+
+} // namespace plane_render
@@ -0,0 +1,132 @@
+#include "shadow_pass.hpp"
+
+#include "common/profiler.hpp"
+
+#include <cmath>
+#include <limits>
+
+namespace plane_render {
+
+constexpr float ShadowPass::OffsetPixels;
+
+ShadowPass::ShadowPass(const RenderingGeometryConstPtr& geom, float shadow_factor) :
+    FullScreenPass(geom),
+    shadow_factor_(shadow_factor),
+    view_to_src_(Matrix4::Identity()),
+    rays_(0)
+{
+}
+
+void ShadowPass::UpdateObjects(const std::vector<SceneObject>& objects, ThreadPool& pool)
+{
+    // SetCastsShadows и SetReceivesShadows меняют версию объекта - смена флагов тоже пересобирает Bvh
+    bool changed = !bvh_ || objects_versions_.size() != objects.size();
+    for (size_t i = 0; i < objects.size() && !changed; i++)
+        changed = objects[i].Version() != objects_versions_[i];
+    if (!changed)
+        return;
+
+    PROFILE_SCOPE("shadow bvh");
+    bvh_.reset(new Bvh(objects, pool, [&objects](size_t i) { return objects[i].CastsShadows(); }));
+    auto const non_receiver = [&objects](size_t i) { return !objects[i].ReceivesShadows(); };
+    non_receivers_.reset();
+    for (size_t i = 0; i < objects.size() && !non_receivers_; i++)
+        if (non_receiver(i))
+            non_receivers_.reset(new Bvh(objects, pool, non_receiver));
+    objects_versions_.resize(objects.size());
+    for (size_t i = 0; i < objects.size(); i++)
+        objects_versions_[i] = objects[i].Version();
+}
+
+void ShadowPass::BeginFrame()
+{
+    DCHECK(bvh_); // Нужен UpdateObjects до кадра
+
+    // Как в Reprojector::SplatPart: x = (px - cx) / half_w * tan(fov) * z, y = (py - cy) / half_h * tan(fov) / ratio * z
+    const RenderingGeometry& geom = GetGeom();
+    float const tan_fov = std::tan(geom.GetFov());
+    float const half_w = geom.Width() / 2.f;
+    float const half_h = geom.Height() / 2.f;
+    center_x_ = half_w - 0.5f;
+    center_y_ = half_h - 0.5f;
+    to_view_x_ = tan_fov / half_w;
+    to_view_y_ = tan_fov / half_h / geom.GetRatio();
+    view_to_src_ = InverseRigid(geom.ViewMatrix());
+    camera_src_ = geom.CameraPosSrc();
+    rays_.store(0, std::memory_order_relaxed);
+}
+
+void ShadowPass::ProcessTile(const ScreenBuffer::TileSpan& span)
+{
+    const RenderingGeometry& geom = GetGeom();
+    FastVector3D const light = geom.LightPos();
+    FastVector3D const light_src = geom.LightPosSrc();
+    size_t rays = 0;
+
+    // Разность с соседом по оси (dx, dy) внутри плитки: из двух соседей - более близкий по глубине.
+    // false - если непустых соседей нет (плитка в пиксель шириной, одиночный пиксель объекта)
+    auto const neighbour_delta = [this, &span](size_t x, size_t y, int dx, int dy, const FastVector3D& pos,
+                                               FastVector3D& delta)
+    {
+        float best = std::numeric_limits<float>::max();
+        for (int sign = 1; sign >= -1; sign -= 2)
+        {
+            long const nx = static_cast<long>(x) + sign*dx;
+            long const ny = static_cast<long>(y) + sign*dy;
+            if (nx < 0 || ny < 0 || nx >= static_cast<long>(span.width) || ny >= static_cast<long>(span.height))
+                continue;
+            float const z = span.Z(nx, ny);
+            if (z == ScreenBuffer::ClearZ || std::abs(z - pos.z) >= best)
+                continue;
+            best = std::abs(z - pos.z);
+            delta = (ViewPosition(span.x0 + nx, span.y0 + ny, z) - pos) * static_cast<float>(sign);
+        }
+        return best != std::numeric_limits<float>::max();
+    };
+
+    for (size_t y = 0; y < span.height; y++)
+     for (size_t x = 0; x < span.width; x++)
+     {
+         float const z = span.Z(x, y);
+         if (z == ScreenBuffer::ClearZ)
+             continue; // Пусто - не затеняем
+
+         FastVector3D const pos = ViewPosition(span.x0 + x, span.y0 + y, z);
+         if (non_receivers_)
+         {
+             Vector4D const pos4 = view_to_src_ * Vector4D(pos.x, pos.y, pos.z, 1.f);
+             FastVector3D const pos_src(pos4.x, pos4.y, pos4.z);
+             if (non_receivers_->Occluded(camera_src_, pos_src - camera_src_, 0.f, 1.f + OffsetPixels * to_view_x_))
+                 continue; // Пиксель объекта, который тени не принимает
+         }
+
+         FastVector3D to_camera = FastVector3D(pos * (-1.f)).Normalized();
+         FastVector3D normal = to_camera;
+         FastVector3D du(0.f, 0.f, 0.f);
+         FastVector3D dv(0.f, 0.f, 0.f);
+         if (neighbour_delta(x, y, 1, 0, pos, du) && neighbour_delta(x, y, 0, 1, pos, dv))
+         {
+             FastVector3D const cross = du.Cross(dv);
+             if (cross.NormSq() > 0.f)
+                 normal = cross.Normalized();
+             if (normal.Dot(to_camera) < 0.f) // Видимая сторона - к камере
+                 normal = normal * (-1.f);
+         }
+
+         if (normal.Dot(light - pos) > 0.f)
+         {
+             // Начало луча - над поверхностью на несколько пикселей (на этой глубине), в исходные координаты
+             float const offset = OffsetPixels * to_view_x_ * std::abs(z);
+             FastVector3D const origin_view = pos + normal*offset;
+             Vector4D const origin4 = view_to_src_ * Vector4D(origin_view.x, origin_view.y, origin_view.z, 1.f);
+             FastVector3D const origin(origin4.x, origin4.y, origin4.z);
+             rays++;
+             if (!bvh_->Occluded(origin, light_src - origin, 0.f, 1.f))
+                 continue;
+         }
+         span.Pixel(x, y) = span.Pixel(x, y) * shadow_factor_;
+     }
+    rays_.fetch_add(rays, std::memory_order_relaxed);
+}
+
+} // namespace plane_render
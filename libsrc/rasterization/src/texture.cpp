@@ -74,14 +74,16 @@ void read_ppm_header(FILE *f, int *img_xdim, int *img_ydim, int *img_colors, int
 
 /* read_ppm_data:
  * Read the data contents of a PPM (portable pix map) file.
+ * At most max_values ints are written to img_in (trailing bytes are ignored).
  */
-void read_ppm_data(FILE *f, int *img_in, int is_ascii)
+void read_ppm_data(FILE *f, int *img_in, size_t max_values, int is_ascii)
 {
-  int i=0, c;
+  size_t i=0;
+  int c;
   int r_val, g_val, b_val;
     
   /* Read the rest of the PPM file. */
-  while ((c = fgetc(f)) != EOF) {
+  while (i + 3 <= max_values && (c = fgetc(f)) != EOF) {
     ungetc(c, f);
     if (is_ascii == 1) {
       if (fscanf(f, "%d %d %d", &r_val, &g_val, &b_val) != 3) return;
@@ -121,7 +123,7 @@ void Texture::Load(const std::string& fname, size_t block_side)
     CHECK(img_colors == 255);
     CHECK(is_ascii != 1); // binary file
     int* texture_tmp = new int[width_*height_*3];
-    read_ppm_data(ppm_file, texture_tmp, is_ascii);
+    read_ppm_data(ppm_file, texture_tmp, width_*height_*3, is_ascii);
 
     texture_ = new Color[width_*height_];
 
@@ -0,0 +1,77 @@
+#include "upscaler.hpp"
+
+#include <algorithm>
+#include <cstring>
+
+namespace plane_render {
+
+Upscaler::Upscaler(size_t out_w, size_t out_h) :
+    out_w_(out_w),
+    out_h_(out_h),
+    columns_(out_w),
+    weights_(out_w),
+    pixels_(out_w*out_h)
+{}
+
+void Upscaler::Source(size_t i, size_t out_size, size_t src_size, size_t& first, int& weight)
+{
+    float const u = std::min(std::max((i + 0.5f) * src_size / out_size - 0.5f, 0.f), static_cast<float>(src_size - 1));
+    first = static_cast<size_t>(u);
+    weight = static_cast<int>((u - first) * 256.f + 0.5f);
+    if (first + 1 == src_size) // Последний - как второй сосед с полным весом: пара соседей не выходит за ряд
+    {
+        first--;
+        weight = 256;
+    }
+}
+
+void Upscaler::SetSourceSize(size_t w, size_t h)
+{
+    CHECK(w >= 2 && h >= 2 && w <= out_w_ && h <= out_h_);
+    if (w == src_w_ && h == src_h_)
+        return;
+
+    src_w_ = w;
+    src_h_ = h;
+    for (size_t x = 0; x < out_w_; x++)
+    {
+        size_t first;
+        int weight;
+        Source(x, out_w_, src_w_, first, weight);
+        columns_[x] = static_cast<uint32_t>(first);
+        std::fill(weights_[x].w, weights_[x].w + 4, static_cast<int16_t>(256 - weight));
+        std::fill(weights_[x].w + 4, weights_[x].w + 8, static_cast<int16_t>(weight));
+    }
+}
+
+void Upscaler::UpscalePart(const Color* src, size_t part, size_t parts)
+{
+    DCHECK(src_w_ > 0 && part < parts);
+    __m128i const round = _mm_set1_epi16(128);
+    for (size_t y = out_h_*part/parts; y < out_h_*(part+1)/parts; y++)
+    {
+        size_t first;
+        int weight;
+        Source(y, out_h_, src_h_, first, weight);
+        const Color* top = src + first*src_w_;
+        const Color* bottom = top + src_w_;
+        __m128i const wy0 = _mm_set1_epi16(static_cast<short>(256 - weight));
+        __m128i const wy1 = _mm_set1_epi16(static_cast<short>(weight));
+
+        // c*w <= 255*256 и сумма весов 256: все суммы помещаются в беззнаковые 16 бит
+        Color* dst = pixels_.data() + y*out_w_;
+        for (size_t x = 0; x < out_w_; x++)
+        {
+            size_t const c = columns_[x];
+            __m128i const t = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(top + c)));
+            __m128i const b = _mm_cvtepu8_epi16(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(bottom + c)));
+            __m128i v = _mm_add_epi16(_mm_add_epi16(_mm_mullo_epi16(t, wy0), _mm_mullo_epi16(b, wy1)), round);
+            v = _mm_mullo_epi16(_mm_srli_epi16(v, 8), _mm_load_si128(reinterpret_cast<const __m128i*>(weights_[x].w)));
+            v = _mm_srli_epi16(_mm_add_epi16(_mm_add_epi16(v, _mm_srli_si128(v, 8)), round), 8);
+            int const bits = _mm_cvtsi128_si32(_mm_packus_epi16(v, v));
+            memcpy(static_cast<void*>(dst + x), &bits, sizeof(bits));
+        }
+    }
+}
+
+} // namespace plane_render
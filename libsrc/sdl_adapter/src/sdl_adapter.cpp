@@ -1,6 +1,7 @@
 #include "sdl_adapter.hpp"
 
 #include "common/logger.hpp"
+#include "common/profiler.hpp"
 #include "SDL.h"
 
 #define CHECK_SDL(x) CHECK(x) << std::string("SDL error: ") + SDL_GetError()
@@ -31,6 +32,7 @@ void SDLAdapter::DrawScreen()
 {
     provider_->Update();
 
+    PROFILE_SCOPE("present");
     int* pixels = nullptr;
     int pitch = 0;
     CHECK_SDL_NULL(SDL_LockTexture(buffer_, NULL, (void**)&pixels, &pitch));
@@ -92,6 +94,12 @@ void SDLAdapter::MessageLoop()
                     }
                     break;
 
+                case SDL_WINDOWEVENT:
+                    // Окно перекрыли и открыли: вид тот же, конвейер отдаст кадр из кэша
+                    if (e.window.event == SDL_WINDOWEVENT_EXPOSED)
+                        need_redraw = true;
+                    break;
+
                 case SDL_MOUSEWHEEL:
                     if (e.wheel.y > 0)
                         provider_->MoveCam(0, 0, -mouse_roll_speed);
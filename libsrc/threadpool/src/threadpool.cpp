@@ -1,20 +1,57 @@
 ﻿#include "threadpool.hpp"
 
+#include "common/logger.hpp"
+#include "common/profiler.hpp"
+
+#include <algorithm>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
 namespace plane_render {
 
-ThreadPool::ThreadPool(size_t n_threads) :
-    task_mutices_(n_threads)
+ThreadPool::ThreadPool(size_t n_threads, bool pin_threads) :
+    counters_(n_threads)
 {
     for (size_t i = 0; i < n_threads; i++)
     {
-        threads_.emplace_back(std::bind(&ThreadPool::ThreadFunction, this, i));
+        threads_.emplace_back(std::bind(&ThreadPool::ThreadFunction, this, i, pin_threads));
+    }
+}
+
+bool ThreadPool::PinCurrentThread(size_t cpu)
+{
+#ifdef __linux__
+    size_t const cpus = std::max(std::thread::hardware_concurrency(), 1u);
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu % cpus, &set);
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpu;
+    return false;
+#endif
+}
+
+ThreadPool::~ThreadPool()
+{
+    Join();
+    {
+        std::lock_guard<std::mutex> lock(new_tasks_mutex_);
+        stop_ = true;
     }
+    new_tasks_.notify_all();
+
+    for (auto& th : threads_)
+        th.join();
 }
 
 void ThreadPool::AddTask(const FunctionType&& task, bool join)
 {
     tasks_->emplace_back(std::move(task), false);
-    FinishAddTasks(join);
+    FinishAddTasks(1, join);
 }
 
 void ThreadPool::AddTasks(const std::vector<FunctionType>& tasks, bool join)
@@ -23,46 +60,71 @@ void ThreadPool::AddTasks(const std::vector<FunctionType>& tasks, bool join)
     {
         tasks_->emplace_back(std::move(t), false);
     }
-    FinishAddTasks(join);
+    FinishAddTasks(tasks.size(), join);
 }
 
-void ThreadPool::FinishAddTasks(bool join)
+void ThreadPool::FinishAddTasks(size_t added, bool join)
 {
+    {
+        std::lock_guard<std::mutex> lock(new_tasks_mutex_);
+        free_tasks_ += added;
+    }
     new_tasks_.notify_all();
     if (join)
         Join();
 }
 
 void ThreadPool::Join()
-{   
-    if (tasks_->empty())
-        return;
+{
+    std::unique_lock<std::mutex> lock_cv(cv_join_mutex_);
+    cv_join_.wait(lock_cv, [this]() { return tasks_->empty(); });
+}
 
-    while (true)
+std::vector<ThreadPool::WorkerStats> ThreadPool::GetWorkerStats() const
+{
+    std::vector<WorkerStats> stats(counters_.size());
+    for (size_t i = 0; i < counters_.size(); i++)
     {
-        std::unique_lock<std::mutex> lock_cv(cv_join_mutex_);
-        cv_join_.wait(lock_cv);
+        stats[i].busy_ns = counters_[i].busy_ns.load(std::memory_order_relaxed);
+        stats[i].idle_ns = counters_[i].idle_ns.load(std::memory_order_relaxed);
+        stats[i].tasks = counters_[i].tasks.load(std::memory_order_relaxed);
+    }
+    return stats;
+}
 
-        if (tasks_->size() == 0)
-            return;
+void ThreadPool::ResetWorkerStats()
+{
+    for (auto& c : counters_)
+    {
+        c.busy_ns.store(0, std::memory_order_relaxed);
+        c.idle_ns.store(0, std::memory_order_relaxed);
+        c.tasks.store(0, std::memory_order_relaxed);
     }
 }
 
-void ThreadPool::ThreadFunction(size_t id)
+void ThreadPool::ThreadFunction(size_t id, bool pin)
 {
+    if (pin && !PinCurrentThread(id + 1))
+        LOG(WARNING) << "Can't pin worker " << id;
+
+    Profiler& profiler = Profiler::Instance();
+    Profiler::SetThreadName("worker " + std::to_string(id));
+    WorkerCounters& counters = counters_[id];
+
     while (true)
     {
-        // Ждем пробуждения (и сразу освобождаем мьютекс)
-        if (tasks_->empty())
+        uint64_t const idle_start = profiler.NowNs();
+
+        // Ждем пробуждения и сразу резервируем за собой одно задание
         {
-            std::unique_lock<std::mutex> cv_lock(task_mutices_[id]);
-            new_tasks_.wait(cv_lock);
+            std::unique_lock<std::mutex> cv_lock(new_tasks_mutex_);
+            new_tasks_.wait(cv_lock, [this]() { return free_tasks_ > 0 || stop_; });
+            if (free_tasks_ == 0)
+                return; // stop_: заданий больше не будет
+            free_tasks_--;
         }
 
         auto accessor = tasks_.GetAccessor();
-        if (accessor->size() == 0)
-            continue; // Пока нет заданий, случайное пробуждение
-
         auto tasks_it = accessor->begin();
         for (; tasks_it != accessor->end(); tasks_it++)
         {
@@ -72,12 +134,22 @@ void ThreadPool::ThreadFunction(size_t id)
                 break;
             }
         }
-        if (tasks_it == accessor->end())
-            continue; // Все задания разобраны, ждем новых
+        DCHECK(tasks_it != accessor->end()); // Задание зарезервировано - оно обязано быть в списке
         accessor.Release(); // Снимаем блокировку
 
         // Выполняем функцию
+        uint64_t const busy_start = profiler.NowNs();
         tasks_it->first();
+        uint64_t const busy_end = profiler.NowNs();
+
+        counters.idle_ns.fetch_add(busy_start - idle_start, std::memory_order_relaxed);
+        counters.busy_ns.fetch_add(busy_end - busy_start, std::memory_order_relaxed);
+        counters.tasks.fetch_add(1, std::memory_order_relaxed);
+        if (profiler.IsEnabled())
+        {
+            profiler.Record("idle", idle_start, busy_start);
+            profiler.Record("task", busy_start, busy_end);
+        }
 
         // Удаляем выполненное задание
         auto accessor2 = tasks_.GetAccessor(); // Нужен новый акцессор
@@ -87,6 +159,10 @@ void ThreadPool::ThreadFunction(size_t id)
         if (accessor2->size() == 0) // Все выполнили: отпускаем очередь и продолжаем
         {
             accessor2.Release();
+            {
+                // Пустой захват: Join не должен пропустить уведомление между проверкой и ожиданием
+                std::lock_guard<std::mutex> lock(cv_join_mutex_);
+            }
             cv_join_.notify_all();
         }
         else // Просто отпускаем очередь
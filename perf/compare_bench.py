@@ -0,0 +1,36 @@
+#!/usr/bin/env python
+
+# Сравнивает два JSON от benchmark_suite (например, до и после коммита).
+# Регрессия - если 95% доверительные интервалы среднего не пересекаются и новое время больше
+
+import json
+import sys
+
+if len(sys.argv) < 3:
+    sys.exit("usage: compare_bench.py <old.json> <new.json> [ <stage> ]")
+
+stage = sys.argv[3] if len(sys.argv) > 3 else "total"
+
+def load(filename):
+    with open(filename, "r") as f:
+        data = json.load(f)
+    return {(r["scene"], r["width"], r["height"], r["threads"]): r["stages"][stage] for r in data["results"]}
+
+old = load(sys.argv[1])
+new = load(sys.argv[2])
+
+regressions = 0
+print("scene\tresolution\tthreads\told mean\tnew mean\tchange\tverdict")
+for key in sorted(set(old) & set(new)):
+    o, n = old[key], new[key]
+    change = (n["mean"] / o["mean"] - 1) * 100 if o["mean"] > 0 else 0
+    if n["mean"] - n["ci95"] > o["mean"] + o["ci95"]:
+        verdict = "SLOWER"
+        regressions += 1
+    elif n["mean"] + n["ci95"] < o["mean"] - o["ci95"]:
+        verdict = "faster"
+    else:
+        verdict = "same"
+    print("%s\t%dx%d\t%d\t%.3f\t%.3f\t%+.1f%%\t%s" % (key[0], key[1], key[2], key[3], o["mean"], n["mean"], change, verdict))
+
+sys.exit(1 if regressions else 0)
@@ -0,0 +1,108 @@
+#include <iostream>
+#include <algorithm>
+#include <numeric>
+#include <chrono>
+#include <vector>
+
+#include "rasterization/fragment_shader.hpp"
+#include "rasterization/rasterizer.hpp"
+
+// Микро-бенчмарк растеризатора: один поток, без пула потоков и SDL.
+// По умолчанию (cat2.obj в 320x180) почти все треугольники занимают 1-4 пикселя,
+// поэтому сравниваем растеризацию с отдельным путем для маленьких треугольников и без него.
+// Затем - построчное и плиточное расположение буферов цвета и глубины, полная и ленивая очистка
+
+using namespace plane_render;
+
+namespace {
+
+constexpr int Angles = 64; // Ракурсов на облет
+constexpr float OrbitRadius = 2.5f; // В радиусах описанной сферы
+
+// Для каждого ракурса - среднее время Clear + Rasterize + GetPixels, мс
+std::vector<double> RunSweep(RenderingGeometry& geom, SceneObject& obj, Rasterizer& rasterizer, int iters)
+{
+    std::vector<double> times;
+    const FastVector3D at = obj.BoundingCenter();
+    for (int angle = 0; angle < Angles; angle++)
+    {
+        float const theta = 0.4f;
+        float const phi = 2.f / Angles * 3.1415926f * angle;
+        FastVector3D dir{std::sin(phi) * std::cos(theta), std::sin(theta), std::cos(phi) * std::cos(theta)};
+        FastVector3D campos = dir * (OrbitRadius * obj.BoundingRadius());
+        geom.LookAt(static_cast<FastVector3D>(campos + at).ToVector3D(), at.ToVector3D());
+        obj.Update();
+
+        auto const t0 = std::chrono::steady_clock::now();
+        for (int i = 0; i < iters; i++)
+        {
+            rasterizer.Clear();
+            rasterizer.Rasterize(obj, 0, obj.TrianglesCount());
+            rasterizer.GetPixels(); // Для плиточного буфера - сборка кадра
+        }
+        std::chrono::duration<double, std::milli> const dt = std::chrono::steady_clock::now() - t0;
+        times.push_back(dt.count() / iters);
+    }
+    return times;
+}
+
+double Report(const std::string& name, std::vector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    double const mean = std::accumulate(times.begin(), times.end(), 0.) / times.size();
+    std::cout << name << ": mean " << mean << "ms, median " << times[times.size() / 2]
+              << "ms, 99% " << times[times.size() * 99 / 100] << "ms" << std::endl;
+    return mean;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ConfigureLogger("logger.conf");
+
+    if (argc < 3)
+        throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" <obj_name> <ppm_name>"
+                                                                     " [ <width> <height> <iters> ]");
+
+    int const width  = argc > 3 ? std::stoi(argv[3]) : 320;
+    int const height = argc > 4 ? std::stoi(argv[4]) : 180;
+    int const iters  = argc > 5 ? std::stoi(argv[5]) : 20;
+
+    RenderingGeometryPtr geom = std::make_shared<RenderingGeometry>(width, height, 0.1, 20, 1);
+    geom->SetLightSrcPos({1, 1, 3});
+
+    // Приводим модель к единичному радиусу
+    SceneObject obj(geom, argv[1], SceneObject::FitRadius{1.f});
+    obj.SetShaders<SceneObject::VertexShader, FragmentShader>();
+    obj.GetFS()->LoadTexture(argv[2]);
+
+    Rasterizer rasterizer(geom);
+    std::cout << argv[1] << ": " << obj.TrianglesCount() << " triangles, "
+              << width << "x" << height << ", " << Angles << " angles x " << iters << " iters" << std::endl;
+
+    rasterizer.SetSmallTrianglesPath(false);
+    RunSweep(*geom, obj, rasterizer, 1); // Прогрев
+    double const general = Report("general path", RunSweep(*geom, obj, rasterizer, iters));
+
+    rasterizer.SetSmallTrianglesPath(true);
+    double const small = Report("small triangles path", RunSweep(*geom, obj, rasterizer, iters));
+
+    std::cout << "speedup: " << general / small << std::endl;
+
+    Rasterizer tiled_rasterizer(geom, ScreenBuffer::Layout::Tiled);
+    RunSweep(*geom, obj, tiled_rasterizer, 1);
+    double const tiled = Report("tiled buffers", RunSweep(*geom, obj, tiled_rasterizer, iters));
+    std::cout << "tiled vs linear: " << small / tiled << std::endl;
+
+    for (auto layout : { ScreenBuffer::Layout::Linear, ScreenBuffer::Layout::Tiled })
+    {
+        Rasterizer lazy_rasterizer(geom, layout, ScreenBuffer::ClearMode::Lazy);
+        RunSweep(*geom, obj, lazy_rasterizer, 1);
+        bool const is_tiled = layout == ScreenBuffer::Layout::Tiled;
+        double const lazy = Report(is_tiled ? "tiled buffers, lazy clear" : "lazy clear",
+                                   RunSweep(*geom, obj, lazy_rasterizer, iters));
+        std::cout << "lazy vs eager clear: " << (is_tiled ? tiled : small) / lazy << std::endl;
+    }
+    return 0;
+}
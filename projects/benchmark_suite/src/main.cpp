@@ -0,0 +1,553 @@
+#include <iostream>
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <sstream>
+#include <ctime>
+#include <cmath>
+#include <vector>
+
+#include "rasterization/fragment_shader.hpp"
+#include "rasterization/pipeline.hpp"
+#include "common/perf_counters.hpp"
+
+// Набор бенчмарков всего конвейера без SDL: фиксированные сцены, разрешения и числа потоков.
+// Камера облетает сцену за frames кадров (после warmup кадров прогрева), по кадрам собирается
+// время стадий из RasterizationPipeline::LastFrameStats. Результат - таблица в stdout и JSON,
+// который можно сравнивать между коммитами (см. perf/compare_bench.py).
+// С --counters по стадиям добавляются аппаратные счетчики (PerfCounters) в пересчете на кадр. Собираются они
+// с первого кадра прогрева (там же потоки открывают свои группы счетчиков), а суммы обнуляются на первом
+// измеряемом кадре - в результат входят только измеряемые кадры.
+// При LOCK_STATS_ENABLED (debug или cmake -DLOCK_STATS=ON) - еще ожидание на спинлоках, тоже на кадр.
+// С --shadows - гибридные тени (PipelineOptions::ray_traced_shadows): их проход - стадия passes.
+// С --shadow-map - тени картой глубины (PipelineOptions::shadow_map): свет и объекты не меняются, поэтому карта
+// рисуется один раз, в первом кадре прогрева - ее время отдельно (shadow_map_ms), выборки из нее - в стадии fs.
+// С --depth-prepass - предварительный проход глубины (PipelineOptions::depth_prepass), он входит в стадию fs.
+// С --front-to-back - растеризация от ближних объектов и кластеров к дальним (PipelineOptions::front_to_back).
+// Число фрагментов на кадр (тестов глубины прохода глубины и вызовов шейдера) пишется в JSON всегда.
+// С --occlusion - отсечение перекрытых объектов (PipelineOptions::occlusion_culling), оно входит в стадию vs,
+// среднее число скрытых за кадр - в JSON (occluded). Заслонять есть что только в сцене crowd.
+// С --meshlets - отсечение мешлетов до вершинного шейдера (PipelineOptions::meshlet_culling), у всех моделей,
+// кроме неба (его видно изнутри), - и повернутых обратной стороной. Среднее число отсеченных за кадр - в JSON (culled_meshlets)
+// С --sort-last - растеризация в буферы потоков без блокировок и их сведение (PipelineOptions::sort_last): сведение
+// входит в стадию fs и выводится еще отдельной стадией composite. Для сравнения с общим буфером по числу потоков
+
+using namespace plane_render;
+
+namespace {
+
+class SkyboxFS : public FragmentShader
+{
+public:
+    using FragmentShader::FragmentShader;
+
+    virtual Color ProcessFragment(const Vertex& vertex_avg) const override
+    {
+        return texture_.GetPoint(vertex_avg.texture_coords);
+    }
+};
+
+struct Config
+{
+    std::string models_dir;
+    std::string json_filename = "benchmark_suite.json";
+    std::string label; // Например, хэш коммита
+    std::vector<std::string> scenes = { "cube", "sphere", "cat2", "plane" };
+    std::vector<std::pair<int, int>> resolutions = { {640, 360}, {1280, 720}, {1920, 1080} };
+    std::vector<size_t> threads = { 1, 2, 4, 8 };
+    int frames = 200;
+    int warmup = 20;
+    bool pin = true;
+    bool counters = false;
+    bool shadows = false;
+    bool shadow_map = false;
+    bool depth_prepass = false;
+    bool front_to_back = false;
+    bool occlusion = false;
+    bool meshlets = false;
+    bool sort_last = false;
+};
+
+struct Scene
+{
+    std::vector<SceneObject> objects;
+    FastVector3D at;
+    float orbit_radius;
+};
+
+constexpr float ZNear = 0.1f;
+constexpr float ZFar = 1050.f; // Для plane: небесная сфера радиусом 1000
+constexpr float Theta = 0.4f; // Наклон облета
+
+// Одиночная модель, приведенная к единичному радиусу
+Scene LoadModel(const RenderingGeometryPtr& geom, const std::string& obj_filename, const std::string& ppm_filename)
+{
+    Scene scene;
+    scene.objects.emplace_back(geom, obj_filename, SceneObject::FitRadius{1.f});
+    scene.objects.back().SetShaders<SceneObject::VertexShader, FragmentShader>();
+    scene.objects.back().GetFS()->LoadTexture(ppm_filename);
+    scene.objects.back().SetBackfaceCulling(true); // Модели замкнуты, действует только с --meshlets
+    scene.at = scene.objects.back().BoundingCenter();
+    scene.orbit_radius = 2.5f;
+    return scene;
+}
+
+Scene LoadScene(const RenderingGeometryPtr& geom, const std::string& models_dir, const std::string& name)
+{
+    const std::string cat_ppm = models_dir + "/cat/cat.ppm";
+    if (name == "cube" || name == "sphere" || name == "cat2")
+        return LoadModel(geom, models_dir + "/test_models/" + name + ".obj", cat_ppm);
+
+    if (name == "plane") // Как в projects/plane_render
+    {
+        Scene scene;
+        scene.objects.emplace_back(geom, models_dir + "/plane/A6M/A6M.obj", 1.f, 5);
+        scene.objects.back().SetShaders<SceneObject::VertexShader, FragmentShader>();
+        scene.objects.back().GetFS()->LoadTexture(models_dir + "/plane/A6M/A6M.ppm");
+        scene.objects.back().SetBackfaceCulling(true);
+
+        scene.objects.emplace_back(geom, models_dir + "/plane/sky/sky.obj", 1000, 1);
+        scene.objects.back().SetShaders<SceneObject::VertexShader, SkyboxFS>();
+        scene.objects.back().GetFS()->LoadTexture(cat_ppm); // Своей текстуры у неба в репозитории нет
+        scene.objects.back().SetCastsShadows(false);
+        scene.objects.back().SetReceivesShadows(false);
+        scene.at = FastVector3D{0.f, 0.f, 0.f};
+        scene.orbit_radius = 15.f;
+        return scene;
+    }
+
+    if (name == "crowd") // Большой куб в кольце котов: дальних от камеры он закрывает
+    {
+        constexpr size_t Cats = 12;
+        constexpr float RingRadius = 2.2f;
+        constexpr float CatRadius = 0.25f;
+
+        Scene scene;
+        const std::string cube_obj = models_dir + "/test_models/cube.obj";
+        scene.objects.emplace_back(geom, cube_obj, SceneObject::FitRadius{1.73f});
+        scene.objects.back().SetShaders<SceneObject::VertexShader, FragmentShader>();
+        scene.objects.back().GetFS()->LoadTexture(cat_ppm);
+        scene.objects.back().SetBackfaceCulling(true);
+        scene.objects.back().SetPosition(FastVector3D(FastVector3D(0.f, 0.f, 0.f) - scene.objects.back().BoundingCenter()).ToVector3D());
+
+        const std::string cat_obj = models_dir + "/test_models/cat2.obj";
+        for (size_t i = 0; i < Cats; i++)
+        {
+            float const phi = 2.f * 3.1415926f * i / Cats;
+            scene.objects.emplace_back(geom, cat_obj, SceneObject::FitRadius{CatRadius});
+            SceneObject& cat = scene.objects.back();
+            cat.SetShaders<SceneObject::VertexShader, FragmentShader>();
+            cat.GetFS()->LoadTexture(cat_ppm);
+            cat.SetBackfaceCulling(true);
+            FastVector3D const place(RingRadius * std::sin(phi), 0.f, RingRadius * std::cos(phi));
+            cat.SetPosition(FastVector3D(place - cat.BoundingCenter()).ToVector3D());
+        }
+        scene.at = FastVector3D{0.f, 0.f, 0.f};
+        scene.orbit_radius = 6.f;
+        return scene;
+    }
+
+    throw std::invalid_argument("Unknown scene: " + name);
+}
+
+struct Summary
+{
+    double mean = 0;
+    double stddev = 0;
+    double ci95 = 0; // Полуширина 95% доверительного интервала для среднего (нормальное приближение)
+    double min = 0;
+    double median = 0;
+    double p99 = 0;
+};
+
+Summary Summarize(std::vector<double> values)
+{
+    Summary s;
+    if (values.empty())
+        return s;
+
+    std::sort(values.begin(), values.end());
+    size_t const n = values.size();
+    s.mean = std::accumulate(values.begin(), values.end(), 0.) / n;
+    double sq = 0;
+    for (double v : values)
+        sq += (v - s.mean) * (v - s.mean);
+    s.stddev = n > 1 ? std::sqrt(sq / (n - 1)) : 0.;
+    s.ci95 = 1.96 * s.stddev / std::sqrt(static_cast<double>(n));
+    s.min = values.front();
+    s.median = values[n / 2];
+    s.p99 = values[std::min(n - 1, n * 99 / 100)];
+    return s;
+}
+
+struct RunResult
+{
+    std::string scene;
+    int width;
+    int height;
+    size_t threads;
+    double triangles; // Среднее за кадр (с учетом LOD)
+    double depth_fragments = 0; // Средние за кадр, см. FrameStats
+    double shaded_fragments = 0;
+    double occluded = 0; // Среднее за кадр число скрытых заслонителями объектов
+    double culled_meshlets = 0;
+    std::vector<std::pair<std::string, Summary>> stages;
+    std::vector<ThreadPool::WorkerStats> workers;
+    std::vector<PerfCounters::StageTotals> counters; // Суммы за все измеренные кадры
+    double shadow_map = 0; // Отрисовка карты теней в первом кадре прогрева, мс
+#ifdef LOCK_STATS_ENABLED
+    LockStats row_locks;  // Суммы за все измеренные кадры
+    LockStats task_locks;
+    LockStats hottest_row_locks; // Самый долгий за кадр ряд среди всех кадров
+    size_t hottest_row = 0;
+#endif
+};
+
+RunResult Run(const Config& config, const std::string& scene_name, int width, int height, size_t threads)
+{
+    RenderingGeometryPtr geom = std::make_shared<RenderingGeometry>(width, height, ZNear, ZFar, 1);
+    geom->SetLightSrcPos({1, 1, 3});
+    Scene scene = LoadScene(geom, config.models_dir, scene_name);
+
+    PipelineOptions options;
+    options.threads = threads;
+    options.pin_threads = config.pin;
+    options.frame_cache = false; // Первый кадр облета совпадает с первым кадром прогрева
+    options.ray_traced_shadows = config.shadows;
+    options.shadow_map = config.shadow_map;
+    options.depth_prepass = config.depth_prepass;
+    options.front_to_back = config.front_to_back;
+    options.occlusion_culling = config.occlusion;
+    options.meshlet_culling = config.meshlets;
+    options.sort_last = config.sort_last;
+    RasterizationPipeline pipeline(geom, std::move(scene.objects), "", options);
+
+    RunResult result;
+    std::vector<double> total, clear, vs, fs, passes, composite;
+    double triangles = 0;
+    for (int frame = -config.warmup; frame < config.frames; frame++)
+    {
+        if (frame == 0)
+        {
+            pipeline.GetThreadPool().ResetWorkerStats();
+            PerfCounters::Instance().Reset(); // Включены с прогрева, считаем отсюда
+        }
+
+        float const phi = 2.f * 3.1415926f * (frame < 0 ? frame + config.warmup : frame) / config.frames;
+        FastVector3D dir{std::sin(phi) * std::cos(Theta), std::sin(Theta), std::cos(phi) * std::cos(Theta)};
+        FastVector3D campos = dir * scene.orbit_radius;
+        geom->LookAt(static_cast<FastVector3D>(campos + scene.at).ToVector3D(), scene.at.ToVector3D());
+        pipeline.Update();
+        pipeline.GetPixels(); // Кадр должен быть готов к показу
+
+        const FrameStats& stats = pipeline.LastFrameStats();
+        if (frame == -config.warmup)
+            result.shadow_map = stats.shadow_map;
+        if (frame < 0)
+            continue;
+        total.push_back(stats.total);
+        clear.push_back(stats.clear);
+        vs.push_back(stats.vs);
+        fs.push_back(stats.fs);
+        passes.push_back(stats.passes);
+        composite.push_back(stats.composite);
+        triangles += stats.triangles;
+        result.depth_fragments += static_cast<double>(stats.depth_fragments) / config.frames;
+        result.shaded_fragments += static_cast<double>(stats.shaded_fragments) / config.frames;
+        result.occluded += static_cast<double>(stats.occluded) / config.frames;
+        result.culled_meshlets += static_cast<double>(stats.culled_meshlets) / config.frames;
+#ifdef LOCK_STATS_ENABLED
+        result.row_locks += stats.row_locks;
+        result.task_locks += stats.task_locks;
+        if (stats.hottest_row_locks.wait_ns > result.hottest_row_locks.wait_ns)
+        {
+            result.hottest_row_locks = stats.hottest_row_locks;
+            result.hottest_row = stats.hottest_row;
+        }
+#endif
+    }
+
+    result.scene = scene_name;
+    result.width = width;
+    result.height = height;
+    result.threads = threads;
+    result.triangles = triangles / config.frames;
+    result.stages = { {"total", Summarize(total)}, {"clear", Summarize(clear)},
+                      {"vs", Summarize(vs)}, {"fs", Summarize(fs)} };
+    if (config.shadows)
+        result.stages.emplace_back("passes", Summarize(passes));
+    if (config.sort_last)
+        result.stages.emplace_back("composite", Summarize(composite)); // Всегда последняя
+    result.workers = pipeline.GetThreadPool().GetWorkerStats();
+    if (config.counters)
+        result.counters = PerfCounters::Instance().Totals();
+    return result;
+}
+
+void WriteJson(const Config& config, const std::vector<RunResult>& results)
+{
+    std::ofstream out(config.json_filename);
+    if (!out)
+        throw std::runtime_error("Can't open " + config.json_filename);
+
+    out << "{\n  \"label\": \"" << config.label << "\",\n"
+        << "  \"timestamp\": " << std::time(nullptr) << ",\n"
+#ifdef NDEBUG
+        << "  \"build\": \"release\",\n"
+#else
+        << "  \"build\": \"debug\",\n"
+#endif
+        << "  \"hardware_concurrency\": " << std::thread::hardware_concurrency() << ",\n"
+        << "  \"frames\": " << config.frames << ",\n"
+        << "  \"warmup\": " << config.warmup << ",\n"
+        << "  \"pinned\": " << (config.pin ? "true" : "false") << ",\n"
+        << "  \"counters\": " << (config.counters ? "true" : "false") << ",\n"
+        << "  \"shadows\": " << (config.shadows ? "true" : "false") << ",\n"
+        << "  \"shadow_map\": " << (config.shadow_map ? "true" : "false") << ",\n"
+        << "  \"depth_prepass\": " << (config.depth_prepass ? "true" : "false") << ",\n"
+        << "  \"front_to_back\": " << (config.front_to_back ? "true" : "false") << ",\n"
+        << "  \"occlusion_culling\": " << (config.occlusion ? "true" : "false") << ",\n"
+        << "  \"meshlet_culling\": " << (config.meshlets ? "true" : "false") << ",\n"
+        << "  \"sort_last\": " << (config.sort_last ? "true" : "false") << ",\n"
+        << "  \"units\": \"ms\",\n"
+        << "  \"results\": [";
+    for (size_t r = 0; r < results.size(); r++)
+    {
+        const RunResult& res = results[r];
+        out << (r ? ",\n" : "\n") << "    {\"scene\": \"" << res.scene << "\", \"width\": " << res.width
+            << ", \"height\": " << res.height << ", \"threads\": " << res.threads
+            << ", \"triangles\": " << res.triangles << ", \"depth_fragments\": " << res.depth_fragments
+            << ", \"shaded_fragments\": " << res.shaded_fragments;
+        if (config.shadow_map)
+            out << ", \"shadow_map_ms\": " << res.shadow_map;
+        if (config.occlusion)
+            out << ", \"occluded\": " << res.occluded;
+        if (config.meshlets)
+            out << ", \"culled_meshlets\": " << res.culled_meshlets;
+        out << ",\n     \"stages\": {";
+        for (size_t s = 0; s < res.stages.size(); s++)
+        {
+            const Summary& sum = res.stages[s].second;
+            out << (s ? ",\n" : "\n") << "       \"" << res.stages[s].first << "\": {\"mean\": " << sum.mean
+                << ", \"stddev\": " << sum.stddev << ", \"ci95\": " << sum.ci95 << ", \"min\": " << sum.min
+                << ", \"median\": " << sum.median << ", \"p99\": " << sum.p99 << "}";
+        }
+        out << "},\n     \"workers\": [";
+        for (size_t w = 0; w < res.workers.size(); w++)
+            out << (w ? ", " : "") << "{\"busy\": " << res.workers[w].busy_ns / 1e6
+                << ", \"idle\": " << res.workers[w].idle_ns / 1e6 << ", \"tasks\": " << res.workers[w].tasks << "}";
+        out << "]";
+
+        if (!res.counters.empty())
+        {
+            // На кадр; недоступные счетчики - null
+            out << ",\n     \"counters\": {";
+            const PerfCounters& counters = PerfCounters::Instance();
+            for (size_t s = 0; s < res.counters.size(); s++)
+            {
+                const auto& stage = res.counters[s];
+                out << (s ? ",\n" : "\n") << "       \"" << stage.name << "\": {\"samples\": "
+                    << static_cast<double>(stage.samples) / config.frames;
+                for (size_t e = 0; e < PerfCounters::EventsCount; e++)
+                {
+                    auto const event = static_cast<PerfCounters::Event>(e);
+                    out << ", \"" << PerfCounters::EventName(event) << "\": ";
+                    if (counters.IsAvailable(event))
+                        out << stage.totals.values[e] / config.frames;
+                    else
+                        out << "null";
+                }
+                out << "}";
+            }
+            out << "}";
+        }
+#ifdef LOCK_STATS_ENABLED
+        {
+            auto write_locks = [&out](const LockStats& s, int frames)
+            {
+                out << "{\"acquires\": " << static_cast<double>(s.acquires) / frames
+                    << ", \"failed_cas\": " << static_cast<double>(s.failed_cas) / frames
+                    << ", \"yields\": " << static_cast<double>(s.yields) / frames
+                    << ", \"wait\": " << s.wait_ns / 1e6 / frames << "}";
+            };
+            // rows и tasks - на кадр, hottest_row - за один кадр
+            out << ",\n     \"locks\": {\"rows\": ";
+            write_locks(res.row_locks, config.frames);
+            out << ", \"tasks\": ";
+            write_locks(res.task_locks, config.frames);
+            out << ", \"hottest_row\": " << res.hottest_row << ", \"hottest_row_stats\": ";
+            write_locks(res.hottest_row_locks, 1);
+            out << "}";
+        }
+#endif
+        out << "}";
+    }
+    out << "\n  ]\n}\n";
+}
+
+// Кратко в stdout: IPC и промахи на кадр
+void PrintCounters(const RunResult& result, int frames)
+{
+    const PerfCounters& counters = PerfCounters::Instance();
+    for (const auto& stage : result.counters)
+    {
+        const auto& v = stage.totals.values;
+        std::cout << "    " << stage.name << ":";
+        if (counters.IsAvailable(PerfCounters::Cycles) && counters.IsAvailable(PerfCounters::Instructions))
+            std::cout << " cycles " << v[PerfCounters::Cycles] / frames
+                      << " ipc " << (v[PerfCounters::Cycles] > 0 ? v[PerfCounters::Instructions] / v[PerfCounters::Cycles] : 0.);
+        for (auto event : { PerfCounters::L1DMisses, PerfCounters::LLCMisses, PerfCounters::BranchMisses,
+                            PerfCounters::ContextSwitches })
+            if (counters.IsAvailable(event))
+                std::cout << " " << PerfCounters::EventName(event) << " " << v[event] / frames;
+        std::cout << std::endl;
+    }
+}
+
+template<typename T, typename Parser>
+std::vector<T> ParseList(const std::string& arg, Parser parser)
+{
+    std::vector<T> values;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+        values.push_back(parser(item));
+    return values;
+}
+
+Config ParseArgs(int argc, char* argv[])
+{
+    if (argc < 2)
+        throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" <models_dir> [ <json_filename> ]"
+                                    " [ --scenes cube,sphere,cat2,plane,crowd ] [ --resolutions 640x360,1280x720 ]"
+                                    " [ --threads 1,2,4,8 ] [ --frames N ] [ --warmup N ] [ --label str ] [ --no-pin ]"
+                                    " [ --counters ] [ --shadows ] [ --shadow-map ] [ --depth-prepass ]"
+                                    " [ --front-to-back ] [ --occlusion ] [ --meshlets ] [ --sort-last ]");
+
+    Config config;
+    config.models_dir = argv[1];
+    int i = 2;
+    if (i < argc && std::string(argv[i]).compare(0, 2, "--") != 0)
+        config.json_filename = argv[i++];
+
+    for (; i < argc; i++)
+    {
+        std::string const key = argv[i];
+        if (key == "--no-pin")
+        {
+            config.pin = false;
+            continue;
+        }
+        if (key == "--counters")
+        {
+            config.counters = true;
+            continue;
+        }
+        if (key == "--shadows")
+        {
+            config.shadows = true;
+            continue;
+        }
+        if (key == "--shadow-map")
+        {
+            config.shadow_map = true;
+            continue;
+        }
+        if (key == "--depth-prepass")
+        {
+            config.depth_prepass = true;
+            continue;
+        }
+        if (key == "--front-to-back")
+        {
+            config.front_to_back = true;
+            continue;
+        }
+        if (key == "--occlusion")
+        {
+            config.occlusion = true;
+            continue;
+        }
+        if (key == "--meshlets")
+        {
+            config.meshlets = true;
+            continue;
+        }
+        if (key == "--sort-last")
+        {
+            config.sort_last = true;
+            continue;
+        }
+        if (i + 1 >= argc)
+            throw std::invalid_argument("No value for " + key);
+
+        std::string const value = argv[++i];
+        if (key == "--scenes")
+            config.scenes = ParseList<std::string>(value, [](const std::string& s) { return s; });
+        else if (key == "--resolutions")
+            config.resolutions = ParseList<std::pair<int, int>>(value, [](const std::string& s)
+                                 {
+                                     size_t const x = s.find('x');
+                                     return std::make_pair(std::stoi(s.substr(0, x)), std::stoi(s.substr(x + 1)));
+                                 });
+        else if (key == "--threads")
+            config.threads = ParseList<size_t>(value, [](const std::string& s) { return std::stoul(s); });
+        else if (key == "--frames")
+            config.frames = std::stoi(value);
+        else if (key == "--warmup")
+            config.warmup = std::stoi(value);
+        else if (key == "--label")
+            config.label = value;
+        else
+            throw std::invalid_argument("Unknown option " + key);
+    }
+    return config;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ConfigureLogger("logger.conf");
+
+    Config const config = ParseArgs(argc, argv);
+    if (config.pin)
+        ThreadPool::PinCurrentThread(0); // Рабочие потоки - с ядра 1, см. ThreadPool
+    PerfCounters::Instance().SetEnabled(config.counters);
+
+    std::vector<RunResult> results;
+    std::cout << "scene\tresolution\tthreads\ttriangles\ttotal mean\t+-ci95\tmedian\tp99\tclear\tvs\tfs"
+              << (config.shadows ? "\tpasses" : "") << (config.shadow_map ? "\tshadow map" : "")
+              << (config.depth_prepass || config.front_to_back ? "\tdepth frags\tshaded frags" : "")
+              << (config.occlusion ? "\toccluded" : "") << (config.meshlets ? "\tculled meshlets" : "")
+              << (config.sort_last ? "\tcomposite" : "") << std::endl;
+    for (const auto& scene : config.scenes)
+     for (const auto& res : config.resolutions)
+      for (size_t threads : config.threads)
+      {
+          results.push_back(Run(config, scene, res.first, res.second, threads));
+          const RunResult& r = results.back();
+          const Summary& total = r.stages[0].second;
+          std::cout << scene << "\t" << res.first << "x" << res.second << "\t" << threads << "\t" << r.triangles
+                    << "\t" << total.mean << "\t" << total.ci95 << "\t" << total.median << "\t" << total.p99
+                    << "\t" << r.stages[1].second.mean << "\t" << r.stages[2].second.mean
+                    << "\t" << r.stages[3].second.mean;
+          if (config.shadows)
+              std::cout << "\t" << r.stages[4].second.mean;
+          if (config.shadow_map)
+              std::cout << "\t" << r.shadow_map;
+          if (config.depth_prepass || config.front_to_back)
+              std::cout << "\t" << r.depth_fragments << "\t" << r.shaded_fragments;
+          if (config.occlusion)
+              std::cout << "\t" << r.occluded;
+          if (config.meshlets)
+              std::cout << "\t" << r.culled_meshlets;
+          if (config.sort_last)
+              std::cout << "\t" << r.stages.back().second.mean;
+          std::cout << std::endl;
+          PrintCounters(r, config.frames);
+      }
+
+    WriteJson(config, results);
+    return 0;
+}
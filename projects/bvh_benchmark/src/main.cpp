@@ -0,0 +1,228 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <string>
+#include <vector>
+
+#include "rasterization/bvh.hpp"
+
+// Бенчмарк Bvh на моделях из models/: время сборки (в один поток и на пуле), число узлов и скорость
+// трассировки - первичные лучи с ближайшим попаданием и теневые лучи из точек попадания к свету
+// (любое попадание), миллионов лучей в секунду в один поток и на пуле.
+// Часть первичных лучей сверяется с перебором всех треугольников. Последняя сцена - вырожденная полоса
+// (см. CollinearStrip): проверка, что сборка не выходит за Bvh::MaxDepth.
+// Вариант пересечения с блоком треугольников - по ActiveIsa() (PLANE_RENDER_ISA=scalar - без AVX2)
+
+using namespace plane_render;
+
+namespace {
+
+constexpr float MinDepth = 1e-3f;
+constexpr float MaxDepth = 1e6f;
+constexpr int Repeats = 5;
+constexpr size_t CheckEvery = 61; // Сверка с перебором - для каждого такого луча
+
+struct Rays
+{
+    FastVec3DynamicArray origins;
+    FastVec3DynamicArray dirs;
+};
+
+// Лучи камеры, смотрящей на начало координат с расстояния 2.5 (модели - в единичной сфере), side x side
+Rays PrimaryRays(size_t side)
+{
+    FastVector3D const pos = FastVector3D(1.f, 0.7f, 0.5f).Normalized() * 2.5f;
+    FastVector3D const n = FastVector3D(pos * (-1.f)).Normalized();
+    FastVector3D const right = n.Cross(FastVector3D(0.f, 0.f, 1.f)).Normalized();
+    FastVector3D const up = right.Cross(n);
+    float const fov = 0.5f;
+
+    Rays rays;
+    for (size_t y = 0; y < side; y++)
+        for (size_t x = 0; x < side; x++)
+        {
+            float const rx = fov * (1.f - (x + 0.5f) * 2.f / side);
+            float const ry = fov * (1.f - (y + 0.5f) * 2.f / side);
+            rays.origins.push_back(pos);
+            rays.dirs.push_back(FastVector3D(n + right*rx + up*ry).Normalized());
+        }
+    return rays;
+}
+
+// Ближайшее пересечение перебором (двусторонний Мёллер-Трумбор, как в Bvh). Нет - MaxDepth
+float BruteForce(const std::vector<SceneObject>& objects, const FastVector3D& origin, const FastVector3D& dir)
+{
+    float best = MaxDepth;
+    for (const SceneObject& obj : objects)
+    {
+        const IndicesList& indices = obj.LodIndices(0);
+        const Vec4DynamicArray& coords = obj.SourceCoords();
+        for (size_t i = 0; i + 2 < indices.size(); i += 3)
+        {
+            FastVector3D const a = coords[indices[i]] + obj.Position();
+            FastVector3D const e1 = FastVector3D(coords[indices[i + 1]] + obj.Position()) - a;
+            FastVector3D const e2 = FastVector3D(coords[indices[i + 2]] + obj.Position()) - a;
+            FastVector3D const p = dir.Cross(e2);
+            float const det = e1.Dot(p);
+            if (std::abs(det) <= GraphicsEps)
+                continue;
+            FastVector3D const s = origin - a;
+            float const u = s.Dot(p) / det;
+            FastVector3D const q = s.Cross(e1);
+            float const v = dir.Dot(q) / det;
+            float const t = e2.Dot(q) / det;
+            if (u >= 0.f && v >= 0.f && u + v <= 1.f && t > MinDepth && t < best)
+                best = t;
+        }
+    }
+    return best;
+}
+
+// Лучшее из Repeats время f(), мс
+template<typename F>
+double Measure(F f)
+{
+    double best = 1e30;
+    for (int rep = 0; rep < Repeats; rep++)
+    {
+        auto const t0 = std::chrono::steady_clock::now();
+        f();
+        best = std::min(best, std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count());
+    }
+    return best;
+}
+
+// f(begin, end) по частям лучей на пуле, с ожиданием
+template<typename F>
+void RunParts(ThreadPool& pool, size_t count, F f)
+{
+    size_t const parts = pool.ThreadsCount();
+    for (size_t part = 0; part < parts; part++)
+        pool.AddTask([&f, part, parts, count]() { f(count*part/parts, count*(part+1)/parts); }, false);
+    pool.Join();
+}
+
+// Вырожденный меш: длинная полоса треугольников на оси x, вершины каждого - на одной прямой. Площади
+// параллелепипедов нулевые, SAH одинакова для всех разбиений, и выбирается первое - отщепляется одна корзина
+// центров из Bins за уровень: без ограничения глубины сборки дерево получается глубже стека обхода Bvh::MaxDepth
+std::vector<SceneObject> CollinearStrip(const RenderingGeometryPtr& geom)
+{
+    size_t const triangles = 4000;
+    std::vector<Vector3D> vertices;
+    std::vector<size_t> indices;
+    for (size_t t = 0; t < triangles; t++)
+    {
+        float const x = -1.f + 2.f * t / triangles;
+        for (float dx : { 0.f, 1.f / triangles, 2.f / triangles })
+        {
+            indices.push_back(vertices.size());
+            vertices.push_back({ x + dx, 0.f, 0.f });
+        }
+    }
+    std::vector<SceneObject> objects;
+    objects.emplace_back(geom, vertices, indices);
+    return objects;
+}
+
+// Как LoadModel в benchmark_suite: единичный радиус, центр - в начале координат
+std::vector<SceneObject> LoadModel(const RenderingGeometryPtr& geom, const std::string& obj_filename)
+{
+    std::vector<SceneObject> objects;
+    objects.emplace_back(geom, obj_filename, SceneObject::FitRadius{1.f});
+    objects.back().SetPosition(FastVector3D(objects.back().BoundingCenter() * (-1.f)).ToVector3D());
+    return objects;
+}
+
+void RunScene(const std::string& name, const std::vector<SceneObject>& objects, ThreadPool& single, ThreadPool& pool,
+              size_t side)
+{
+    double const build_single = Measure([&]() { Bvh bvh(objects, single); });
+    double const build_pool = Measure([&]() { Bvh bvh(objects, pool); });
+    Bvh const bvh(objects, pool);
+    std::cout << name << ": " << bvh.TrianglesCount() << " triangles, " << bvh.NodesCount() << " nodes, build "
+              << build_single << " ms (1 thread), " << build_pool << " ms (" << pool.ThreadsCount() << " threads)"
+              << std::endl;
+
+    Rays const primary = PrimaryRays(side);
+    size_t const count = primary.dirs.size();
+    std::vector<RayHit> hits(count);
+    auto const trace_primary = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+        {
+            hits[i] = RayHit();
+            bvh.Intersect(primary.origins[i], primary.dirs[i], MinDepth, MaxDepth, hits[i]);
+        }
+    };
+    double const primary_single = Measure([&]() { trace_primary(0, count); });
+    double const primary_pool = Measure([&]() { RunParts(pool, count, trace_primary); });
+
+    // Теневые лучи - из попаданий первичных к свету, t в (0, 1): отрезок до источника
+    FastVector3D const light(3.f, 2.f, 4.f);
+    Rays shadow;
+    for (size_t i = 0; i < count; i++)
+    {
+        if (hits[i].triangle == RayHit::None)
+            continue;
+        FastVector3D normal = bvh.GeometricNormal(hits[i].triangle).Normalized();
+        if (normal.Dot(primary.dirs[i]) > 0)
+            normal = normal * (-1.f);
+        FastVector3D const point = primary.origins[i] + primary.dirs[i]*hits[i].t + normal*MinDepth;
+        shadow.origins.push_back(point);
+        shadow.dirs.push_back(light - point);
+    }
+    size_t const shadow_count = shadow.dirs.size();
+    std::vector<char> occluded(shadow_count);
+    auto const trace_shadow = [&](size_t begin, size_t end)
+    {
+        for (size_t i = begin; i < end; i++)
+            occluded[i] = bvh.Occluded(shadow.origins[i], shadow.dirs[i], 0.f, 1.f);
+    };
+    double const shadow_single = Measure([&]() { trace_shadow(0, shadow_count); });
+    double const shadow_pool = Measure([&]() { RunParts(pool, shadow_count, trace_shadow); });
+
+    size_t checked = 0;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < count; i += CheckEvery, checked++)
+    {
+        float const expected = BruteForce(objects, primary.origins[i], primary.dirs[i]);
+        float const got = hits[i].triangle == RayHit::None ? MaxDepth : hits[i].t;
+        if (std::abs(expected - got) > 1e-4f * std::max(1.f, expected))
+            mismatches++;
+    }
+
+    auto const mrays = [](size_t rays, double ms) { return rays / ms / 1e3; };
+    std::cout << "    primary: " << count << " rays, " << shadow_count << " hits, " << mrays(count, primary_single)
+              << " Mrays/s (1 thread), " << mrays(count, primary_pool) << " Mrays/s (pool)" << std::endl
+              << "    shadow:  " << shadow_count << " rays, "
+              << std::count(occluded.begin(), occluded.end(), 1) << " occluded, "
+              << mrays(shadow_count, shadow_single) << " Mrays/s (1 thread), "
+              << mrays(shadow_count, shadow_pool) << " Mrays/s (pool)" << std::endl
+              << "    brute force check: " << mismatches << " of " << checked << " rays differ" << std::endl;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ConfigureLogger("logger.conf");
+
+    if (argc < 2)
+        throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" <models_dir> [ <threads> [ <rays per side> ] ]");
+    std::string const models_dir = argv[1];
+    size_t const threads = argc > 2 ? std::stoul(argv[2]) : 8;
+    size_t const side = argc > 3 ? std::stoul(argv[3]) : 512;
+
+    Isa const isa = ActiveIsa(); // Пишет в лог - до вывода в stdout
+    std::cout << "isa: " << IsaName(isa) << ", " << side << "x" << side << " rays" << std::endl;
+
+    RenderingGeometryPtr geom = std::make_shared<RenderingGeometry>(640, 360, 0.1, 20, 1, Vector3D{0.f, 0.f, 1.f});
+    ThreadPool single(1);
+    ThreadPool pool(threads);
+    RunScene("sphere", LoadModel(geom, models_dir + "/test_models/sphere.obj"), single, pool, side);
+    RunScene("cat2", LoadModel(geom, models_dir + "/test_models/cat2.obj"), single, pool, side);
+    RunScene("A6M", LoadModel(geom, models_dir + "/plane/A6M/A6M.obj"), single, pool, side);
+    RunScene("collinear strip", CollinearStrip(geom), single, pool, side);
+    return 0;
+}
@@ -0,0 +1,261 @@
+#include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <random>
+#include <string>
+#include <vector>
+
+#include "common/batch_math.hpp"
+
+// Микро-бенчмарк пакетной математики (common/batch_math.hpp) против AoS-типов basic_math.hpp, один поток.
+// Для каждой операции - три варианта: по одному вектору (AoS), пакетами по 8 с переводом AoS <-> SoA
+// (Load/Store - как при подмене в существующем коде) и пакетами по данным, уже лежащим в SoA.
+// Печатается время на вектор, ускорение относительно AoS и наибольшее расхождение результатов с AoS
+// Вариант пакетов - по ActiveIsa() (см. BatchIsa): SSE4.1 и AVX2 сравниваются в одной сборке через PLANE_RENDER_ISA
+
+using namespace plane_render;
+
+namespace {
+
+// Данные в обеих раскладках
+struct SoA
+{
+    std::vector<float> x, y, z, fourth;
+
+    explicit SoA(const Vec4DynamicArray& src)
+    {
+        for (const auto& v : src)
+        {
+            x.push_back(v.x);
+            y.push_back(v.y);
+            z.push_back(v.z);
+            fourth.push_back(v.fourth);
+        }
+    }
+    explicit SoA(size_t count) : x(count), y(count), z(count), fourth(count) {}
+
+    template<Isa I>
+    Vec3x8<I> Load3(size_t i) const { return { Float8<I>::Load(&x[i]), Float8<I>::Load(&y[i]), Float8<I>::Load(&z[i]) }; }
+    template<Isa I>
+    Vec4x8<I> Load4(size_t i) const
+    {
+        return { Float8<I>::Load(&x[i]), Float8<I>::Load(&y[i]), Float8<I>::Load(&z[i]), Float8<I>::Load(&fourth[i]) };
+    }
+    template<Isa I>
+    void Store(const Vec3x8<I>& v, size_t i) { v.x.Store(&x[i]); v.y.Store(&y[i]); v.z.Store(&z[i]); }
+    template<Isa I>
+    void Store(const Vec4x8<I>& v, size_t i) { Store(Vec3x8<I>{ v.x, v.y, v.z }, i); v.fourth.Store(&fourth[i]); }
+};
+
+// Проходы пакетами по всему массиву (count кратно BatchSize)
+template<Isa I>
+struct BatchPasses
+{
+    static void Dot(const FastVector3D* a, const FastVector3D* b, float* out, size_t count)
+    {
+        for (size_t i = 0; i < count; i += BatchSize)
+            Vec3x8<I>::Load(&a[i]).Dot(Vec3x8<I>::Load(&b[i])).Store(&out[i]);
+    }
+    static void DotSoA(const SoA& a, const SoA& b, float* out, size_t count)
+    {
+        for (size_t i = 0; i < count; i += BatchSize)
+            a.Load3<I>(i).Dot(b.Load3<I>(i)).Store(&out[i]);
+    }
+
+    static void CrossNormalized(const FastVector3D* a, const FastVector3D* b, FastVector3D* out, size_t count)
+    {
+        for (size_t i = 0; i < count; i += BatchSize)
+            Vec3x8<I>::Load(&a[i]).Cross(Vec3x8<I>::Load(&b[i])).Normalized().Store(&out[i]);
+    }
+    static void CrossNormalizedSoA(const SoA& a, const SoA& b, SoA& out, size_t count)
+    {
+        for (size_t i = 0; i < count; i += BatchSize)
+            out.Store(a.Load3<I>(i).Cross(b.Load3<I>(i)).Normalized(), i);
+    }
+
+    static void Transform(const Matrix4& m, const Vector4D* v, Vector4D* out, size_t count)
+    {
+        Mat4x8<I> const m8(m);
+        for (size_t i = 0; i < count; i += BatchSize)
+            (m8 * Vec4x8<I>::Load(&v[i])).Store(&out[i]);
+    }
+    static void TransformSoA(const Matrix4& m, const SoA& v, SoA& out, size_t count)
+    {
+        Mat4x8<I> const m8(m);
+        for (size_t i = 0; i < count; i += BatchSize)
+            out.Store(m8 * v.Load4<I>(i), i);
+    }
+};
+
+// Те же проходы, собранные под AVX2 целиком (см. PLANE_RENDER_BATCH_KERNEL_AVX2)
+struct BatchPassesAvx2
+{
+    using Passes = BatchPasses<Isa::Avx2>;
+
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void Dot(const FastVector3D* a, const FastVector3D* b, float* out, size_t count)
+    {
+        Passes::Dot(a, b, out, count);
+    }
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void DotSoA(const SoA& a, const SoA& b, float* out, size_t count)
+    {
+        Passes::DotSoA(a, b, out, count);
+    }
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void CrossNormalized(const FastVector3D* a, const FastVector3D* b,
+                                                               FastVector3D* out, size_t count)
+    {
+        Passes::CrossNormalized(a, b, out, count);
+    }
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void CrossNormalizedSoA(const SoA& a, const SoA& b, SoA& out, size_t count)
+    {
+        Passes::CrossNormalizedSoA(a, b, out, count);
+    }
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void Transform(const Matrix4& m, const Vector4D* v, Vector4D* out, size_t count)
+    {
+        Passes::Transform(m, v, out, count);
+    }
+    PLANE_RENDER_BATCH_KERNEL_AVX2 static void TransformSoA(const Matrix4& m, const SoA& v, SoA& out, size_t count)
+    {
+        Passes::TransformSoA(m, v, out, count);
+    }
+};
+
+// Проходы варианта, выбранного по ActiveIsa()
+struct PassTable
+{
+    decltype(&BatchPasses<Isa::Sse41>::Dot) dot;
+    decltype(&BatchPasses<Isa::Sse41>::DotSoA) dot_soa;
+    decltype(&BatchPasses<Isa::Sse41>::CrossNormalized) cross_normalized;
+    decltype(&BatchPasses<Isa::Sse41>::CrossNormalizedSoA) cross_normalized_soa;
+    decltype(&BatchPasses<Isa::Sse41>::Transform) transform;
+    decltype(&BatchPasses<Isa::Sse41>::TransformSoA) transform_soa;
+};
+
+template<typename P>
+PassTable MakePassTable()
+{
+    return { &P::Dot, &P::DotSoA, &P::CrossNormalized, &P::CrossNormalizedSoA, &P::Transform, &P::TransformSoA };
+}
+
+// Лучшее из нескольких повторов время одного прохода f(), нс на вектор
+template<typename F>
+double Measure(F f, size_t count, int passes)
+{
+    double best = 1e30;
+    for (int rep = 0; rep < 5; rep++)
+    {
+        auto const t0 = std::chrono::steady_clock::now();
+        for (int p = 0; p < passes; p++)
+            f();
+        std::chrono::duration<double, std::nano> const dt = std::chrono::steady_clock::now() - t0;
+        best = std::min(best, dt.count() / passes / count);
+    }
+    return best;
+}
+
+void Report(const std::string& name, double aos, double batch_aos, double batch_soa, float max_diff)
+{
+    std::cout << name << ": AoS " << aos << " ns, batch " << batch_aos << " ns (x" << aos / batch_aos
+              << "), batch SoA " << batch_soa << " ns (x" << aos / batch_soa << "), max diff " << max_diff << std::endl;
+}
+
+float MaxDiff(const float* a, const float* b, size_t count)
+{
+    float diff = 0.f;
+    for (size_t i = 0; i < count; i++)
+        diff = std::max(diff, std::abs(a[i] - b[i]));
+    return diff;
+}
+
+// Прежнее умножение матриц: столбцы m через _mm_set_ps и _mm_dp_ps - для сравнения
+Matrix4 MulDp(const Matrix4& a, const Matrix4& m)
+{
+    Matrix4 result = {};
+    for (size_t i = 0; i < 4; i++)
+     for (size_t j = 0; j < 4; j++)
+         result.rows[i].vals[j] = _mm_cvtss_f32(_mm_dp_ps(a.rows[i],
+                                                          _mm_set_ps(m.coeffitients[3][j], m.coeffitients[2][j],
+                                                                     m.coeffitients[1][j], m.coeffitients[0][j]), 0xF1));
+    return result;
+}
+
+} // namespace
+
+int main(int argc, char* argv[])
+{
+    ConfigureLogger("logger.conf");
+
+    // По умолчанию все массивы помещаются в L2: меряем вычисления, а не память
+    size_t const count = (argc > 1 ? std::stoul(argv[1]) : 4096) / BatchSize * BatchSize;
+    int const passes = argc > 2 ? std::stoi(argv[2]) : 2000;
+    if (count == 0)
+        throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" [ <vectors, >= 8> [ <passes> ] ]");
+
+    Isa const batch_isa = BatchIsa(ActiveIsa());
+    PassTable const batch_passes = batch_isa == Isa::Avx2 ? MakePassTable<BatchPassesAvx2>()
+                                                          : MakePassTable<BatchPasses<Isa::Sse41>>();
+    std::cout << "batch: " << IsaName(batch_isa) << ", " << count << " vectors x " << passes << " passes" << std::endl;
+
+    std::mt19937 gen(42);
+    std::uniform_real_distribution<float> dist(-10.f, 10.f);
+    FastVec3DynamicArray a(count), b(count), out3(count), out3_batch(count);
+    Vec4DynamicArray v(count), out4(count), out4_batch(count);
+    for (size_t i = 0; i < count; i++)
+    {
+        a[i] = FastVector3D(dist(gen), dist(gen), dist(gen));
+        b[i] = FastVector3D(dist(gen), dist(gen), dist(gen));
+        v[i] = Vector4D(dist(gen), dist(gen), dist(gen), 1.f);
+    }
+    SoA const a_soa(Vec4DynamicArray(a.begin(), a.end()));
+    SoA const b_soa(Vec4DynamicArray(b.begin(), b.end()));
+    SoA const v_soa(v);
+    SoA out_soa(count);
+    std::vector<float> dots(count), dots_batch(count);
+
+    // Dot
+    {
+        double const aos = Measure([&]() { for (size_t i = 0; i < count; i++) dots[i] = a[i].Dot(b[i]); }, count, passes);
+        double const batch = Measure([&]() { batch_passes.dot(a.data(), b.data(), dots_batch.data(), count); }, count, passes);
+        float const diff = MaxDiff(dots.data(), dots_batch.data(), count);
+        double const soa = Measure([&]() { batch_passes.dot_soa(a_soa, b_soa, dots_batch.data(), count); }, count, passes);
+        Report("Dot", aos, batch, soa, std::max(diff, MaxDiff(dots.data(), dots_batch.data(), count)));
+    }
+
+    // Cross + Normalized (как нормаль треугольника)
+    {
+        double const aos = Measure([&]() { for (size_t i = 0; i < count; i++) out3[i] = a[i].Cross(b[i]).Normalized(); },
+                                   count, passes);
+        double const batch = Measure([&]() { batch_passes.cross_normalized(a.data(), b.data(), out3_batch.data(), count); },
+                                     count, passes);
+        double const soa = Measure([&]() { batch_passes.cross_normalized_soa(a_soa, b_soa, out_soa, count); }, count, passes);
+        Report("Cross + Normalized", aos, batch, soa, MaxDiff(&out3[0].x, &out3_batch[0].x, count*4));
+    }
+
+    // Matrix4 * Vector4D (вершинный шейдер)
+    {
+        Matrix4 m = {};
+        for (size_t i = 0; i < 4; i++)
+         for (size_t j = 0; j < 4; j++)
+             m.coeffitients[i][j] = dist(gen);
+
+        double const aos = Measure([&]() { for (size_t i = 0; i < count; i++) out4[i] = m * v[i]; }, count, passes);
+        double const batch = Measure([&]() { batch_passes.transform(m, v.data(), out4_batch.data(), count); }, count, passes);
+        double const soa = Measure([&]() { batch_passes.transform_soa(m, v_soa, out_soa, count); }, count, passes);
+        Report("Matrix4 * Vector4D", aos, batch, soa, MaxDiff(&out4[0].x, &out4_batch[0].x, count*4));
+    }
+
+    // Matrix4 * Matrix4: комбинация строк против прежнего _mm_dp_ps по собранным столбцам
+    {
+        size_t const mats = count / 4;
+        VectorAlignment16<Matrix4> ms(mats), out_dp(mats), out_rows(mats);
+        for (size_t k = 0; k < mats; k++)
+            for (size_t i = 0; i < 4; i++)
+                ms[k].rows[i] = v[k*4 + i];
+        Matrix4 const rhs = ms[0];
+
+        double const dp = Measure([&]() { for (size_t k = 0; k < mats; k++) out_dp[k] = MulDp(ms[k], rhs); }, mats, passes);
+        double const rows = Measure([&]() { for (size_t k = 0; k < mats; k++) out_rows[k] = ms[k] * rhs; }, mats, passes);
+        std::cout << "Matrix4 * Matrix4: dp " << dp << " ns, rows " << rows << " ns (x" << dp / rows << "), max diff "
+                  << MaxDiff(&out_dp[0].coeffitients[0][0], &out_rows[0].coeffitients[0][0], mats*16) << std::endl;
+    }
+    return 0;
+}
@@ -45,7 +45,7 @@ int main(int argc, char* argv[])
     if (argc < 5)
         throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" <obj_name> <ppm_name>"
                                                                      " <skybox_obj_name> <skybox_ppm_name>"
-                                                                     " [ <perf_filename> ]");
+                                                                     " [ <perf_filename> [ <trace_filename> ] ]");
 
     RenderingGeometryPtr geom = std::make_shared<RenderingGeometry>(Width, Height, 0.1, 1050, 1);
     geom->SetLightSrcPos({1, 1, 3});
@@ -63,8 +63,12 @@ int main(int argc, char* argv[])
     if (argc > 5)
         perf_filename = argv[5];
 
+    PipelineOptions options;
+    if (argc > 6)
+        options.trace_filename = argv[6]; // Открывается в Perfetto
+
     RenderProviderPtr pipeline =
-        std::make_shared<RasterizationPipeline>(geom, std::move(objects), perf_filename);
+        std::make_shared<RasterizationPipeline>(geom, std::move(objects), perf_filename, options);
 
     SDLAdapter adapter(pipeline);
 
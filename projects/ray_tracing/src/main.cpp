@@ -1,6 +1,7 @@
 ﻿#include "raycast.hpp"
+#include "packet_tracer.hpp"
+#include "mesh_tracer.hpp"
 #include "rasterization/pipeline.hpp"
-#include "rasterization/fragment_shader.hpp"
 #include "sdl_adapter/sdl_adapter.hpp"
 
 #include <iostream>
@@ -29,92 +30,43 @@ sphere const sph[] =
 };
 int const sph_size = sizeof(sph) / sizeof(sphere);
 
-std::vector<Vector3D> verts = // Vector3D - для совместимости
-{
-    {-1.f, -1.f, 0.f },
-    {-1.f,  0.f, 0.f },
-    {-1.f,  1.f, 0.f },
-    { 0.f, -1.f, 0.f },
-    { 0.f,  0.f, 0.f },
-    { 0.f,  1.f, 0.f },
-    { 1.f, -1.f, 0.f },
-    { 1.f,  0.f, 0.f },
-    { 1.f,  1.f, 0.f }
-};
-std::vector<size_t> inds =
-{
-    0, 3, 1,
-    1, 3, 4,
-    3, 6, 4,
-    4, 6, 7,
-    1, 4, 2,
-    2, 4, 5,
-    4, 7, 5,
-    5, 7, 8
-};
-
-// =================== Шейдеры ==============================
-
-class CustomVS : public SceneObject::VertexShader
-{
-protected:
-    virtual void Update() override
-    {
-        const auto& src_coords = GetAssociatedSrcCoords();
-        auto& vertices = GetAssociatedVertices();
-
-        DCHECK(src_coords.size() == vertices.size());
-        for (size_t i = 0; i < src_coords.size(); i++)
-        {
-            vertices[i].vertex_coords = FastVector3D{ -src_coords[i].x, -src_coords[i].y, -1.f };
-            GetGeom().SetPixelPos(vertices[i].vertex_coords * (-1), vertices[i]);
-        }
-    }
-
-protected:
-    using SceneObject::VertexShader::VertexShader;
-    friend class SceneObject; // Чтобы создавал объекты
-};
-
+// =================== Полноэкранный проход ==============================
 
-class CustomFS : public FragmentShader
+// Луч на пиксель: плитки кадра раздает RasterizationPipeline, без растеризации прямоугольника во весь экран
+class RayTracingPass : public FullScreenPass
 {
 public:
-    using FragmentShader::FragmentShader;
+    using FullScreenPass::FullScreenPass;
 
-    // Инкапсулирует внешний код для фрагментного шейдера
-    vec3 RawProcessFragment(const Vertex& vertex_avg) const
+    // Базис камеры и свет - один раз на кадр
+    virtual void BeginFrame() override
     {
-        camera cam = { geom_->GetFov(), geom_->GetRatio(), ToVec3(geom_->CameraPosSrc()), 
-                       ToVec3(geom_->GetAt()), ToVec3(geom_->GetUp()) };
-        ray r = cast_from_cam(cam, { vertex_avg.vertex_coords.x, vertex_avg.vertex_coords.y } );
-        intersection const I = find_intersection(r, sph, sph_size);
-        if(I.idx < 0)
-            return vec3(0.1f, 0.1f, 0.4f);
-
-        vec3 const color = sph[I.idx].color;
-        vec3 const pos = ray_vec(r, I.t);
-        vec3 light = normalize(ToVec3(geom_->LightPos()));
-        intersection const shadow = find_intersection({pos, light}, sph, sph_size);
-        if(shadow.idx >= 0)
-            return color * 0.3f;
-        
-        vec3 const norm = normalize(pos - sph[I.idx].pos);
-        vec3 const halfway = normalize(light - r.dir);
-
-        float const NH = std::max(0.f, dot(norm, halfway));
-        float spec = NH;
-        for(int i = 0; i < 4; i++)
-            spec *= spec;
-        float const diff = std::max(0.f, dot(norm, light));
-        return color * (0.3f + 0.4f * diff + 0.3f * spec);
+        const RenderingGeometry& geom = GetGeom();
+        camera const cam = { geom.GetFov(), geom.GetRatio(), ToVec3(geom.CameraPosSrc()),
+                             ToVec3(geom.GetAt()), ToVec3(geom.GetUp()) };
+        frame_ = make_camera_frame(cam);
+        light_ = normalize(ToVec3(geom.LightPos()));
     }
 
-    virtual Color ProcessFragment(const Vertex& vertex_avg) const override
+    virtual void ProcessTile(const ScreenBuffer::TileSpan& span) override
     {
-        vec3 preprocessed = RawProcessFragment(vertex_avg);
-        return Color{0, 255.f*preprocessed.x, 255.f*preprocessed.y, 255.f*preprocessed.z};
+        float const width = static_cast<float>(GetGeom().Width());
+        float const height = static_cast<float>(GetGeom().Height());
+        for (size_t y = 0; y < span.height; y++)
+         for (size_t x = 0; x < span.width; x++)
+         {
+             // Координаты на экране - как в PacketTracer
+             vec2 const r = { 1.f - (span.x0 + x + 0.5f) * 2.f / width, 1.f - (span.y0 + y + 0.5f) * 2.f / height };
+             vec3 const c = shade_ray(cast_from_frame(frame_, r), sph, sph_size, light_);
+             span.Pixel(x, y) = Color{ 0, static_cast<Color::ColorElement>(255.f*c.x),
+                                       static_cast<Color::ColorElement>(255.f*c.y),
+                                       static_cast<Color::ColorElement>(255.f*c.z) };
+         }
     }
+
+private:
+    camera_frame frame_;
+    vec3 light_;
 };
 
 // =================== Код рисования ==============================
@@ -143,16 +95,34 @@ int main(int argc, char* argv[])
     RenderingGeometryPtr geom = std::make_shared<RenderingGeometry>(Width, Height, 0.1, 20, 1, Vector3D{0.f, 0.f, 1.f});
     geom->SetLightSrcPos({1, 1, 2});
 
-    std::vector<SceneObject> objects;
-    objects.emplace_back(geom, verts, inds, 1);
-    objects.back().SetShaders<CustomVS, CustomFS>();
-
     std::string perf_filename = std::string(argv[0]) + ".pd";
     if (argc > 1)
         perf_filename = argv[1];
 
-    RenderProviderPtr pipeline =
-        std::make_shared<RasterizationPipeline>(geom, std::move(objects), perf_filename);
+    // packets - пакетный трассировщик (PacketTracer), pass - луч на пиксель полноэкранным проходом RasterizationPipeline,
+    // mesh <obj> - модель из файла через Bvh (MeshTracer)
+    std::string const mode = argc > 2 ? argv[2] : "packets";
+    RenderProviderPtr pipeline;
+    if (mode == "packets")
+    {
+        pipeline = std::make_shared<PacketTracer>(geom, sph, sph_size, perf_filename);
+    }
+    else if (mode == "pass")
+    {
+        auto rasterization = std::make_shared<RasterizationPipeline>(geom, std::vector<SceneObject>(), perf_filename);
+        rasterization->AddPass(std::unique_ptr<FullScreenPass>(new RayTracingPass(geom)));
+        pipeline = rasterization;
+    }
+    else if (mode == "mesh" && argc > 3)
+    {
+        // Модель - в сферу радиуса 1 с центром в начале координат, чтобы попасть в облет из Measurement
+        std::vector<SceneObject> objects;
+        objects.emplace_back(geom, argv[3], SceneObject::FitRadius{1.f});
+        objects.back().SetPosition(FastVector3D(objects.back().BoundingCenter() * (-1.f)).ToVector3D());
+        pipeline = std::make_shared<MeshTracer>(geom, std::move(objects), perf_filename);
+    }
+    else
+        throw std::invalid_argument(std::string("Usage: ./")+argv[0]+" [ <perf_filename> [ packets | pass | mesh <obj> ] ]");
 
     SDLAdapter adapter(pipeline);
 
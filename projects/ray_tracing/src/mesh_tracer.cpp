@@ -0,0 +1,106 @@
+#include "mesh_tracer.hpp"
+
+#include "common/profiler.hpp"
+
+#include <chrono>
+
+namespace plane_render {
+
+namespace {
+
+constexpr float MinDepth = 1e-3f; // Как в find_intersection
+constexpr float MaxDepth = 1e6f;
+constexpr float ShadowOffset = 1e-3f; // Сдвиг начала теневого луча по нормали - чтобы не попасть в свой треугольник
+
+} // namespace
+
+MeshTracer::MeshTracer(const RenderingGeometryPtr& geom, std::vector<SceneObject>&& objects,
+                       const std::string& perf_filename, size_t threads) :
+    geom_(geom),
+    objects_(std::move(objects)),
+    pool_(threads),
+    pixels_(static_cast<size_t>(geom_->Width())*geom_->Height())
+{
+    auto const t0 = std::chrono::steady_clock::now();
+    bvh_.reset(new Bvh(objects_, pool_));
+    LOG(INFO) << "Mesh tracing: BVH over " << bvh_->TrianglesCount() << " triangles, " << bvh_->NodesCount()
+              << " nodes, built in " << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count()
+              << " ms";
+
+    if (!perf_filename.empty())
+        perf_output_.open(perf_filename, std::ios_base::out);
+}
+
+void MeshTracer::MoveCam(float dx, float dy, float dz)
+{
+    geom_->MoveCam({ dx, dy, dz });
+    Update();
+}
+
+void MeshTracer::MoveAt(float dx, float dy, float dz)
+{
+    geom_->MoveAt({ dx, dy, dz });
+    Update();
+}
+
+void MeshTracer::Update()
+{
+    auto const t0 = std::chrono::steady_clock::now();
+
+    FastVector3D const pos = geom_->CameraPosSrc();
+    Vector3D const at = geom_->GetAt();
+    Vector3D const up = geom_->GetUp();
+    camera const cam = { geom_->GetFov(), geom_->GetRatio(), vec3(pos.x, pos.y, pos.z), vec3(at.x, at.y, at.z),
+                         vec3(up.x, up.y, up.z) };
+    frame_ = make_camera_frame(cam);
+    light_ = geom_->LightPosSrc();
+
+    {
+        PROFILE_SCOPE("mesh tracing");
+        size_t const height = geom_->Height();
+        for (size_t row = 0; row < height; row += RowsPerTask)
+            pool_.AddTask([this, row, height]() { TraceRows(row, std::min(RowsPerTask, height - row)); }, false);
+        pool_.Join();
+    }
+
+    if (perf_output_.is_open())
+        perf_output_ << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << std::endl;
+}
+
+void MeshTracer::TraceRows(size_t first_row, size_t rows)
+{
+    size_t const width = geom_->Width();
+    FastVector3D const origin(frame_.pos.x, frame_.pos.y, frame_.pos.z);
+    for (size_t y = first_row; y < first_row + rows; y++)
+    {
+        for (size_t x = 0; x < width; x++)
+        {
+            ray const r = cast_from_frame(frame_, { RayX(x), RayY(y) });
+            FastVector3D const dir(r.dir.x, r.dir.y, r.dir.z);
+
+            Color& out = pixels_[y*width + x];
+            RayHit hit;
+            if (!bvh_->Intersect(origin, dir, MinDepth, MaxDepth, hit))
+            {
+                out = Color{ 0, 25, 25, 102 }; // Фон - как у shade_ray
+                continue;
+            }
+
+            // Нормаль - к камере: у мешей бывают треугольники с обоими обходами
+            FastVector3D normal = bvh_->GeometricNormal(hit.triangle).Normalized();
+            if (normal.Dot(dir) > 0)
+                normal = normal * (-1.f);
+
+            FastVector3D const point = origin + dir*hit.t + normal*ShadowOffset;
+            FastVector3D const to_light = light_ - point;
+            float const diff = std::max(normal.Dot(to_light.Normalized()), 0.f);
+            bool const shadowed = diff > 0 && bvh_->Occluded(point, to_light, 0.f, 1.f);
+
+            float const k = 0.3f + (shadowed ? 0.f : 0.7f*diff);
+            Color::ColorElement const c = static_cast<Color::ColorElement>(255.f*k);
+            out = Color{ 0, c, c, c };
+        }
+    }
+}
+
+} // namespace plane_render
@@ -0,0 +1,62 @@
+#pragma once
+
+#include "raycast.hpp"
+
+#include "rasterization/bvh.hpp"
+#include "rasterization/rendering_geometry.hpp"
+#include "threadpool/threadpool.hpp"
+#include "sdl_adapter/render_provider.hpp"
+
+#include <fstream>
+#include <memory>
+#include <vector>
+
+namespace plane_render {
+
+// Трассировка треугольных мешей (SceneObject) через Bvh: первичный луч на пиксель - ближайшее попадание,
+// из точки попадания - теневой луч к источнику света (LightPosSrc, любое попадание). Освещение по Ламберту
+// по нормали плоскости треугольника. Ряды раздаются пулу, Bvh строится один раз в конструкторе
+class MeshTracer : public IRenderProvider
+{
+public:
+    static constexpr size_t RowsPerTask = 8;
+
+    // perf_filename - куда писать время кадра, мс (пусто - никуда)
+    MeshTracer(const RenderingGeometryPtr& geom, std::vector<SceneObject>&& objects,
+               const std::string& perf_filename, size_t threads = 8);
+    MeshTracer(const MeshTracer&) = delete;
+    MeshTracer& operator=(const MeshTracer&) = delete;
+
+    virtual void MoveCam(float dx, float dy, float dz) override;
+    virtual void MoveAt (float dx, float dy, float dz) override;
+    virtual void Update() override;
+
+    virtual const Color* GetPixels() const override { return pixels_.data(); }
+    virtual size_t GetBufferSize() const override   { return pixels_.size()*sizeof(Color); }
+    virtual ScreenDimension ScreenWidth() const override  { return geom_->Width();  }
+    virtual ScreenDimension ScreenHeight() const override { return geom_->Height(); }
+
+    const Bvh& GetBvh() const { return *bvh_; }
+
+private:
+    void TraceRows(size_t first_row, size_t rows);
+
+    // Как в PacketTracer: пиксель -> координаты на экране
+    float RayX(size_t x) const { return 1.f - (x + 0.5f) * 2.f / geom_->Width(); }
+    float RayY(size_t y) const { return 1.f - (y + 0.5f) * 2.f / geom_->Height(); }
+
+private:
+    RenderingGeometryPtr geom_;
+    std::vector<SceneObject> objects_;
+    ThreadPool pool_;
+    std::unique_ptr<Bvh> bvh_;
+
+    std::vector<Color> pixels_;
+    std::ofstream perf_output_;
+
+    // Кадр
+    camera_frame frame_;
+    FastVector3D light_;
+};
+
+} // namespace plane_render
@@ -0,0 +1,236 @@
+#include "packet_tracer.hpp"
+
+#include "common/profiler.hpp"
+
+#include <chrono>
+
+namespace plane_render {
+
+namespace {
+
+constexpr float MinDepth = 1e-3f; // Как в find_intersection
+constexpr float MaxDepth = 1e6f;
+
+// Операции - в том же порядке, что в geom.hpp: пакет дает те же цвета, что shade_ray
+PLANE_RENDER_TARGET_AVX2 inline __m256 Dot8(__m256 ax, __m256 ay, __m256 az, __m256 bx, __m256 by, __m256 bz)
+{
+    return _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax, bx), _mm256_mul_ps(ay, by)), _mm256_mul_ps(az, bz));
+}
+
+PLANE_RENDER_TARGET_AVX2 inline void Normalize8(__m256& x, __m256& y, __m256& z)
+{
+    __m256 const len = _mm256_sqrt_ps(Dot8(x, y, z, x, y, z));
+    x = _mm256_div_ps(x, len);
+    y = _mm256_div_ps(y, len);
+    z = _mm256_div_ps(z, len);
+}
+
+// Пересечение 8 лучей со сферой (как intersect_sphere): t и маска попаданий с t в (MinDepth, depth)
+PLANE_RENDER_TARGET_AVX2 inline __m256 IntersectSphere8(__m256 rp_x, __m256 rp_y, __m256 rp_z, __m256 rp_sq,
+                                                        __m256 dx, __m256 dy, __m256 dz, __m256 r_sq,
+                                                        __m256 depth, __m256& t)
+{
+    __m256 const ra_rp = Dot8(dx, dy, dz, rp_x, rp_y, rp_z);
+    __m256 const d = _mm256_add_ps(_mm256_sub_ps(_mm256_mul_ps(ra_rp, ra_rp), rp_sq), r_sq);
+    t = _mm256_sub_ps(_mm256_xor_ps(ra_rp, _mm256_set1_ps(-0.f)), _mm256_sqrt_ps(d));
+
+    __m256 const zero = _mm256_setzero_ps();
+    __m256 const valid = _mm256_and_ps(_mm256_cmp_ps(ra_rp, zero, _CMP_LE_OQ), _mm256_cmp_ps(d, zero, _CMP_GE_OQ));
+    return _mm256_and_ps(valid, _mm256_and_ps(_mm256_cmp_ps(t, _mm256_set1_ps(MinDepth), _CMP_GT_OQ),
+                                              _mm256_cmp_ps(t, depth, _CMP_LT_OQ)));
+}
+
+} // namespace
+
+PacketTracer::PacketTracer(const RenderingGeometryPtr& geom, const sphere* spheres, int spheres_count,
+                           const std::string& perf_filename, size_t threads) :
+    geom_(geom),
+    spheres_(spheres),
+    spheres_count_(spheres_count),
+    pool_(threads),
+    packets_(ActiveIsa() >= Isa::Avx2),
+    pixels_(static_cast<size_t>(geom_->Width())*geom_->Height())
+{
+    for (int i = 0; i < spheres_count_; i++)
+    {
+        const sphere& s = spheres_[i];
+        soa_.x.push_back(s.pos.x);
+        soa_.y.push_back(s.pos.y);
+        soa_.z.push_back(s.pos.z);
+        soa_.r_sq.push_back(s.R * s.R);
+        soa_.red.push_back(s.color.x);
+        soa_.green.push_back(s.color.y);
+        soa_.blue.push_back(s.color.z);
+    }
+    soa_.primary_rp_sq.resize(spheres_count_);
+
+    if (!perf_filename.empty())
+        perf_output_.open(perf_filename, std::ios_base::out);
+    LOG(INFO) << "Ray tracing: " << (packets_ ? "8-ray AVX2 packets" : "single rays");
+}
+
+void PacketTracer::MoveCam(float dx, float dy, float dz)
+{
+    geom_->MoveCam({ dx, dy, dz });
+    Update();
+}
+
+void PacketTracer::MoveAt(float dx, float dy, float dz)
+{
+    geom_->MoveAt({ dx, dy, dz });
+    Update();
+}
+
+void PacketTracer::Update()
+{
+    auto const t0 = std::chrono::steady_clock::now();
+
+    FastVector3D const pos = geom_->CameraPosSrc();
+    Vector3D const at = geom_->GetAt();
+    Vector3D const up = geom_->GetUp();
+    FastVector3D const light = geom_->LightPos();
+    camera const cam = { geom_->GetFov(), geom_->GetRatio(), vec3(pos.x, pos.y, pos.z), vec3(at.x, at.y, at.z),
+                         vec3(up.x, up.y, up.z) };
+    frame_ = make_camera_frame(cam);
+    light_ = normalize(vec3(light.x, light.y, light.z));
+    for (int i = 0; i < spheres_count_; i++)
+    {
+        vec3 const rp = frame_.pos - spheres_[i].pos;
+        soa_.primary_rp_sq[i] = dot(rp, rp);
+    }
+
+    {
+        PROFILE_SCOPE("ray tracing");
+        size_t const height = geom_->Height();
+        for (size_t row = 0; row < height; row += RowsPerTask)
+            pool_.AddTask([this, row, height]() { TraceRows(row, std::min(RowsPerTask, height - row)); }, false);
+        pool_.Join();
+    }
+
+    if (perf_output_.is_open())
+        perf_output_ << std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - t0).count() << std::endl;
+}
+
+void PacketTracer::TraceRows(size_t first_row, size_t rows)
+{
+    size_t const width = geom_->Width();
+    size_t const packets_end = packets_ ? width / PacketSize * PacketSize : 0;
+    for (size_t y = first_row; y < first_row + rows; y++)
+    {
+        if (packets_)
+            TracePackets(y);
+        for (size_t x = packets_end; x < width; x++)
+            TraceScalar(x, y);
+    }
+}
+
+void PacketTracer::TraceScalar(size_t x, size_t y)
+{
+    vec3 const c = shade_ray(cast_from_frame(frame_, { RayX(x), RayY(y) }), spheres_, spheres_count_, light_);
+    pixels_[y*geom_->Width() + x] = Color{ 0, static_cast<Color::ColorElement>(255.f*c.x),
+                                           static_cast<Color::ColorElement>(255.f*c.y),
+                                           static_cast<Color::ColorElement>(255.f*c.z) };
+}
+
+void PacketTracer::TracePackets(size_t row)
+{
+    size_t const width = geom_->Width();
+    Color* out = pixels_.data() + row*width;
+
+    __m256 const zero = _mm256_setzero_ps();
+    __m256 const ones = _mm256_set1_ps(1.f);
+    __m256 const all = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+    __m256 const lanes = _mm256_set_ps(7.f, 6.f, 5.f, 4.f, 3.f, 2.f, 1.f, 0.f);
+    __m256 const ray_y = _mm256_set1_ps(RayY(row));
+    __m256 const light_x = _mm256_set1_ps(light_.x);
+    __m256 const light_y = _mm256_set1_ps(light_.y);
+    __m256 const light_z = _mm256_set1_ps(light_.z);
+
+    for (size_t x0 = 0; x0 + PacketSize <= width; x0 += PacketSize)
+    {
+        // Первичные лучи: общее начало, направления - как в cast_from_frame
+        __m256 const pixel_x = _mm256_add_ps(_mm256_set1_ps(static_cast<float>(x0)), lanes);
+        __m256 const ray_x = _mm256_sub_ps(ones, _mm256_div_ps(_mm256_mul_ps(_mm256_add_ps(pixel_x, _mm256_set1_ps(0.5f)),
+                                                                            _mm256_set1_ps(2.f)),
+                                                              _mm256_set1_ps(static_cast<float>(width))));
+        __m256 dx = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(frame_.n.x), _mm256_mul_ps(_mm256_set1_ps(frame_.x.x), ray_x)),
+                                  _mm256_mul_ps(_mm256_set1_ps(frame_.y.x), ray_y));
+        __m256 dy = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(frame_.n.y), _mm256_mul_ps(_mm256_set1_ps(frame_.x.y), ray_x)),
+                                  _mm256_mul_ps(_mm256_set1_ps(frame_.y.y), ray_y));
+        __m256 dz = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(frame_.n.z), _mm256_mul_ps(_mm256_set1_ps(frame_.x.z), ray_x)),
+                                  _mm256_mul_ps(_mm256_set1_ps(frame_.y.z), ray_y));
+        Normalize8(dx, dy, dz);
+
+        // Ближайшее попадание: индекс сферы (-1 - нет) и глубина
+        __m256 depth = _mm256_set1_ps(MaxDepth);
+        __m256 idx = _mm256_set1_ps(-1.f);
+        for (int i = 0; i < spheres_count_; i++)
+        {
+            __m256 t;
+            __m256 const hit = IntersectSphere8(_mm256_set1_ps(frame_.pos.x - soa_.x[i]), _mm256_set1_ps(frame_.pos.y - soa_.y[i]),
+                                                _mm256_set1_ps(frame_.pos.z - soa_.z[i]), _mm256_set1_ps(soa_.primary_rp_sq[i]),
+                                                dx, dy, dz, _mm256_set1_ps(soa_.r_sq[i]), depth, t);
+            depth = _mm256_blendv_ps(depth, t, hit);
+            idx = _mm256_blendv_ps(idx, _mm256_set1_ps(static_cast<float>(i)), hit);
+        }
+        __m256 const any_hit = _mm256_cmp_ps(idx, zero, _CMP_GE_OQ);
+        int const hit_lanes = _mm256_movemask_ps(any_hit);
+
+        __m256 red = _mm256_set1_ps(0.1f);
+        __m256 green = _mm256_set1_ps(0.1f);
+        __m256 blue = _mm256_set1_ps(0.4f);
+        if (hit_lanes)
+        {
+            __m256i const sphere_idx = _mm256_cvttps_epi32(_mm256_max_ps(idx, zero));
+            __m256 const pos_x = _mm256_add_ps(_mm256_set1_ps(frame_.pos.x), _mm256_mul_ps(dx, depth));
+            __m256 const pos_y = _mm256_add_ps(_mm256_set1_ps(frame_.pos.y), _mm256_mul_ps(dy, depth));
+            __m256 const pos_z = _mm256_add_ps(_mm256_set1_ps(frame_.pos.z), _mm256_mul_ps(dz, depth));
+
+            // Теневые лучи к свету: любое попадание, все дорожки с попаданием закрыты - дальше не ищем
+            __m256 occluded = zero;
+            __m256 const done_lanes = _mm256_xor_ps(any_hit, all); // Промахи тени не ищут
+            for (int i = 0; i < spheres_count_ && _mm256_movemask_ps(_mm256_or_ps(occluded, done_lanes)) != 0xFF; i++)
+            {
+                __m256 const rp_x = _mm256_sub_ps(pos_x, _mm256_set1_ps(soa_.x[i]));
+                __m256 const rp_y = _mm256_sub_ps(pos_y, _mm256_set1_ps(soa_.y[i]));
+                __m256 const rp_z = _mm256_sub_ps(pos_z, _mm256_set1_ps(soa_.z[i]));
+                __m256 t;
+                occluded = _mm256_or_ps(occluded, IntersectSphere8(rp_x, rp_y, rp_z, Dot8(rp_x, rp_y, rp_z, rp_x, rp_y, rp_z),
+                                                                   light_x, light_y, light_z, _mm256_set1_ps(soa_.r_sq[i]),
+                                                                   _mm256_set1_ps(MaxDepth), t));
+            }
+
+            // Блинн-Фонг, в тени - только фоновая составляющая
+            __m256 norm_x = _mm256_sub_ps(pos_x, _mm256_i32gather_ps(soa_.x.data(), sphere_idx, 4));
+            __m256 norm_y = _mm256_sub_ps(pos_y, _mm256_i32gather_ps(soa_.y.data(), sphere_idx, 4));
+            __m256 norm_z = _mm256_sub_ps(pos_z, _mm256_i32gather_ps(soa_.z.data(), sphere_idx, 4));
+            Normalize8(norm_x, norm_y, norm_z);
+            __m256 half_x = _mm256_sub_ps(light_x, dx);
+            __m256 half_y = _mm256_sub_ps(light_y, dy);
+            __m256 half_z = _mm256_sub_ps(light_z, dz);
+            Normalize8(half_x, half_y, half_z);
+
+            __m256 spec = _mm256_max_ps(Dot8(norm_x, norm_y, norm_z, half_x, half_y, half_z), zero);
+            for (int i = 0; i < 4; i++)
+                spec = _mm256_mul_ps(spec, spec);
+            __m256 const diff = _mm256_max_ps(Dot8(norm_x, norm_y, norm_z, light_x, light_y, light_z), zero);
+            __m256 const ambient = _mm256_set1_ps(0.3f);
+            __m256 const lit = _mm256_add_ps(_mm256_add_ps(ambient, _mm256_mul_ps(_mm256_set1_ps(0.4f), diff)),
+                                             _mm256_mul_ps(_mm256_set1_ps(0.3f), spec));
+            __m256 const k = _mm256_blendv_ps(lit, ambient, occluded);
+
+            red = _mm256_blendv_ps(red, _mm256_mul_ps(_mm256_i32gather_ps(soa_.red.data(), sphere_idx, 4), k), any_hit);
+            green = _mm256_blendv_ps(green, _mm256_mul_ps(_mm256_i32gather_ps(soa_.green.data(), sphere_idx, 4), k), any_hit);
+            blue = _mm256_blendv_ps(blue, _mm256_mul_ps(_mm256_i32gather_ps(soa_.blue.data(), sphere_idx, 4), k), any_hit);
+        }
+
+        // В Color байты A, R, G, B (см. common_graphics.hpp), перевод в байт - отбрасыванием дробной части
+        __m256 const to_byte = _mm256_set1_ps(255.f);
+        __m256i const colors = _mm256_or_si256(_mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(to_byte, red)), 8),
+                               _mm256_or_si256(_mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(to_byte, green)), 16),
+                                               _mm256_slli_epi32(_mm256_cvttps_epi32(_mm256_mul_ps(to_byte, blue)), 24)));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + x0), colors);
+    }
+}
+
+} // namespace plane_render
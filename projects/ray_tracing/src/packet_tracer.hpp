@@ -0,0 +1,73 @@
+#pragma once
+
+#include "raycast.hpp"
+
+#include "rasterization/rendering_geometry.hpp"
+#include "threadpool/threadpool.hpp"
+#include "sdl_adapter/render_provider.hpp"
+
+#include <fstream>
+#include <vector>
+
+namespace plane_render {
+
+// Трассировка сферической сцены пакетами: 8 соседних пикселей ряда - 8 дорожек AVX2 (когерентные
+// первичные лучи из одной точки), проход по сферам в SoA-раскладке. Теневые лучи - тоже пакетами,
+// с выходом, как только закрыты все дорожки (нужно любое пересечение, а не ближайшее).
+// Базис камеры и общие для первичных лучей величины считаются один раз на кадр.
+// Без AVX2 (см. ActiveIsa) - по одному лучу через shade_ray, им же дорисовываются неполные пакеты
+class PacketTracer : public IRenderProvider
+{
+public:
+    static constexpr size_t PacketSize = 8;
+    static constexpr size_t RowsPerTask = 8;
+
+    // perf_filename - куда писать время кадра, мс (пусто - никуда)
+    PacketTracer(const RenderingGeometryPtr& geom, const sphere* spheres, int spheres_count,
+                 const std::string& perf_filename, size_t threads = 8);
+    PacketTracer(const PacketTracer&) = delete;
+    PacketTracer& operator=(const PacketTracer&) = delete;
+
+    virtual void MoveCam(float dx, float dy, float dz) override;
+    virtual void MoveAt (float dx, float dy, float dz) override;
+    virtual void Update() override;
+
+    virtual const Color* GetPixels() const override { return pixels_.data(); }
+    virtual size_t GetBufferSize() const override   { return pixels_.size()*sizeof(Color); }
+    virtual ScreenDimension ScreenWidth() const override  { return geom_->Width();  }
+    virtual ScreenDimension ScreenHeight() const override { return geom_->Height(); }
+
+private:
+    // Сферы по компонентам: пакет берет по одному значению на все дорожки, цвет и центр попаданий - gather
+    struct SpheresSoA
+    {
+        std::vector<float> x, y, z, r_sq;
+        std::vector<float> red, green, blue;
+        std::vector<float> primary_rp_sq; // |камера - центр|^2: одно для всех первичных лучей кадра
+    };
+
+    void TraceRows(size_t first_row, size_t rows);
+    PLANE_RENDER_TARGET_AVX2 void TracePackets(size_t row); // Все полные пакеты ряда
+    void TraceScalar(size_t x, size_t y);
+
+    // Пиксель -> координаты на экране, как у растеризованного прямоугольника во всю камеру
+    float RayX(size_t x) const { return 1.f - (x + 0.5f) * 2.f / geom_->Width(); }
+    float RayY(size_t y) const { return 1.f - (y + 0.5f) * 2.f / geom_->Height(); }
+
+private:
+    RenderingGeometryPtr geom_;
+    const sphere* spheres_;
+    int spheres_count_;
+    SpheresSoA soa_;
+    ThreadPool pool_;
+    bool packets_;
+
+    std::vector<Color> pixels_;
+    std::ofstream perf_output_;
+
+    // Кадр
+    camera_frame frame_;
+    vec3 light_;
+};
+
+} // namespace plane_render
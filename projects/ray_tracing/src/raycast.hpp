@@ -2,6 +2,8 @@
 #include "geom.hpp"
 #include "common/logger.hpp"
 
+#include <algorithm>
+
 struct sphere
 {
     vec3 pos;
@@ -51,6 +53,36 @@ inline ray cast_from_cam(camera const &cam, vec2 const &r) noexcept
         normalize(n + x + y)
     };
 }
+// Базис камеры: считается один раз на кадр, а не для каждого луча
+struct camera_frame
+{
+    vec3 pos;
+    vec3 n; // Направление взгляда
+    vec3 x; // Сдвиг направления на единицу r.x
+    vec3 y; // И на единицу r.y
+};
+inline camera_frame make_camera_frame(camera const &cam) noexcept
+{
+    vec3 const n = normalize(cam.at - cam.pos);
+    vec3 const right = cross(n, cam.up);
+    vec3 const up = cross(right, n);
+    return camera_frame
+    {
+        cam.pos,
+        n,
+        normalize(right) * (cam.fov * cam.ratio),
+        normalize(up) * cam.fov
+    };
+}
+inline ray cast_from_frame(camera_frame const &f, vec2 const &r) noexcept
+{
+    return ray
+    {
+        f.pos,
+        normalize(f.n + f.x * r.x + f.y * r.y)
+    };
+}
+
 struct intersection
 {
     float t;
@@ -72,3 +104,27 @@ inline intersection find_intersection(ray const &r, sphere const *sph, int sph_s
     }
     return intersection{depth, idx == sph_sz ? -1 : idx};
 }
+
+// Цвет луча: Блинн-Фонг с тенью от точечного направления light (нормированного)
+inline vec3 shade_ray(ray const &r, sphere const *sph, int sph_sz, vec3 const &light) noexcept
+{
+    intersection const I = find_intersection(r, sph, sph_sz);
+    if(I.idx < 0)
+        return vec3(0.1f, 0.1f, 0.4f);
+
+    vec3 const color = sph[I.idx].color;
+    vec3 const pos = ray_vec(r, I.t);
+    intersection const shadow = find_intersection({pos, light}, sph, sph_sz);
+    if(shadow.idx >= 0)
+        return color * 0.3f;
+
+    vec3 const norm = normalize(pos - sph[I.idx].pos);
+    vec3 const halfway = normalize(light - r.dir);
+
+    float const NH = std::max(0.f, dot(norm, halfway));
+    float spec = NH;
+    for(int i = 0; i < 4; i++)
+        spec *= spec;
+    float const diff = std::max(0.f, dot(norm, light));
+    return color * (0.3f + 0.4f * diff + 0.3f * spec);
+}